@@ -483,6 +483,66 @@ static int cluster_enable_recover(int argc, char **argv)
 	return EXIT_SUCCESS;
 }
 
+static int cluster_recover_throttle(int argc, char **argv)
+{
+	int ret;
+	struct sd_req hdr;
+	struct sd_rsp *rsp = (struct sd_rsp *)&hdr;
+	struct recovery_throttle throttle = {};
+	char *p;
+
+	if (argc <= optind) {
+		sd_init_req(&hdr, SD_OP_GET_RECOVERY_THROTTLE);
+		hdr.data_length = sizeof(throttle);
+		ret = dog_exec_req(&sd_nid, &hdr, &throttle);
+		if (ret < 0)
+			return EXIT_SYSFAIL;
+		if (rsp->result != SD_RES_SUCCESS) {
+			sd_err("failed to get recovery throttle: %s",
+			       sd_strerror(rsp->result));
+			return EXIT_FAILURE;
+		}
+		goto out;
+	}
+
+	if (option_parse_size(argv[optind], &throttle.max_bps) < 0) {
+		sd_err("Invalid bandwidth '%s'", argv[optind]);
+		return EXIT_USAGE;
+	}
+
+	if (++optind < argc) {
+		throttle.max_ops = strtoul(argv[optind], &p, 10);
+		if (argv[optind] == p || *p != '\0') {
+			sd_err("Invalid number of objects '%s'", argv[optind]);
+			return EXIT_USAGE;
+		}
+	}
+
+	sd_init_req(&hdr, SD_OP_SET_RECOVERY_THROTTLE);
+	hdr.flags = SD_FLAG_CMD_WRITE;
+	hdr.data_length = sizeof(throttle);
+	ret = dog_exec_req(&sd_nid, &hdr, &throttle);
+	if (ret < 0)
+		return EXIT_SYSFAIL;
+	if (rsp->result != SD_RES_SUCCESS) {
+		sd_err("failed to set recovery throttle: %s",
+		       sd_strerror(rsp->result));
+		return EXIT_FAILURE;
+	}
+out:
+	printf("Cluster recovery throttle: ");
+	if (throttle.max_bps)
+		printf("%s/s", strnumber(throttle.max_bps));
+	else
+		printf("unlimited bandwidth");
+	if (throttle.max_ops)
+		printf(", %"PRIu32" objects/s\n", throttle.max_ops);
+	else
+		printf(", unlimited objects\n");
+
+	return EXIT_SUCCESS;
+}
+
 /* Subcommand list of recover */
 static struct subcommand cluster_recover_cmd[] = {
 	{"force", NULL, NULL, "force recover cluster immediately",
@@ -492,6 +552,9 @@ static struct subcommand cluster_recover_cmd[] = {
 	 NULL, 0, cluster_enable_recover},
 	{"disable", NULL, NULL, "disable automatic recovery",
 	 NULL, 0, cluster_disable_recover},
+	{"throttle", "[<bandwidth> [<objects>]]", NULL,
+	 "show or limit recovery bandwidth and objects per second, "
+	 "0 for unlimited", NULL, 0, cluster_recover_throttle},
 	{NULL},
 };
 
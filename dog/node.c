@@ -293,6 +293,102 @@ static int node_kill(int argc, char **argv)
 	return EXIT_SUCCESS;
 }
 
+static void print_store_stat(const struct sd_stat *stat)
+{
+	uint64_t total = stat->s.fd_cache_hit + stat->s.fd_cache_miss;
+
+	printf("%s%"PRIu64"\t%"PRIu64"\t%"PRIu64"\t%.1f%%\n",
+	       raw_output ? "" : "Store\tHit\tMiss\tCached\tHit%\nFD\t",
+	       stat->s.fd_cache_hit, stat->s.fd_cache_miss,
+	       stat->s.fd_cache_nr,
+	       total ? 100 * (double)stat->s.fd_cache_hit / total : 0.0);
+
+	printf("%s%"PRIu64"\t%.1f\t%"PRIu64"\t%.1f\n",
+	       raw_output ? "" : "Journal\tCommit\tAvg ms\tStall\tAvg ms\nData\t",
+	       stat->s.journal_commit_nr,
+	       stat->s.journal_commit_nr ? (double)stat->s.journal_commit_time /
+	       stat->s.journal_commit_nr / 1000000 : 0.0,
+	       stat->s.journal_stall_nr,
+	       stat->s.journal_stall_nr ? (double)stat->s.journal_stall_time /
+	       stat->s.journal_stall_nr / 1000000 : 0.0);
+}
+
+static void print_pool_stat(const struct sd_stat *stat)
+{
+	uint64_t req = stat->p.req_hit + stat->p.req_miss;
+	uint64_t buf = stat->p.buf_hit + stat->p.buf_miss;
+
+	printf("%s%"PRIu64"\t%"PRIu64"\t%.1f%%\n",
+	       raw_output ? "" : "Pool\tHit\tMiss\tHit%\nRequest\t",
+	       stat->p.req_hit, stat->p.req_miss,
+	       req ? 100 * (double)stat->p.req_hit / req : 0.0);
+	printf("%s%"PRIu64"\t%"PRIu64"\t%.1f%%\n",
+	       raw_output ? "" : "Buffer\t",
+	       stat->p.buf_hit, stat->p.buf_miss,
+	       buf ? 100 * (double)stat->p.buf_hit / buf : 0.0);
+}
+
+static void print_hedge_stat(const struct sd_stat *stat)
+{
+	printf("%s%"PRIu64"\t%"PRIu64"\n",
+	       raw_output ? "" : "Hedge\tSent\tWon\nRead\t",
+	       stat->r.gway_hedge_nr, stat->r.gway_hedge_win_nr);
+}
+
+static void print_tx_stat(const struct sd_stat *stat)
+{
+	printf("%s%"PRIu64"\t%"PRIu64"\t%.1f\n",
+	       raw_output ? "" : "Response\tSent\tSends\tBatch\nClient\t",
+	       stat->r.gway_tx_rsp_nr, stat->r.gway_tx_batch_nr,
+	       stat->r.gway_tx_batch_nr ?
+	       (double)stat->r.gway_tx_rsp_nr / stat->r.gway_tx_batch_nr : 0.0);
+}
+
+/* Main thread utilization, since 'last' or since the start if it's zero */
+static void print_main_stat(const struct sd_stat *stat,
+			    const struct sd_stat *last)
+{
+	uint64_t busy = stat->m.busy_time - last->m.busy_time;
+	uint64_t total = stat->m.up_time - last->m.up_time;
+	uint64_t done = stat->m.done_nr - last->m.done_nr;
+	uint64_t wakeup = stat->m.wakeup_nr - last->m.wakeup_nr;
+
+	printf("%s%.1f%%\t%"PRIu64"\t%.1f\t%"PRIu64"\n",
+	       raw_output ? "" :
+	       "Thread\tBusy%\tDone\tBatch\tWorker done\nMain\t",
+	       total ? 100 * (double)busy / total : 0.0, done,
+	       wakeup ? (double)done / wakeup : 0.0,
+	       stat->m.worker_done_nr - last->m.worker_done_nr);
+}
+
+/* Latency of the peers this node sends requests to */
+static void print_peer_stat(void)
+{
+	struct sd_req hdr;
+	struct sd_rsp *rsp = (struct sd_rsp *)&hdr;
+	struct sd_peer_stat *ps;
+	int ret, nr;
+
+	ps = xmalloc(sizeof(*ps) * SD_MAX_NODES);
+	sd_init_req(&hdr, SD_OP_STAT_PEER);
+	hdr.data_length = sizeof(*ps) * SD_MAX_NODES;
+	ret = dog_exec_req(&sd_nid, &hdr, ps);
+	/* older sheep don't track them */
+	if (ret < 0 || rsp->result != SD_RES_SUCCESS)
+		goto out;
+
+	nr = rsp->data_length / sizeof(*ps);
+	if (!raw_output && nr)
+		printf("Peer\tLatency ms\tInflight\tRequests\tErrors\n");
+	for (int i = 0; i < nr; i++)
+		printf("%s\t%.2f\t%"PRIu32"\t%"PRIu64"\t%"PRIu64"\n",
+		       addr_to_str(ps[i].nid.addr, ps[i].nid.port),
+		       (double)ps[i].latency / 1000000, ps[i].inflight,
+		       ps[i].nr, ps[i].nr_error);
+out:
+	free(ps);
+}
+
 static int node_stat(int argc, char **argv)
 {
 	struct sd_req hdr;
@@ -345,6 +441,8 @@ again:
 		       strnumber(stat.r.peer_total_tx - last.r.peer_total_tx),
 		       strnumber_raw(stat.r.peer_total_nr -
 				     last.r.peer_total_nr, true));
+		print_store_stat(&stat);
+		print_main_stat(&stat, &last);
 		last = stat;
 		sleep(1);
 		goto again;
@@ -367,6 +465,12 @@ again:
 		       stat.r.peer_total_remove_nr, 0UL,
 		       strnumber(stat.r.peer_total_rx),
 		       strnumber(stat.r.peer_total_tx));
+		print_store_stat(&stat);
+		print_pool_stat(&stat);
+		print_hedge_stat(&stat);
+		print_tx_stat(&stat);
+		print_main_stat(&stat, &last);
+		print_peer_stat();
 	}
 
 	return EXIT_SUCCESS;
@@ -2186,24 +2186,38 @@ static int vdi_cache_info(int argc, char **argv)
 		return EXIT_FAILURE;
 	}
 
-	fprintf(stdout, "Name\tTag\tTotal\tDirty\tClean\n");
+	fprintf(stdout, "Name\tTag\tTotal\tDirty\tClean\tPrefetched\tUsed\n");
 	for (i = 0; i < info.count; i++) {
 		uint64_t total = info.caches[i].total * SD_DATA_OBJ_SIZE,
 			 dirty = info.caches[i].dirty * SD_DATA_OBJ_SIZE,
-			 clean = total - dirty;
+			 clean = total - dirty,
+			 prefetched = info.caches[i].prefetched *
+				SD_DATA_OBJ_SIZE,
+			 used = info.caches[i].prefetch_hits *
+				SD_DATA_OBJ_SIZE;
 		char name[SD_MAX_VDI_LEN], tag[SD_MAX_VDI_TAG_LEN];
 
 		ret = vid_to_name_tag(info.caches[i].vid, name, tag);
 		if (ret != SD_RES_SUCCESS)
 			return EXIT_FAILURE;
-		fprintf(stdout, "%s\t%s\t%s\t%s\t%s\n",
+		fprintf(stdout, "%s\t%s\t%s\t%s\t%s\t%s\t%s\n",
 			name, tag, strnumber(total), strnumber(dirty),
-			strnumber(clean));
+			strnumber(clean), strnumber(prefetched),
+			strnumber(used));
 	}
 
 	fprintf(stdout, "\nCache size %s, used %s, %s\n",
 		strnumber(info.size), strnumber(info.used),
 		info.directio ? "directio" : "non-directio");
+	fprintf(stdout, "Read hit %s, partial hit %s, miss %s\n",
+		strnumber(info.hit_bytes), strnumber(info.partial_bytes),
+		strnumber(info.miss_bytes));
+	fprintf(stdout, "Write dirty %s, pushed %s", strnumber(info.dirty_bytes),
+		strnumber(info.push_bytes));
+	if (info.dirty_bytes)
+		fprintf(stdout, " (%.2fx)",
+			(double)info.push_bytes / info.dirty_bytes);
+	fprintf(stdout, "\n");
 
 	return EXIT_SUCCESS;
 }
@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2013 Nippon Telegraph and Telephone Corporation.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License version
+ * 2 as published by the Free Software Foundation.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CAR_H__
+#define __CAR_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "list.h"
+
+/*
+ * CAR, Clock with Adaptive Replacement, by Bansal and Modha
+ *
+ * It is ARC on two clocks: T1 holds the objects referenced once lately, T2
+ * the ones referenced more than once.  Their ghost lists B1 and B2 remember
+ * the keys recently evicted from them, and a miss on a ghost adapts the
+ * target size of T1.  A hit only sets the reference bit of the object, so it
+ * needs no lock, and an object which is referenced only once, like the ones
+ * of a scan, never gets into T2.
+ *
+ * The references in the first 'period' after an object is inserted are
+ * correlated with the one which inserted it, like the sequential reads of a
+ * scan, so they don't count.
+ *
+ * The caller serializes all the calls but car_hit().
+ */
+
+enum car_clock {
+	CAR_T1,
+	CAR_T2,
+	CAR_NR_CLOCKS,
+};
+
+struct car_node {
+	struct list_node list;
+	uint64_t key;
+	uint64_t stamp; /* When it was inserted */
+	uint8_t clock;
+	bool ref;
+};
+
+struct car {
+	struct list_head clocks[CAR_NR_CLOCKS]; /* The heads are the hands */
+	struct list_head ghosts[CAR_NR_CLOCKS]; /* In the LRU order */
+	struct hlist_head *ghost_hash;
+	unsigned ghost_hash_bits;
+	size_t nr[CAR_NR_CLOCKS];
+	size_t nr_ghosts[CAR_NR_CLOCKS];
+	size_t size; /* The nr of the objects the cache holds */
+	size_t target; /* The target size of T1 */
+	uint64_t period;
+};
+
+void car_init(struct car *car, size_t size, uint64_t period);
+void car_destroy(struct car *car);
+void car_insert(struct car *car, struct car_node *node, uint64_t key,
+		uint64_t now);
+void car_restore(struct car *car, struct car_node *node, uint64_t key,
+		 bool frequent);
+void car_remove(struct car *car, struct car_node *node);
+struct car_node *car_evict(struct car *car,
+			   bool (*evictable)(struct car_node *));
+
+static inline void car_hit(struct car *car, struct car_node *node,
+			   uint64_t now)
+{
+	if (!node->ref && now - node->stamp >= car->period)
+		node->ref = true;
+}
+
+static inline bool car_is_frequent(const struct car_node *node)
+{
+	return node->clock == CAR_T2;
+}
+
+#endif
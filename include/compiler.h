@@ -18,6 +18,7 @@
 #include <time.h>
 #include <signal.h>
 #include <stdint.h>
+#include <stdbool.h>
 
 #include "config.h"
 
@@ -123,11 +124,19 @@ static inline int fallocate(int fd, int mode, __off_t offset, __off_t len)
 }
 #endif
 
+#ifndef HAVE_SYNCFS
+static inline int syncfs(int fd)
+{
+	return syscall(__NR_syncfs, fd);
+}
+#endif
+
 #ifdef __x86_64__
 
 #define X86_FEATURE_SSSE3	(4 * 32 + 9) /* Supplemental SSE-3 */
 #define X86_FEATURE_OSXSAVE	(4 * 32 + 27) /* "" XSAVE enabled in the OS */
 #define X86_FEATURE_AVX	(4 * 32 + 28) /* Advanced Vector Extensions */
+#define X86_FEATURE_AVX2	(9 * 32 + 5) /* AVX2 instructions */
 
 #define XSTATE_FP	0x1
 #define XSTATE_SSE	0x2
@@ -163,6 +172,22 @@ static inline uint64_t xgetbv(uint32_t idx)
 #define cpu_has_ssse3           cpu_has(X86_FEATURE_SSSE3)
 #define cpu_has_avx		cpu_has(X86_FEATURE_AVX)
 #define cpu_has_osxsave		cpu_has(X86_FEATURE_OSXSAVE)
+#define cpu_has_avx2		cpu_has(X86_FEATURE_AVX2)
+
+/* Return true if both the CPU and the OS support the AVX (YMM) state */
+static inline bool avx_usable(void)
+{
+	uint64_t xcr0;
+
+	if (!cpu_has_avx || !cpu_has_osxsave)
+		return false;
+
+	xcr0 = xgetbv(XCR_XFEATURE_ENABLED_MASK);
+	if ((xcr0 & (XSTATE_SSE | XSTATE_YMM)) != (XSTATE_SSE | XSTATE_YMM))
+		return false;
+
+	return true;
+}
 
 #endif /* __x86_64__ */
 
@@ -3,6 +3,7 @@
 
 #include "list.h"
 #include <limits.h>
+#include <stdint.h>
 
 struct event_info;
 
@@ -15,6 +16,7 @@ int modify_event(int fd, unsigned int events);
 void event_loop(int timeout);
 void event_loop_prio(int timeout);
 void event_force_refresh(void);
+void get_event_loop_time(uint64_t *busy, uint64_t *total);
 
 struct timer {
 	void (*callback)(void *);
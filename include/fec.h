@@ -65,13 +65,28 @@
 #include "util.h"
 #include "sheepdog_proto.h"
 
+struct fec_decode_matrix;
+
 struct fec {
 	unsigned long magic;
 	unsigned short d, dp;                     /* parameters of the code */
 	uint8_t *enc_matrix;
+	/* inverted matrices of the recent input index sets */
+	struct fec_decode_matrix *dec_cache;
+	bool shared;                              /* owned by ec_init() */
 };
 
 void init_fec(void);
+
+/*
+ * The GF(2^8) multiply-accumulate kernel is chosen by init_fec() according to
+ * the CPU features ("generic", "ssse3" or "avx2").  fec_set_kernel() forces
+ * one for the tests and the benchmarks and returns false if the CPU can't run
+ * it.  They all produce the same result.
+ */
+const char *fec_kernel_name(void);
+bool fec_set_kernel(const char *name);
+
 /*
  * param d the number of blocks required to reconstruct
  * param dp the total number of blocks created
@@ -154,11 +169,13 @@ static inline int ec_policy_to_dp(uint8_t policy, int *d, int *p)
  *  R1    R2   R3   R4   R5   ...   Rn  Rn+1  Rn+2  Rn+3
  */
 
-/* Return the erasure code context to encode|decode */
-static inline struct fec *ec_init(int d, int dp)
-{
-	return fec_new(d, dp);
-}
+/*
+ * Return the erasure code context to encode|decode
+ *
+ * Contexts of the valid policies are built once and shared by all the
+ * threads, so this is cheap enough to call for every request.
+ */
+struct fec *ec_init(int d, int dp);
 
 /*
  * This function decodes the data strips and return the parity strips
@@ -194,7 +211,8 @@ void ec_decode(struct fec *ctx, const uint8_t *input[],
 /* Destroy the erasure code context */
 static inline void ec_destroy(struct fec *ctx)
 {
-	fec_free(ctx);
+	if (!ctx->shared)
+		fec_free(ctx);
 }
 
 void ec_decode_buffer(struct fec *ctx, uint8_t *input[], const int in_idx[],
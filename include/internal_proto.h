@@ -26,6 +26,14 @@
 
 #define SD_SHEEP_PROTO_VER 0x09
 
+/*
+ * Revisions of the peer protocol understood by a node, advertised in its
+ * node_id.  Older nodes leave it to 0.
+ */
+#define SD_PEER_VER_MUX 0x01 /* tagged requests over shared connections */
+#define SD_PEER_VER_THROTTLE 0x02 /* answers SD_OP_GET_RECOVERY_THROTTLE */
+#define SD_PEER_VER SD_PEER_VER_THROTTLE
+
 #define SD_DEFAULT_COPIES 3
 /*
  * For erasure coding, we use at most SD_EC_MAX_STRIP for data strips and
@@ -100,6 +108,9 @@
 #define SD_OP_NFS_CREATE	0xBB
 #define SD_OP_NFS_DELETE	0xBC
 #define SD_OP_EXIST	0xBD
+#define SD_OP_SET_RECOVERY_THROTTLE	0xBE
+#define SD_OP_GET_RECOVERY_THROTTLE	0xBF
+#define SD_OP_STAT_PEER	0xC0
 
 /* internal flags for hdr.flags, must be above 0x80 */
 #define SD_FLAG_CMD_RECOVERY 0x0080
@@ -144,7 +155,8 @@ struct node_id {
 	uint16_t port;
 	uint8_t io_addr[16];
 	uint16_t io_port;
-	uint8_t pad[4];
+	uint8_t peer_ver;
+	uint8_t pad[3];
 };
 
 #define SD_NODE_SIZE 80
@@ -204,6 +216,15 @@ struct md_info {
 	char path[PATH_MAX];
 };
 
+struct sd_peer_stat {
+	struct node_id nid;
+	uint64_t latency; /* EWMA of the request latency in ns */
+	uint64_t nr; /* nr of requests sent to the peer */
+	uint64_t nr_error; /* nr of requests failed by a network error */
+	uint32_t inflight;
+	uint32_t __pad;
+};
+
 #define MD_MAX_DISK 64 /* FIXME remove roof and make it dynamic */
 struct sd_md_info {
 	struct md_info disk[MD_MAX_DISK];
@@ -229,11 +250,20 @@ struct recovery_state {
 	uint64_t nr_total;
 };
 
+/* 0 means unlimited */
+struct recovery_throttle {
+	uint64_t max_bps; /* bytes per second */
+	uint32_t max_ops; /* objects per second */
+	uint32_t __pad;
+};
+
 #define CACHE_MAX	1024
 struct cache_info {
 	uint32_t vid;
 	uint32_t dirty;
 	uint32_t total;
+	uint32_t prefetched; /* nr of the objects read ahead */
+	uint32_t prefetch_hits; /* nr of them read afterwards */
 };
 
 struct object_cache_info {
@@ -242,6 +272,11 @@ struct object_cache_info {
 	struct cache_info caches[CACHE_MAX];
 	int count;
 	uint8_t directio;
+	uint64_t hit_bytes; /* bytes read from the cached blocks */
+	uint64_t partial_bytes; /* bytes read with some blocks to fetch */
+	uint64_t miss_bytes; /* bytes read with all the blocks to fetch */
+	uint64_t dirty_bytes; /* bytes written to the cache in writeback mode */
+	uint64_t push_bytes; /* bytes pushed back to the cluster */
 };
 
 struct sd_stat {
@@ -261,7 +296,33 @@ struct sd_stat {
 		uint64_t peer_total_remove_nr;
 		uint64_t peer_total_read_nr;
 		uint64_t peer_total_write_nr;
+		uint64_t gway_hedge_nr; /* reads sent to a second replica */
+		uint64_t gway_hedge_win_nr; /* the second replica was faster */
+		uint64_t gway_tx_rsp_nr; /* responses sent to the clients */
+		uint64_t gway_tx_batch_nr; /* sendmsg() calls completing them */
 	} r;
+	struct s_store {
+		uint64_t fd_cache_hit; /* object I/O with a cached fd */
+		uint64_t fd_cache_miss; /* object I/O which had to open() */
+		uint64_t fd_cache_nr; /* nr of cached fds */
+		uint64_t journal_commit_nr; /* nr of journal data commits */
+		uint64_t journal_commit_time; /* total commit time in ns */
+		uint64_t journal_stall_nr; /* journal switches which waited */
+		uint64_t journal_stall_time; /* total wait time in ns */
+	} s;
+	struct s_pool {
+		uint64_t req_hit; /* requests recycled from the pool */
+		uint64_t req_miss; /* requests which had to be allocated */
+		uint64_t buf_hit; /* data buffers recycled from the pool */
+		uint64_t buf_miss; /* data buffers which had to be allocated */
+	} p;
+	struct s_main {
+		uint64_t busy_time; /* ns the main thread spent in handlers */
+		uint64_t up_time; /* ns since the main loop was set up */
+		uint64_t done_nr; /* works completed on the main thread */
+		uint64_t wakeup_nr; /* main thread wakeups to complete them */
+		uint64_t worker_done_nr; /* works completed on the workers */
+	} m;
 };
 
 void sd_inode_stat(const struct sd_inode *inode, uint64_t *, uint64_t *);
@@ -46,6 +46,10 @@ int tx(struct connection *conn, enum conn_state next_state);
 int connect_to(const char *name, int port);
 int send_req(int sockfd, struct sd_req *hdr, void *data, unsigned int wlen,
 	     bool (*need_retry)(uint32_t), uint32_t, uint32_t);
+int send_req_iov(int sockfd, struct sd_req *hdr, const struct iovec *data,
+		 int iovcnt, bool (*need_retry)(uint32_t), uint32_t, uint32_t);
+int do_readv(int sockfd, struct iovec *iov, int iovcnt, size_t len,
+	     bool (*need_retry)(uint32_t), uint32_t, uint32_t);
 int exec_req(int sockfd, struct sd_req *hdr, void *,
 	     bool (*need_retry)(uint32_t), uint32_t, uint32_t);
 int create_listen_ports(const char *bindaddr, int port,
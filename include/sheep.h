@@ -26,8 +26,23 @@ struct sd_vnode {
 	uint64_t hash;
 };
 
+/*
+ * The vnodes sorted by hash in flat arrays, which are much cheaper to search
+ * than the rbtree on the I/O path.  next_zone[i] is the index of the first
+ * vnode after i, wrapping around, which is not in the zone of vnode i, so
+ * that placing a copy skips whole runs of a zone which already has one.
+ */
+struct vnode_ring {
+	int nr_vnodes;
+	uint64_t *hash;
+	const struct sd_vnode **vnode;
+	uint32_t *zone;
+	int *next_zone;
+};
+
 struct vnode_info {
 	struct rb_root vroot;
+	struct vnode_ring ring;
 	struct rb_root nroot;
 	int nr_nodes;
 	int nr_zones;
@@ -116,6 +131,82 @@ static inline void oid_to_nodes(uint64_t oid, struct rb_root *root,
 		nodes[i] = vnodes[i]->node;
 }
 
+/* Return the index of the first vnode whose hash is not less than 'hash' */
+static inline int vnode_ring_search(const struct vnode_ring *ring,
+				    uint64_t hash)
+{
+	const uint64_t *base = ring->hash;
+	int n = ring->nr_vnodes, idx;
+
+	while (n > 1) {
+		int half = n / 2;
+
+		base = base[half] < hash ? base + half : base;
+		n -= half;
+	}
+	idx = base - ring->hash + (*base < hash);
+
+	return idx == ring->nr_vnodes ? 0 : idx; /* Wrap around */
+}
+
+/* Same as oid_to_vnodes(), but on the flat ring */
+static inline void ring_oid_to_vnodes(uint64_t oid,
+				      const struct vnode_ring *ring,
+				      int nr_copies,
+				      const struct sd_vnode **vnodes)
+{
+	int n = ring->nr_vnodes, first, idx, dist = 0;
+	uint32_t zones[SD_MAX_COPIES];
+
+	first = idx = vnode_ring_search(ring, sd_hash_oid(oid));
+	vnodes[0] = ring->vnode[idx];
+	zones[0] = ring->zone[idx];
+	for (int i = 1; i < nr_copies; i++) {
+		int next = idx + 1 == n ? 0 : idx + 1;
+next:
+		/* the distance from the first vnode must keep growing */
+		if (unlikely((next - first + n) % n <= dist))
+			panic("can't find a valid vnode");
+		dist = (next - first + n) % n;
+		for (int j = 0; j < i; j++)
+			if (zones[j] == ring->zone[next]) {
+				next = ring->next_zone[next];
+				goto next;
+			}
+		idx = next;
+		vnodes[i] = ring->vnode[idx];
+		zones[i] = ring->zone[idx];
+	}
+}
+
+static inline const struct sd_vnode *
+ring_oid_to_vnode(uint64_t oid, const struct vnode_ring *ring, int copy_idx)
+{
+	const struct sd_vnode *vnodes[SD_MAX_COPIES];
+
+	ring_oid_to_vnodes(oid, ring, copy_idx + 1, vnodes);
+
+	return vnodes[copy_idx];
+}
+
+static inline const struct sd_node *
+ring_oid_to_node(uint64_t oid, const struct vnode_ring *ring, int copy_idx)
+{
+	return ring_oid_to_vnode(oid, ring, copy_idx)->node;
+}
+
+static inline void ring_oid_to_nodes(uint64_t oid,
+				     const struct vnode_ring *ring,
+				     int nr_copies,
+				     const struct sd_node **nodes)
+{
+	const struct sd_vnode *vnodes[SD_MAX_COPIES];
+
+	ring_oid_to_vnodes(oid, ring, nr_copies, vnodes);
+	for (int i = 0; i < nr_copies; i++)
+		nodes[i] = vnodes[i]->node;
+}
+
 static inline const char *sd_strerror(int err)
 {
 	static const char *descs[256] = {
@@ -230,6 +321,59 @@ nodes_to_vnodes(struct rb_root *nroot, struct rb_root *vroot)
 		node_to_vnodes(n, vroot);
 }
 
+/* Build the flat ring from the vnode rbtree */
+static inline void vnodes_to_ring(struct rb_root *vroot,
+				  struct vnode_ring *ring)
+{
+	const struct sd_vnode *v;
+	int n = 0, i;
+	char *p;
+
+	memset(ring, 0, sizeof(*ring));
+	rb_for_each_entry(v, vroot, rb)
+		n++;
+	if (n == 0)
+		return;
+
+	/* hashes first, so that the binary search starts cache aligned */
+	p = xvalloc(n * (sizeof(*ring->hash) + sizeof(*ring->vnode) +
+			 sizeof(*ring->zone) + sizeof(*ring->next_zone)));
+	ring->nr_vnodes = n;
+	ring->hash = (uint64_t *)p;
+	ring->vnode = (const struct sd_vnode **)(ring->hash + n);
+	ring->zone = (uint32_t *)(ring->vnode + n);
+	ring->next_zone = (int *)(ring->zone + n);
+
+	i = 0;
+	rb_for_each_entry(v, vroot, rb) {
+		ring->hash[i] = v->hash;
+		ring->vnode[i] = v;
+		ring->zone[i] = v->node->zone;
+		i++;
+	}
+
+	/*
+	 * Walk backwards twice so that next_zone wraps around: the second
+	 * pass sees the successors of the vnodes at the end of the ring.
+	 */
+	for (i = 0; i < n; i++)
+		ring->next_zone[i] = i;
+	for (int k = 2 * n - 2; k >= 0; k--) {
+		int cur = k % n, next = (k + 1) % n;
+
+		if (ring->zone[next] != ring->zone[cur])
+			ring->next_zone[cur] = next;
+		else
+			ring->next_zone[cur] = ring->next_zone[next];
+	}
+}
+
+static inline void free_vnode_ring(struct vnode_ring *ring)
+{
+	free(ring->hash);
+	memset(ring, 0, sizeof(*ring));
+}
+
 static inline void nodes_to_buffer(struct rb_root *nroot, void *buffer)
 {
 	struct sd_node *n, *buf = buffer;
@@ -0,0 +1,32 @@
+#ifndef __URING_H__
+#define __URING_H__
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+/* The max nr of I/Os in one uring_exec() */
+#define URING_MAX_IOS	64
+
+enum uring_op {
+	URING_READ,
+	URING_WRITE,
+	URING_FDATASYNC,
+};
+
+/* Don't start the I/O until the ones before it in the batch complete */
+#define URING_BARRIER	0x1
+
+struct uring_io {
+	enum uring_op op;
+	int flags;
+	int fd;
+	void *buf;
+	size_t len;
+	off_t offset;
+	ssize_t ret;	/* nr of bytes transferred, or -errno */
+};
+
+bool uring_supported(void);
+int uring_exec(struct uring_io *ios, int nr);
+
+#endif
@@ -18,7 +18,6 @@ struct work {
 
 struct work_queue {
 	int wq_state;
-	struct list_head pending_list;
 };
 
 enum wq_thread_control {
@@ -64,6 +63,21 @@ struct work_queue *create_ordered_work_queue(const char *name);
 void queue_work(struct work_queue *q, struct work *work);
 bool work_queue_empty(struct work_queue *q);
 
+/*
+ * Called by a work function which completed the work by itself.  The done
+ * function is not called then, so the work may be freed before the work
+ * function returns.
+ */
+void work_done_on_worker(struct work *work);
+
+struct wq_stat {
+	uint64_t main_done_nr; /* works completed on the main thread */
+	uint64_t main_wakeup_nr; /* main thread wakeups to complete them */
+	uint64_t worker_done_nr; /* works completed on the workers */
+};
+
+void get_wq_stat(struct wq_stat *stat);
+
 #ifdef HAVE_TRACE
 void suspend_worker_threads(void);
 void resume_worker_threads(void);
@@ -0,0 +1,205 @@
+/*
+ * Copyright (C) 2013 Nippon Telegraph and Telephone Corporation.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License version
+ * 2 as published by the Free Software Foundation.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * CAR replacement policy, see "CAR: Clock with Adaptive Replacement", Sorav
+ * Bansal and Dharmendra S. Modha, FAST '04
+ *
+ * Unlike the paper, we don't evict an object on each miss.  The cache evicts
+ * with car_evict() when it is over its watermark, and car_evict() skips the
+ * objects which the cache can't evict, like the dirty ones.
+ */
+
+#include "util.h"
+#include "sheepdog_proto.h"
+#include "car.h"
+
+struct car_ghost {
+	struct hlist_node hash;
+	struct list_node list;
+	uint64_t key;
+	uint8_t clock;
+};
+
+void car_init(struct car *car, size_t size, uint64_t period)
+{
+	memset(car, 0, sizeof(*car));
+	for (int i = 0; i < CAR_NR_CLOCKS; i++) {
+		INIT_LIST_HEAD(&car->clocks[i]);
+		INIT_LIST_HEAD(&car->ghosts[i]);
+	}
+	car->size = max(size, (size_t)1);
+	car->period = period;
+
+	/* There are up to 'size' ghosts in both of B1 and B2 */
+	car->ghost_hash_bits = 6;
+	while ((1UL << car->ghost_hash_bits) < car->size * 2)
+		car->ghost_hash_bits++;
+	car->ghost_hash = xzalloc(sizeof(struct hlist_head) <<
+				  car->ghost_hash_bits);
+}
+
+static struct car_ghost *ghost_lookup(struct car *car, uint64_t key)
+{
+	struct hlist_head *head;
+	struct hlist_node *n;
+	struct car_ghost *ghost;
+
+	head = car->ghost_hash + hash_64(key, car->ghost_hash_bits);
+	hlist_for_each_entry(ghost, n, head, hash) {
+		if (ghost->key == key)
+			return ghost;
+	}
+	return NULL;
+}
+
+static void ghost_del(struct car *car, struct car_ghost *ghost)
+{
+	hlist_del(&ghost->hash);
+	list_del(&ghost->list);
+	car->nr_ghosts[ghost->clock]--;
+	free(ghost);
+}
+
+static void ghost_del_lru(struct car *car, enum car_clock clock)
+{
+	ghost_del(car, list_first_entry(&car->ghosts[clock], struct car_ghost,
+					list));
+}
+
+static void ghost_add(struct car *car, uint64_t key, enum car_clock clock)
+{
+	struct car_ghost *ghost;
+
+	/* car_insert() trims them, but the restored objects don't */
+	if (car->nr_ghosts[CAR_T1] + car->nr_ghosts[CAR_T2] >= 2 * car->size)
+		ghost_del_lru(car, car->nr_ghosts[clock] ? clock : !clock);
+
+	ghost = xmalloc(sizeof(*ghost));
+	ghost->key = key;
+	ghost->clock = clock;
+	hlist_add_head(&ghost->hash, car->ghost_hash +
+		       hash_64(key, car->ghost_hash_bits));
+	list_add_tail(&ghost->list, &car->ghosts[clock]);
+	car->nr_ghosts[clock]++;
+}
+
+void car_destroy(struct car *car)
+{
+	for (int i = 0; i < CAR_NR_CLOCKS; i++)
+		while (!list_empty(&car->ghosts[i]))
+			ghost_del_lru(car, i);
+	free(car->ghost_hash);
+}
+
+static void clock_add(struct car *car, struct car_node *node,
+		      enum car_clock clock)
+{
+	node->clock = clock;
+	node->ref = false;
+	list_add_tail(&node->list, &car->clocks[clock]);
+	car->nr[clock]++;
+}
+
+/* Insert a new object on a miss */
+void car_insert(struct car *car, struct car_node *node, uint64_t key,
+		uint64_t now)
+{
+	size_t nr_b1 = car->nr_ghosts[CAR_T1], nr_b2 = car->nr_ghosts[CAR_T2];
+	struct car_ghost *ghost = ghost_lookup(car, key);
+	size_t delta;
+
+	node->key = key;
+	node->stamp = now;
+
+	if (!ghost) {
+		/* Keep the directory within twice the cache size */
+		if (car->nr[CAR_T1] + nr_b1 >= car->size && nr_b1)
+			ghost_del_lru(car, CAR_T1);
+		else if (car->nr[CAR_T1] + car->nr[CAR_T2] + nr_b1 + nr_b2 >=
+			 2 * car->size && nr_b2)
+			ghost_del_lru(car, CAR_T2);
+		clock_add(car, node, CAR_T1);
+		return;
+	}
+
+	/* T1 was too small if we miss on B1, and T2 if on B2 */
+	if (ghost->clock == CAR_T1) {
+		delta = max(nr_b2 / nr_b1, (size_t)1);
+		car->target = min(car->target + delta, car->size);
+	} else {
+		delta = max(nr_b1 / nr_b2, (size_t)1);
+		car->target -= min(car->target, delta);
+	}
+	ghost_del(car, ghost);
+	clock_add(car, node, CAR_T2);
+}
+
+/* Insert an object which the cache still holds after restart */
+void car_restore(struct car *car, struct car_node *node, uint64_t key,
+		 bool frequent)
+{
+	node->key = key;
+	node->stamp = 0;
+	clock_add(car, node, frequent ? CAR_T2 : CAR_T1);
+}
+
+/* Remove an object which the cache drops without evicting it */
+void car_remove(struct car *car, struct car_node *node)
+{
+	list_del(&node->list);
+	car->nr[node->clock]--;
+}
+
+/*
+ * Find an object to evict and remove it, or return NULL if there is none
+ *
+ * 'evictable' tells if the object can be evicted, and the cache should
+ * unlink it from its index if so.  The ones it can't evict are passed over.
+ */
+struct car_node *car_evict(struct car *car,
+			   bool (*evictable)(struct car_node *))
+{
+	/* Each object is visited at most three times */
+	size_t budget = 3 * (car->nr[CAR_T1] + car->nr[CAR_T2]);
+	struct car_node *node;
+	enum car_clock clock;
+
+	while (budget--) {
+		if (car->nr[CAR_T1] &&
+		    (car->nr[CAR_T1] >= max(car->target, (size_t)1) ||
+		     !car->nr[CAR_T2]))
+			clock = CAR_T1;
+		else if (car->nr[CAR_T2])
+			clock = CAR_T2;
+		else
+			break;
+
+		node = list_first_entry(&car->clocks[clock], struct car_node,
+					list);
+		if (node->ref) {
+			/* referenced again, so it is a frequent one */
+			car_remove(car, node);
+			clock_add(car, node, CAR_T2);
+			continue;
+		}
+		if (!evictable(node)) {
+			list_move_tail(&node->list, &car->clocks[clock]);
+			continue;
+		}
+
+		car_remove(car, node);
+		ghost_add(car, node->key, clock);
+		return node;
+	}
+
+	return NULL;
+}
@@ -71,6 +71,10 @@ struct event_info {
 static struct epoll_event *events;
 static int nr_events;
 
+/* time spent in the event handlers and when the loop was set up, in ns */
+static uint64_t busy_time;
+static uint64_t start_time;
+
 static int event_cmp(const struct event_info *e1, const struct event_info *e2)
 {
 	return intcmp(e1->fd, e2->fd);
@@ -79,6 +83,7 @@ static int event_cmp(const struct event_info *e1, const struct event_info *e2)
 int init_event(int nr)
 {
 	nr_events = nr;
+	start_time = clock_get_time();
 	events = xcalloc(nr_events, sizeof(struct epoll_event));
 
 	efd = epoll_create(nr);
@@ -203,18 +208,27 @@ refresh:
 		sd_err("epoll_wait failed: %m");
 		exit(1);
 	} else if (nr) {
-		for (i = 0; i < nr; i++) {
+		uint64_t start = clock_get_time();
+
+		for (i = 0; i < nr && !event_loop_refresh; i++) {
 			struct event_info *ei;
 
 			ei = (struct event_info *)events[i].data.ptr;
 			ei->handler(ei->fd, events[i].events, ei->data);
-
-			if (event_loop_refresh)
-				goto refresh;
 		}
+		busy_time += clock_get_time() - start;
+
+		if (event_loop_refresh)
+			goto refresh;
 	}
 }
 
+void get_event_loop_time(uint64_t *busy, uint64_t *total)
+{
+	*busy = busy_time;
+	*total = clock_get_time() - start_time;
+}
+
 void event_loop(int timeout)
 {
 	do_event_loop(timeout, false);
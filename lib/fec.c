@@ -58,6 +58,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
 
 #include "fec.h"
 #include "util.h"
@@ -114,6 +117,16 @@ static uint8_t gf_mul_table[256][256];
 #define GF_MULC0(c) __gf_mulc_ = gf_mul_table[c]
 #define GF_ADDMULC(dst, x) dst ^= __gf_mulc_[x]
 
+/*
+ * Split nibble multiplication tables for the SIMD kernels:
+ *
+ *   c * x = gf_mul_nibble[c][0][x & 0xf] ^ gf_mul_nibble[c][1][x >> 4]
+ *
+ * Both halves fit in a 16 byte register, so a pshufb does 16 (or 32)
+ * lookups at once.
+ */
+static uint8_t gf_mul_nibble[256][2][16] __attribute__((aligned(16)));
+
 /*
  * Generate GF(2**m) from the irreducible polynomial p(X) in p[0]..p[m]
  * Lookup tables:
@@ -134,6 +147,12 @@ static void _init_mul_table(void)
 
 	for (j = 0; j < 256; j++)
 		gf_mul_table[0][j] = gf_mul_table[j][0] = 0;
+
+	for (i = 0; i < 256; i++)
+		for (j = 0; j < 16; j++) {
+			gf_mul_nibble[i][0][j] = gf_mul_table[i][j];
+			gf_mul_nibble[i][1][j] = gf_mul_table[i][j << 4];
+		}
 }
 
 #define NEW_GF_MATRIX(rows, cols) \
@@ -210,7 +229,7 @@ static void generate_gf(void)
  */
 #define addmul(dst, src, c, sz)                 \
 	if (c != 0)				\
-		_addmul1(dst, src, c, sz)
+		gf_addmul(dst, src, c, sz)
 
 #define UNROLL 16               /* 1, 4, 8, 16 */
 static void _addmul1(register uint8_t *dst,
@@ -251,6 +270,97 @@ static void _addmul1(register uint8_t *dst,
 		GF_ADDMULC(*dst, *src);
 }
 
+#ifdef __x86_64__
+
+/*
+ * SIMD versions of _addmul1() with the split nibble tables.  The tail which
+ * doesn't fill a whole vector is left to the narrower kernel.
+ */
+static __attribute__((target("ssse3")))
+void _addmul1_ssse3(uint8_t *dst, const uint8_t *src, uint8_t c, size_t sz)
+{
+	const __m128i lo = _mm_load_si128((const __m128i *)gf_mul_nibble[c][0]);
+	const __m128i hi = _mm_load_si128((const __m128i *)gf_mul_nibble[c][1]);
+	const __m128i mask = _mm_set1_epi8(0x0f);
+	size_t i;
+
+	for (i = 0; i + 16 <= sz; i += 16) {
+		__m128i s = _mm_loadu_si128((const __m128i *)(src + i));
+		__m128i d = _mm_loadu_si128((const __m128i *)(dst + i));
+		__m128i l = _mm_shuffle_epi8(lo, _mm_and_si128(s, mask));
+		__m128i h = _mm_shuffle_epi8(hi,
+				_mm_and_si128(_mm_srli_epi64(s, 4), mask));
+
+		d = _mm_xor_si128(d, _mm_xor_si128(l, h));
+		_mm_storeu_si128((__m128i *)(dst + i), d);
+	}
+
+	if (i < sz)
+		_addmul1(dst + i, src + i, c, sz - i);
+}
+
+static __attribute__((target("avx2")))
+void _addmul1_avx2(uint8_t *dst, const uint8_t *src, uint8_t c, size_t sz)
+{
+	const __m256i lo = _mm256_broadcastsi128_si256(
+		_mm_load_si128((const __m128i *)gf_mul_nibble[c][0]));
+	const __m256i hi = _mm256_broadcastsi128_si256(
+		_mm_load_si128((const __m128i *)gf_mul_nibble[c][1]));
+	const __m256i mask = _mm256_set1_epi8(0x0f);
+	size_t i;
+
+	for (i = 0; i + 32 <= sz; i += 32) {
+		__m256i s = _mm256_loadu_si256((const __m256i *)(src + i));
+		__m256i d = _mm256_loadu_si256((const __m256i *)(dst + i));
+		__m256i l = _mm256_shuffle_epi8(lo, _mm256_and_si256(s, mask));
+		__m256i h = _mm256_shuffle_epi8(hi,
+				_mm256_and_si256(_mm256_srli_epi64(s, 4), mask));
+
+		d = _mm256_xor_si256(d, _mm256_xor_si256(l, h));
+		_mm256_storeu_si256((__m256i *)(dst + i), d);
+	}
+
+	if (i < sz)
+		_addmul1_ssse3(dst + i, src + i, c, sz - i);
+}
+
+#endif
+
+struct gf_kernel {
+	const char *name;
+	void (*fn)(uint8_t *dst, const uint8_t *src, uint8_t c, size_t sz);
+	bool (*usable)(void);
+};
+
+#ifdef __x86_64__
+static bool ssse3_usable(void)
+{
+	return cpu_has_ssse3;
+}
+
+static bool avx2_usable(void)
+{
+	return cpu_has_avx2 && avx_usable();
+}
+#endif
+
+/* Ordered from the slowest to the fastest */
+static const struct gf_kernel gf_kernels[] = {
+	{ "generic", _addmul1, NULL },
+#ifdef __x86_64__
+	{ "ssse3", _addmul1_ssse3, ssse3_usable },
+	{ "avx2", _addmul1_avx2, avx2_usable },
+#endif
+};
+
+static const struct gf_kernel *gf_kernel = gf_kernels;
+
+static inline void gf_addmul(uint8_t *dst, const uint8_t *src, uint8_t c,
+			     size_t sz)
+{
+	gf_kernel->fn(dst, src, c, sz);
+}
+
 /* computes C = AB where A is dp*d, B is d*m, C is dp*m */
 static void _matmul(uint8_t *a, uint8_t *b, uint8_t *c, unsigned dp, unsigned d,
 		    unsigned m)
@@ -439,6 +549,33 @@ void init_fec(void)
 {
 	generate_gf();
 	_init_mul_table();
+
+	for (int i = ARRAY_SIZE(gf_kernels) - 1; i >= 0; i--)
+		if (!gf_kernels[i].usable || gf_kernels[i].usable()) {
+			gf_kernel = gf_kernels + i;
+			break;
+		}
+}
+
+const char *fec_kernel_name(void)
+{
+	return gf_kernel->name;
+}
+
+bool fec_set_kernel(const char *name)
+{
+	for (int i = 0; i < ARRAY_SIZE(gf_kernels); i++) {
+		const struct gf_kernel *k = gf_kernels + i;
+
+		if (strcmp(k->name, name) != 0)
+			continue;
+		if (k->usable && !k->usable())
+			return false;
+		gf_kernel = k;
+		return true;
+	}
+
+	return false;
 }
 
 /*
@@ -449,10 +586,32 @@ void init_fec(void)
 
 #define FEC_MAGIC	0xFECC0DEC
 
+/*
+ * Inverting the decode matrix costs O(d^3) and ec_decode_buffer() asks for the
+ * same one for each of the thousands of stripes of an object, so every context
+ * keeps a small direct mapped cache of them, keyed by the input indexes.
+ *
+ * On a miss the new matrix replaces whatever the slot held, so the cache
+ * follows the index sets in use as the failed strips change.  The matrix is
+ * copied out under the read lock of the slot, which costs far less than
+ * inverting it.
+ */
+#define FEC_DECODE_CACHE_SIZE	64
+
+struct fec_decode_matrix {
+	struct sd_rw_lock lock;
+	bool valid;
+	int idx[SD_EC_MAX_STRIP];
+	uint8_t matrix[SD_EC_MAX_STRIP * SD_EC_MAX_STRIP];
+};
+
 void fec_free(struct fec *p)
 {
 	assert(p != NULL && p->magic == (((FEC_MAGIC ^ p->d) ^ p->dp) ^
 					 (unsigned long) (p->enc_matrix)));
+	for (int i = 0; i < FEC_DECODE_CACHE_SIZE; i++)
+		sd_destroy_rw_lock(&p->dec_cache[i].lock);
+	free(p->dec_cache);
 	free(p->enc_matrix);
 	free(p);
 }
@@ -468,6 +627,11 @@ struct fec *fec_new(unsigned short d, unsigned short dp)
 	retval->d = d;
 	retval->dp = dp;
 	retval->enc_matrix = NEW_GF_MATRIX(dp, d);
+	retval->dec_cache = xzalloc(sizeof(*retval->dec_cache) *
+				    FEC_DECODE_CACHE_SIZE);
+	for (int i = 0; i < FEC_DECODE_CACHE_SIZE; i++)
+		sd_init_rw_lock(&retval->dec_cache[i].lock);
+	retval->shared = false;
 	retval->magic = ((FEC_MAGIC^d)^dp)^(unsigned long)(retval->enc_matrix);
 	tmp_m = NEW_GF_MATRIX(dp, d);
 	/*
@@ -497,6 +661,36 @@ struct fec *fec_new(unsigned short d, unsigned short dp)
 	return retval;
 }
 
+/*
+ * Shared contexts of all the valid policies, indexed by the number of the data
+ * and the parity strips.  Like the decode matrices, they are published with
+ * cmpxchg and never freed.
+ */
+static struct fec *ec_cache[SD_EC_MAX_STRIP + 1][SD_EC_MAX_STRIP];
+
+struct fec *ec_init(int d, int dp)
+{
+	int p = dp - d;
+	struct fec *ctx;
+
+	if (d <= 0 || d > SD_EC_MAX_STRIP || p <= 0 || p >= SD_EC_MAX_STRIP)
+		return fec_new(d, dp);
+
+	ctx = uatomic_read(&ec_cache[d][p]);
+	if (ctx)
+		return ctx;
+
+	ctx = fec_new(d, dp);
+	ctx->shared = true;
+	if (uatomic_cmpxchg(&ec_cache[d][p], NULL, ctx) != NULL) {
+		/* somebody else built it first */
+		fec_free(ctx);
+		ctx = uatomic_read(&ec_cache[d][p]);
+	}
+
+	return ctx;
+}
+
 /*
  * To make sure that we stay within cache in the inner loops of fec_encode().
  * (It would probably help to also do this for fec_decode().
@@ -552,6 +746,36 @@ build_decode_matrix_into_space(const struct fec *const code,
 	_invert_mat(matrix, d);
 }
 
+/*
+ * Put the decode matrix for the input indexes into 'space', either from the
+ * cache or built
+ */
+static void get_decode_matrix(const struct fec *const code,
+			      const int *const idx, uint8_t *const space)
+{
+	unsigned d = code->d;
+	size_t idx_len = sizeof(*idx) * d;
+	struct fec_decode_matrix *dm;
+	bool hit;
+
+	dm = code->dec_cache + sd_hash(idx, idx_len) % FEC_DECODE_CACHE_SIZE;
+	sd_read_lock(&dm->lock);
+	hit = dm->valid && memcmp(dm->idx, idx, idx_len) == 0;
+	if (hit)
+		memcpy(space, dm->matrix, d * d);
+	sd_rw_unlock(&dm->lock);
+	if (hit)
+		return;
+
+	build_decode_matrix_into_space(code, idx, d, space);
+
+	sd_write_lock(&dm->lock);
+	memcpy(dm->idx, idx, idx_len);
+	memcpy(dm->matrix, space, d * d);
+	dm->valid = true;
+	sd_rw_unlock(&dm->lock);
+}
+
 void fec_decode(const struct fec *code,
 		const uint8_t *const *const inpkts,
 		uint8_t *const *const outpkts,
@@ -563,7 +787,7 @@ void fec_decode(const struct fec *code,
 	unsigned char col = 0;
 
 	assert(code->d * code->d < 8 * 1024 * 1024);
-	build_decode_matrix_into_space(code, idx, code->d, m_dec);
+	get_decode_matrix(code, idx, m_dec);
 
 	for (row = 0; row < code->d; row++) {
 		/*
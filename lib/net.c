@@ -323,6 +323,105 @@ int send_req(int sockfd, struct sd_req *hdr, void *data, unsigned int wlen,
 	return ret;
 }
 
+/*
+ * Like send_req(), but the data is gathered from 'data'.  There can be more
+ * than IOV_MAX vectors, they are sent in several sendmsg() calls.
+ */
+int send_req_iov(int sockfd, struct sd_req *hdr, const struct iovec *data,
+		 int iovcnt, bool (*need_retry)(uint32_t epoch),
+		 uint32_t epoch, uint32_t max_count)
+{
+	struct iovec iov[IOV_MAX];
+	struct msghdr msg;
+	int n = 0, i = 0, len = 0;
+
+	iov[n].iov_base = hdr;
+	iov[n++].iov_len = sizeof(*hdr);
+	len += sizeof(*hdr);
+
+	for (;;) {
+		for (; n < IOV_MAX && i < iovcnt; n++, i++) {
+			iov[n] = data[i];
+			len += data[i].iov_len;
+		}
+
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = iov;
+		msg.msg_iovlen = n;
+		if (len && do_write(sockfd, &msg, len, need_retry, epoch,
+				    max_count)) {
+			sd_err("failed to send request %x, %d: %m",
+			       hdr->opcode, hdr->data_length);
+			return -1;
+		}
+
+		if (i == iovcnt)
+			break;
+		n = len = 0;
+	}
+
+	return 0;
+}
+
+/*
+ * Like do_read(), but scatter 'len' bytes over 'iov', which must be large
+ * enough.  The vectors are consumed.
+ */
+int do_readv(int sockfd, struct iovec *iov, int iovcnt, size_t len,
+	     bool (*need_retry)(uint32_t epoch), uint32_t epoch,
+	     uint32_t max_count)
+{
+	struct msghdr msg;
+	int ret, repeat = max_count;
+
+	while (len) {
+		size_t batch_len = 0;
+		int n;
+
+		assert(iovcnt > 0);
+		for (n = 0; n < iovcnt && n < IOV_MAX && batch_len < len; n++)
+			batch_len += iov[n].iov_len;
+		if (batch_len > len) {
+			iov[n - 1].iov_len -= batch_len - len;
+			batch_len = len;
+		}
+
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = iov;
+		msg.msg_iovlen = n;
+		iov += n;
+		iovcnt -= n;
+		len -= batch_len;
+reread:
+		ret = recvmsg(sockfd, &msg, 0);
+		if (ret == 0) {
+			sd_debug("connection is closed (%zu bytes left)",
+				 batch_len + len);
+			return 1;
+		}
+		if (ret < 0) {
+			if (errno == EINTR)
+				goto reread;
+			if (errno == EAGAIN && repeat &&
+			    (need_retry == NULL || need_retry(epoch))) {
+				repeat--;
+				goto reread;
+			}
+
+			sd_err("failed to read from socket: %d, %m", ret);
+			return 1;
+		}
+
+		batch_len -= ret;
+		if (batch_len) {
+			forward_iov(&msg, ret);
+			goto reread;
+		}
+	}
+
+	return 0;
+}
+
 int exec_req(int sockfd, struct sd_req *hdr, void *data,
 	     bool (*need_retry)(uint32_t epoch), uint32_t epoch,
 	     uint32_t max_count)
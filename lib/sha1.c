@@ -303,20 +303,6 @@ static void ssse3_sha1_final(void *ctx, uint8_t *out)
 	return;
 }
 
-static bool avx_usable(void)
-{
-	uint64_t xcr0;
-
-	if (!cpu_has_avx || !cpu_has_osxsave)
-		return false;
-
-	xcr0 = xgetbv(XCR_XFEATURE_ENABLED_MASK);
-	if ((xcr0 & (XSTATE_SSE | XSTATE_YMM)) != (XSTATE_SSE | XSTATE_YMM))
-		return false;
-
-	return true;
-}
-
 #endif
 
 const char *sha1_to_hex(const unsigned char *sha1)
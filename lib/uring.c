@@ -0,0 +1,438 @@
+/*
+ * Copyright (C) 2013 Nippon Telegraph and Telephone Corporation.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License version
+ * 2 as published by the Free Software Foundation.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * A minimal io_uring wrapper
+ *
+ * Each thread sets up its own ring on first use, so the queues need no lock.
+ * uring_exec() submits a batch of I/Os, which run in parallel but for the
+ * barriers, and waits for all of them with a single io_uring_enter() as long
+ * as none of them is short.  The short ones are resubmitted for the rest,
+ * like xpread() and xpwrite() do, and so are the barriers after them.
+ *
+ * If the kernel is short of resources, io_uring_enter() is retried for a
+ * while.  If it keeps failing, the ring of the thread is given up and
+ * uring_exec() fails with ENOSYS from then on, so that the callers fall back
+ * to the plain syscalls.
+ *
+ * We talk to the kernel directly, so that liburing isn't needed.
+ */
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "util.h"
+#include "uring.h"
+
+#ifdef HAVE_LINUX_IO_URING_H
+
+#include <linux/io_uring.h>
+
+#define URING_MAX_RETRIES	1000	/* for 1ms each */
+
+struct uring {
+	int fd;
+
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned sq_mask;
+	unsigned *sq_array;
+	struct io_uring_sqe *sqes;
+
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned cq_mask;
+	struct io_uring_cqe *cqes;
+
+	void *sq_ring;
+	void *cq_ring;
+	size_t sq_ring_size;
+	size_t cq_ring_size;
+	size_t sqes_size;
+};
+
+static __thread struct uring *thread_ring;
+static __thread bool thread_ring_failed;
+static pthread_key_t ring_key;
+static pthread_once_t ring_once = PTHREAD_ONCE_INIT;
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit,
+			      unsigned min_complete, unsigned flags)
+{
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags,
+		       NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, void *arg,
+				 unsigned nr_args)
+{
+	return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static void *uring_mmap(int fd, size_t size, off_t offset)
+{
+	void *p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		       MAP_SHARED | MAP_POPULATE, fd, offset);
+
+	return p == MAP_FAILED ? NULL : p;
+}
+
+static void uring_destroy(struct uring *r)
+{
+	if (r->sqes)
+		munmap(r->sqes, r->sqes_size);
+	if (r->cq_ring && r->cq_ring != r->sq_ring)
+		munmap(r->cq_ring, r->cq_ring_size);
+	if (r->sq_ring)
+		munmap(r->sq_ring, r->sq_ring_size);
+	close(r->fd);
+	free(r);
+}
+
+static struct uring *uring_create(void)
+{
+	struct io_uring_params p = {};
+	struct uring *r = xzalloc(sizeof(*r));
+	char *sq, *cq;
+
+	r->fd = sys_io_uring_setup(URING_MAX_IOS, &p);
+	if (r->fd < 0) {
+		sd_debug("failed to set up io_uring, %m");
+		free(r);
+		return NULL;
+	}
+
+	r->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	r->cq_ring_size = p.cq_off.cqes +
+		p.cq_entries * sizeof(struct io_uring_cqe);
+	r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		r->sq_ring_size = max(r->sq_ring_size, r->cq_ring_size);
+		r->cq_ring_size = r->sq_ring_size;
+	}
+
+	r->sq_ring = uring_mmap(r->fd, r->sq_ring_size, IORING_OFF_SQ_RING);
+	if (!r->sq_ring)
+		goto err;
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		r->cq_ring = r->sq_ring;
+	else {
+		r->cq_ring = uring_mmap(r->fd, r->cq_ring_size,
+					IORING_OFF_CQ_RING);
+		if (!r->cq_ring)
+			goto err;
+	}
+	r->sqes = uring_mmap(r->fd, r->sqes_size, IORING_OFF_SQES);
+	if (!r->sqes)
+		goto err;
+
+	sq = r->sq_ring;
+	r->sq_head = (unsigned *)(sq + p.sq_off.head);
+	r->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+	r->sq_mask = *(unsigned *)(sq + p.sq_off.ring_mask);
+	r->sq_array = (unsigned *)(sq + p.sq_off.array);
+
+	cq = r->cq_ring;
+	r->cq_head = (unsigned *)(cq + p.cq_off.head);
+	r->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+	r->cq_mask = *(unsigned *)(cq + p.cq_off.ring_mask);
+	r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+	return r;
+err:
+	sd_err("failed to map io_uring, %m");
+	uring_destroy(r);
+	return NULL;
+}
+
+static void ring_exit(void *arg)
+{
+	uring_destroy(arg);
+}
+
+static void ring_key_init(void)
+{
+	if (pthread_key_create(&ring_key, ring_exit))
+		panic("failed to create the ring key");
+}
+
+static struct uring *get_ring(void)
+{
+	if (likely(thread_ring))
+		return thread_ring;
+	if (thread_ring_failed)
+		return NULL;
+
+	pthread_once(&ring_once, ring_key_init);
+	thread_ring = uring_create();
+	if (!thread_ring) {
+		thread_ring_failed = true;
+		return NULL;
+	}
+	pthread_setspecific(ring_key, thread_ring);
+
+	return thread_ring;
+}
+
+/* Check if the kernel supports io_uring and the ops we use */
+bool uring_supported(void)
+{
+	static const uint8_t ops[] = {
+		IORING_OP_READ, IORING_OP_WRITE, IORING_OP_FSYNC,
+	};
+	struct io_uring_probe *probe;
+	struct uring *r = get_ring();
+	bool ret = false;
+
+	if (!r)
+		return false;
+
+	probe = xzalloc(sizeof(*probe) +
+			IORING_OP_LAST * sizeof(struct io_uring_probe_op));
+	if (sys_io_uring_register(r->fd, IORING_REGISTER_PROBE, probe,
+				  IORING_OP_LAST) < 0) {
+		sd_debug("failed to probe io_uring, %m");
+		goto out;
+	}
+	for (int i = 0; i < ARRAY_SIZE(ops); i++) {
+		if (ops[i] > probe->last_op ||
+		    !(probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED)) {
+			sd_debug("io_uring op %d is not supported", ops[i]);
+			goto out;
+		}
+	}
+	ret = true;
+out:
+	free(probe);
+	return ret;
+}
+
+/* Queue the rest of 'io', return the new tail of the submission queue */
+static unsigned uring_prep(struct uring *r, unsigned tail, struct uring_io *io,
+			   int idx)
+{
+	unsigned i = tail & r->sq_mask;
+	struct io_uring_sqe *sqe = r->sqes + i;
+
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->fd = io->fd;
+	sqe->user_data = idx;
+	if (io->flags & URING_BARRIER)
+		sqe->flags |= IOSQE_IO_DRAIN;
+
+	switch (io->op) {
+	case URING_READ:
+	case URING_WRITE:
+		sqe->opcode = io->op == URING_READ ?
+			IORING_OP_READ : IORING_OP_WRITE;
+		sqe->addr = (uintptr_t)((char *)io->buf + io->ret);
+		sqe->len = io->len - io->ret;
+		sqe->off = io->offset + io->ret;
+		break;
+	case URING_FDATASYNC:
+		sqe->opcode = IORING_OP_FSYNC;
+		sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+		break;
+	}
+	r->sq_array[i] = i;
+
+	return tail + 1;
+}
+
+/* Account the result of 'io', return true if it has to be resubmitted */
+static bool uring_complete(struct uring_io *io, int res)
+{
+	if (res < 0) {
+		io->ret = res;
+		return false;
+	}
+
+	switch (io->op) {
+	case URING_READ:
+		/* stop at the end of the file */
+		io->ret += res;
+		return res && io->ret < io->len;
+	case URING_WRITE:
+		if (unlikely(!res)) {
+			io->ret = -ENOSPC;
+			return false;
+		}
+		io->ret += res;
+		return io->ret < io->len;
+	default:
+		return false;
+	}
+}
+
+static unsigned uring_reap(struct uring *r, struct uring_io *ios,
+			   uint64_t *resubmit)
+{
+	unsigned head = *r->cq_head, tail = uatomic_read(r->cq_tail), nr = 0;
+
+	cmm_smp_rmb();
+	for (; head != tail; head++, nr++) {
+		struct io_uring_cqe *cqe = r->cqes + (head & r->cq_mask);
+
+		if (uring_complete(ios + cqe->user_data, cqe->res))
+			*resubmit |= 1ULL << cqe->user_data;
+	}
+	cmm_smp_mb();
+	uatomic_set(r->cq_head, head);
+
+	return nr;
+}
+
+/* The errors which mean the kernel is short of resources for now */
+static inline bool uring_busy(int err)
+{
+	return err == EAGAIN || err == EBUSY || err == ENOMEM;
+}
+
+/*
+ * Give up the ring of this thread.  The I/Os which the kernel hasn't taken
+ * are dropped, but the ones in flight still use the buffers of the caller,
+ * so wait for them first.
+ */
+static void uring_abort(struct uring *r, struct uring_io *ios,
+			unsigned inflight)
+{
+	uint64_t resubmit = 0;
+	int ret;
+
+	uatomic_set(r->sq_tail, uatomic_read(r->sq_head));
+	while (inflight > 0) {
+		ret = sys_io_uring_enter(r->fd, 0, inflight,
+					 IORING_ENTER_GETEVENTS);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			if (!uring_busy(errno))
+				panic("failed to wait for the I/Os in flight,"
+				      " %m");
+			usleep(1000);
+		}
+		ret = uring_reap(r, ios, &resubmit);
+		inflight -= min(inflight, (unsigned)ret);
+	}
+
+	pthread_setspecific(ring_key, NULL);
+	uring_destroy(r);
+	thread_ring = NULL;
+	thread_ring_failed = true;
+}
+
+/*
+ * Run 'nr' I/Os through the ring of the calling thread and wait for them
+ *
+ * Return 0 on success, or -1 with errno of the first failed I/O, which is
+ * ENOSYS if this thread has no working ring.  A read which hits the end of the file
+ * succeeds with a short ios[i].ret.
+ */
+int uring_exec(struct uring_io *ios, int nr)
+{
+	struct uring *r;
+	uint64_t pending;
+
+	if (nr > URING_MAX_IOS) {
+		errno = EINVAL;
+		return -1;
+	}
+	r = get_ring();
+	if (!r) {
+		errno = ENOSYS;
+		return -1;
+	}
+
+	for (int i = 0; i < nr; i++)
+		ios[i].ret = 0;
+	pending = nr == 64 ? ~0ULL : (1ULL << nr) - 1;
+
+	while (pending) {
+		unsigned tail = *r->sq_tail, n = 0, submitted = 0, reaped = 0;
+		int retries = 0;
+		uint64_t resubmit = 0;
+
+		for (int i = 0; i < nr; i++) {
+			if (!(pending & (1ULL << i)))
+				continue;
+			tail = uring_prep(r, tail, ios + i, i);
+			n++;
+		}
+		cmm_smp_wmb();
+		uatomic_set(r->sq_tail, tail);
+
+		while (reaped < n) {
+			int ret = sys_io_uring_enter(r->fd, n - submitted,
+						     n - reaped,
+						     IORING_ENTER_GETEVENTS);
+			if (ret < 0) {
+				if (errno == EINTR)
+					continue;
+				if (uring_busy(errno) &&
+				    retries++ < URING_MAX_RETRIES) {
+					/* make room in the completion queue */
+					ret = uring_reap(r, ios, &resubmit);
+					if (!ret)
+						usleep(1000);
+					reaped += ret;
+					continue;
+				}
+				sd_err("io_uring_enter failed, %m, falling back"
+				       " to the syscalls");
+				uring_abort(r, ios, submitted - reaped);
+				errno = ENOSYS;
+				return -1;
+			}
+			retries = 0;
+			submitted += ret;
+			reaped += uring_reap(r, ios, &resubmit);
+		}
+
+		/* a barrier has to come after the rest of the ones before it */
+		for (int i = 0; i < nr; i++) {
+			if (ios[i].flags & URING_BARRIER && ios[i].ret >= 0 &&
+			    resubmit & ((1ULL << i) - 1)) {
+				ios[i].ret = 0;
+				resubmit |= 1ULL << i;
+			}
+		}
+		pending = resubmit;
+	}
+
+	for (int i = 0; i < nr; i++) {
+		if (ios[i].ret < 0) {
+			errno = -ios[i].ret;
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+#else
+
+bool uring_supported(void)
+{
+	return false;
+}
+
+int uring_exec(struct uring_io *ios, int nr)
+{
+	errno = ENOSYS;
+	return -1;
+}
+
+#endif
@@ -26,6 +26,7 @@
 #include <sys/time.h>
 #include <linux/types.h>
 #include <signal.h>
+#include <semaphore.h>
 
 #include "list.h"
 #include "util.h"
@@ -40,31 +41,54 @@
  */
 #define WQ_PROTECTION_PERIOD 1000 /* ms */
 
+/*
+ * The pending works are spread over shards, one per CPU, so that the workers
+ * and the producers don't all contend on a single lock.  Each worker takes
+ * the works of its own shard first and steals from the others when it has
+ * none.  A semaphore counts the pending works, so that a worker only wakes up
+ * when there is one to take.
+ */
+struct wq_shard {
+	struct sd_mutex pending_lock;
+	struct list_head pending_list;
+
+	struct sd_mutex finished_lock;
+	struct list_head finished_list;
+} __attribute__((aligned(64)));
+
 struct wq_info {
 	const char *name;
 
-	struct list_head finished_list;
 	struct list_node list;
 
-	struct sd_mutex finished_lock;
-	struct sd_mutex startup_lock;
+	struct wq_shard *shards;
+	int nr_shards;
 
-	/* wokers sleep on this and signaled by work producer */
-	struct sd_cond pending_cond;
-	/* locked by work producer and workers */
-	struct sd_mutex pending_lock;
-	/* protected by pending_lock */
+	/* wokers sleep on this and posted by work producer */
+	sem_t pending_sem;
+
+	struct sd_mutex startup_lock;
 	struct work_queue q;
-	size_t nr_threads;
 
 	/* protected by uatomic primitives */
+	size_t nr_threads;
+	size_t nr_idle;
+	size_t nr_pending; /* queued and not taken by a worker yet */
 	size_t nr_queued_work;
+	uint32_t next_shard;
+	uint32_t next_worker;
 
-	/* we cannot shrink work queue till this time */
-	uint64_t tm_end_of_protection;
 	enum wq_thread_control tc;
 };
 
+/* the work queue and the shard of the current worker thread */
+static __thread struct wq_info *worker_wi;
+static __thread int worker_shard;
+/* the work which the current worker completed by itself */
+static __thread struct work *worker_done_work;
+
+static struct wq_stat wq_stat;
+
 static int efd;
 static LIST_HEAD(wq_info_list);
 static size_t nr_nodes = 1;
@@ -89,7 +113,8 @@ void suspend_worker_threads(void)
 	int tid;
 
 	list_for_each_entry(wi, &wq_info_list, list) {
-		sd_mutex_lock(&wi->pending_lock);
+		for (int i = 0; i < wi->nr_shards; i++)
+			sd_mutex_lock(&wi->shards[i].pending_lock);
 	}
 
 	FOR_EACH_BIT(tid, tid_map, tid_max) {
@@ -121,7 +146,8 @@ void resume_worker_threads(void)
 		eventfd_xread(ack_efd);
 
 	list_for_each_entry(wi, &wq_info_list, list) {
-		sd_mutex_unlock(&wi->pending_lock);
+		for (int i = 0; i < wi->nr_shards; i++)
+			sd_mutex_unlock(&wi->shards[i].pending_lock);
 	}
 }
 
@@ -187,14 +213,6 @@ static inline void trace_clear_tid_map(int tid) {}
 
 #endif	/* HAVE_TRACE */
 
-static uint64_t get_msec_time(void)
-{
-	struct timeval tv;
-
-	gettimeofday(&tv, NULL);
-	return tv.tv_sec * 1000 + tv.tv_usec / 1000;
-}
-
 static inline uint64_t wq_get_roof(struct wq_info *wi)
 {
 	uint64_t nr = 1;
@@ -215,31 +233,15 @@ static inline uint64_t wq_get_roof(struct wq_info *wi)
 	return nr;
 }
 
-static bool wq_need_grow(struct wq_info *wi)
-{
-	if (wi->nr_threads < uatomic_read(&wi->nr_queued_work) &&
-	    wi->nr_threads * 2 <= wq_get_roof(wi)) {
-		wi->tm_end_of_protection = get_msec_time() +
-			WQ_PROTECTION_PERIOD;
-		return true;
-	}
-
-	return false;
-}
-
 /*
- * Return true if more than half of threads are not used more than
- * WQ_PROTECTION_PERIOD seconds
+ * Grow by one thread when a work is queued while no worker is idle to take
+ * it.  The workers may sleep waiting for other works (e.g. local requests),
+ * so a WQ_UNLIMITED queue must always be able to get one more thread.
  */
-static bool wq_need_shrink(struct wq_info *wi)
+static bool wq_need_grow(struct wq_info *wi, size_t nr_pending)
 {
-	if (uatomic_read(&wi->nr_queued_work) < wi->nr_threads / 2)
-		/* we cannot shrink work queue during protection period. */
-		return wi->tm_end_of_protection <= get_msec_time();
-
-	/* update the end of protection time */
-	wi->tm_end_of_protection = get_msec_time() + WQ_PROTECTION_PERIOD;
-	return false;
+	return nr_pending > uatomic_read(&wi->nr_idle) &&
+		uatomic_read(&wi->nr_threads) < wq_get_roof(wi);
 }
 
 static int create_worker_threads(struct wq_info *wi, size_t nr_threads)
@@ -248,14 +250,14 @@ static int create_worker_threads(struct wq_info *wi, size_t nr_threads)
 	int ret;
 
 	sd_mutex_lock(&wi->startup_lock);
-	while (wi->nr_threads < nr_threads) {
+	while (uatomic_read(&wi->nr_threads) < nr_threads) {
 		ret = pthread_create(&thread, NULL, worker_routine, wi);
 		if (ret != 0) {
 			sd_err("failed to create worker thread: %m");
 			sd_mutex_unlock(&wi->startup_lock);
 			return -1;
 		}
-		wi->nr_threads++;
+		uatomic_inc(&wi->nr_threads);
 		sd_debug("create thread %s %zu", wi->name, wi->nr_threads);
 	}
 	sd_mutex_unlock(&wi->startup_lock);
@@ -266,18 +268,27 @@ static int create_worker_threads(struct wq_info *wi, size_t nr_threads)
 void queue_work(struct work_queue *q, struct work *work)
 {
 	struct wq_info *wi = container_of(q, struct wq_info, q);
+	struct wq_shard *shard;
+	size_t nr_pending;
+	int idx;
 
-	uatomic_inc(&wi->nr_queued_work);
-	sd_mutex_lock(&wi->pending_lock);
+	/* a worker queues to its own shard, the others spread the works */
+	if (worker_wi == wi)
+		idx = worker_shard;
+	else
+		idx = uatomic_add_return(&wi->next_shard, 1) % wi->nr_shards;
+	shard = wi->shards + idx;
 
-	if (wq_need_grow(wi))
-		/* double the thread pool size */
-		create_worker_threads(wi, wi->nr_threads * 2);
+	uatomic_inc(&wi->nr_queued_work);
+	nr_pending = uatomic_add_return(&wi->nr_pending, 1);
+	sd_mutex_lock(&shard->pending_lock);
+	list_add_tail(&work->w_list, &shard->pending_list);
+	sd_mutex_unlock(&shard->pending_lock);
 
-	list_add_tail(&work->w_list, &wi->q.pending_list);
-	sd_mutex_unlock(&wi->pending_lock);
+	sem_post(&wi->pending_sem);
 
-	sd_cond_signal(&wi->pending_cond);
+	if (wq_need_grow(wi, nr_pending))
+		create_worker_threads(wi, uatomic_read(&wi->nr_threads) + 1);
 }
 
 static void worker_thread_request_done(int fd, int events, void *data)
@@ -290,11 +301,16 @@ static void worker_thread_request_done(int fd, int events, void *data)
 		nr_nodes = wq_get_nr_nodes();
 
 	eventfd_xread(fd);
+	wq_stat.main_wakeup_nr++;
 
 	list_for_each_entry(wi, &wq_info_list, list) {
-		sd_mutex_lock(&wi->finished_lock);
-		list_splice_init(&wi->finished_list, &list);
-		sd_mutex_unlock(&wi->finished_lock);
+		for (int i = 0; i < wi->nr_shards; i++) {
+			struct wq_shard *shard = wi->shards + i;
+
+			sd_mutex_lock(&shard->finished_lock);
+			list_splice_tail_init(&shard->finished_list, &list);
+			sd_mutex_unlock(&shard->finished_lock);
+		}
 
 		while (!list_empty(&list)) {
 			work = list_first_entry(&list, struct work, w_list);
@@ -302,14 +318,98 @@ static void worker_thread_request_done(int fd, int events, void *data)
 
 			work->done(work);
 			uatomic_dec(&wi->nr_queued_work);
+			wq_stat.main_done_nr++;
+		}
+	}
+}
+
+static struct work *shard_dequeue(struct wq_shard *shard)
+{
+	struct work *work = NULL;
+
+	sd_mutex_lock(&shard->pending_lock);
+	if (!list_empty(&shard->pending_list)) {
+		work = list_first_entry(&shard->pending_list, struct work,
+					w_list);
+		list_del(&work->w_list);
+	}
+	sd_mutex_unlock(&shard->pending_lock);
+
+	return work;
+}
+
+/*
+ * Take a work from the own shard, or steal one from the others
+ *
+ * The caller got a token from pending_sem, so there is a work for it, but
+ * another worker may take it from under us; then go around again.
+ */
+static struct work *wq_dequeue(struct wq_info *wi)
+{
+	struct work *work;
+
+	for (;;) {
+		for (int i = 0; i < wi->nr_shards; i++) {
+			int idx = (worker_shard + i) % wi->nr_shards;
+
+			work = shard_dequeue(wi->shards + idx);
+			if (work) {
+				uatomic_dec(&wi->nr_pending);
+				return work;
+			}
+		}
+	}
+}
+
+/*
+ * Wait for a pending work, return false if the thread should exit
+ *
+ * A thread idle for the whole protection period exits, but the last one.
+ */
+static bool wq_wait(struct wq_info *wi)
+{
+	struct timespec ts;
+	int ret;
+
+	for (;;) {
+		uatomic_inc(&wi->nr_idle);
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec += WQ_PROTECTION_PERIOD / 1000;
+		do {
+			ret = sem_timedwait(&wi->pending_sem, &ts);
+		} while (ret < 0 && errno == EINTR);
+		uatomic_dec(&wi->nr_idle);
+
+		if (ret == 0)
+			return true;
+		if (errno != ETIMEDOUT)
+			panic("failed to wait for a work, %m");
+
+		/*
+		 * queue_work() posts before it looks at nr_idle, so a work
+		 * which didn't grow the pool because it counted us as idle is
+		 * still in pending_sem.  Take it rather than leave it behind.
+		 */
+		sd_mutex_lock(&wi->startup_lock);
+		if (sem_trywait(&wi->pending_sem) == 0) {
+			sd_mutex_unlock(&wi->startup_lock);
+			return true;
 		}
+		if (uatomic_read(&wi->nr_threads) > 1) {
+			uatomic_dec(&wi->nr_threads);
+			sd_mutex_unlock(&wi->startup_lock);
+			return false;
+		}
+		sd_mutex_unlock(&wi->startup_lock);
 	}
 }
 
 static void *worker_routine(void *arg)
 {
 	struct wq_info *wi = arg;
+	struct wq_shard *shard;
 	struct work *work;
+	bool wakeup;
 	int tid = gettid();
 
 	set_thread_name(wi->name, (wi->tc != WQ_ORDERED));
@@ -318,42 +418,41 @@ static void *worker_routine(void *arg)
 	/* started this thread */
 	sd_mutex_unlock(&wi->startup_lock);
 
-	trace_set_tid_map(tid);
-	while (true) {
-
-		sd_mutex_lock(&wi->pending_lock);
-		if (wq_need_shrink(wi)) {
-			wi->nr_threads--;
-
-			trace_clear_tid_map(tid);
-			sd_mutex_unlock(&wi->pending_lock);
-			pthread_detach(pthread_self());
-			sd_debug("destroy thread %s %d, %zu", wi->name, tid,
-				 wi->nr_threads);
-			break;
-		}
-retest:
-		if (list_empty(&wi->q.pending_list)) {
-			sd_cond_wait(&wi->pending_cond, &wi->pending_lock);
-			goto retest;
-		}
-
-		work = list_first_entry(&wi->q.pending_list,
-				       struct work, w_list);
+	worker_wi = wi;
+	worker_shard = uatomic_add_return(&wi->next_worker, 1) % wi->nr_shards;
+	shard = wi->shards + worker_shard;
 
-		list_del(&work->w_list);
-		sd_mutex_unlock(&wi->pending_lock);
+	trace_set_tid_map(tid);
+	while (wq_wait(wi)) {
+		work = wq_dequeue(wi);
 
 		if (work->fn)
 			work->fn(work);
 
-		sd_mutex_lock(&wi->finished_lock);
-		list_add_tail(&work->w_list, &wi->finished_list);
-		sd_mutex_unlock(&wi->finished_lock);
+		if (worker_done_work == work) {
+			/* the work may be freed already, don't touch it */
+			worker_done_work = NULL;
+			uatomic_dec(&wi->nr_queued_work);
+			uatomic_inc(&wq_stat.worker_done_nr);
+			continue;
+		}
 
-		eventfd_xwrite(efd, 1);
+		/*
+		 * Only the first work of a batch wakes up the main thread, the
+		 * others are picked up with it.
+		 */
+		sd_mutex_lock(&shard->finished_lock);
+		wakeup = list_empty(&shard->finished_list);
+		list_add_tail(&work->w_list, &shard->finished_list);
+		sd_mutex_unlock(&shard->finished_lock);
+
+		if (wakeup)
+			eventfd_xwrite(efd, 1);
 	}
 
+	trace_clear_tid_map(tid);
+	pthread_detach(pthread_self());
+	sd_debug("destroy thread %s %d, %zu", wi->name, tid, wi->nr_threads);
 	pthread_exit(NULL);
 }
 
@@ -402,32 +501,46 @@ struct work_queue *create_work_queue(const char *name,
 {
 	int ret;
 	struct wq_info *wi;
+	long nr_cpus = sysconf(_SC_NPROCESSORS_ONLN);
 
 	wi = xzalloc(sizeof(*wi));
 	wi->name = name;
 	wi->tc = tc;
 
-	INIT_LIST_HEAD(&wi->q.pending_list);
-	INIT_LIST_HEAD(&wi->finished_list);
+	/* a single shard keeps the works of an ordered queue in order */
+	wi->nr_shards = tc == WQ_ORDERED ? 1 : max(nr_cpus, 1L);
+	wi->shards = xvalloc(sizeof(*wi->shards) * wi->nr_shards);
+	for (int i = 0; i < wi->nr_shards; i++) {
+		struct wq_shard *shard = wi->shards + i;
 
-	sd_cond_init(&wi->pending_cond);
+		INIT_LIST_HEAD(&shard->pending_list);
+		INIT_LIST_HEAD(&shard->finished_list);
+		sd_init_mutex(&shard->pending_lock);
+		sd_init_mutex(&shard->finished_lock);
+	}
 
-	sd_init_mutex(&wi->finished_lock);
-	sd_init_mutex(&wi->pending_lock);
+	if (sem_init(&wi->pending_sem, 0, 0) < 0) {
+		sd_err("failed to init a semaphore: %m");
+		goto free_shards;
+	}
 	sd_init_mutex(&wi->startup_lock);
 
 	ret = create_worker_threads(wi, 1);
 	if (ret < 0)
-		goto destroy_threads;
+		goto destroy_sem;
 
 	list_add(&wi->list, &wq_info_list);
 
 	return &wi->q;
-destroy_threads:
-	sd_mutex_unlock(&wi->startup_lock);
-	sd_destroy_cond(&wi->pending_cond);
-	sd_destroy_mutex(&wi->pending_lock);
-	sd_destroy_mutex(&wi->finished_lock);
+destroy_sem:
+	sem_destroy(&wi->pending_sem);
+	sd_destroy_mutex(&wi->startup_lock);
+free_shards:
+	for (int i = 0; i < wi->nr_shards; i++) {
+		sd_destroy_mutex(&wi->shards[i].pending_lock);
+		sd_destroy_mutex(&wi->shards[i].finished_lock);
+	}
+	free(wi->shards);
 	free(wi);
 
 	return NULL;
@@ -438,6 +551,19 @@ struct work_queue *create_ordered_work_queue(const char *name)
 	return create_work_queue(name, WQ_ORDERED);
 }
 
+void work_done_on_worker(struct work *work)
+{
+	assert(is_worker_thread());
+	worker_done_work = work;
+}
+
+void get_wq_stat(struct wq_stat *stat)
+{
+	stat->main_done_nr = wq_stat.main_done_nr;
+	stat->main_wakeup_nr = wq_stat.main_wakeup_nr;
+	stat->worker_done_nr = uatomic_read(&wq_stat.worker_done_nr);
+}
+
 bool work_queue_empty(struct work_queue *q)
 {
 	struct wq_info *wi = container_of(q, struct wq_info, q);
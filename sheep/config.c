@@ -12,7 +12,7 @@
 #include "sheep_priv.h"
 
 #define SD_FORMAT_VERSION 0x0004
-#define SD_CONFIG_SIZE 40
+#define SD_CONFIG_SIZE 56
 
 static struct sheepdog_config {
 	uint64_t ctime;
@@ -24,6 +24,8 @@ static struct sheepdog_config {
 	uint8_t __pad;
 	uint16_t version;
 	uint64_t space;
+	/* Appended without a new format version, so older files lack it */
+	struct recovery_throttle recovery_throttle;
 } config;
 
 char *config_path;
@@ -103,7 +105,8 @@ int init_config_file(void)
 			if (ret == 0) {
 				/* reload config file */
 				ret = xpread(fd, &config, sizeof(config), 0);
-				if (ret != sizeof(config)) {
+				if (ret < (int)offsetof(struct sheepdog_config,
+							recovery_throttle)) {
 					sd_err("failed to reload config file,"
 					       " %m");
 					ret = -1;
@@ -123,6 +126,9 @@ int init_config_file(void)
 reload:
 	ret = 0;
 	get_cluster_config(&sys->cinfo);
+	if (config.recovery_throttle.max_bps ||
+	    config.recovery_throttle.max_ops)
+		set_recovery_throttle(&config.recovery_throttle);
 out:
 	close(fd);
 
@@ -170,6 +176,16 @@ int get_node_space(uint64_t *space)
 	return SD_RES_SUCCESS;
 }
 
+int set_recovery_throttle_config(const struct recovery_throttle *throttle)
+{
+	if (!memcmp(&config.recovery_throttle, throttle, sizeof(*throttle)))
+		return SD_RES_SUCCESS;
+
+	config.recovery_throttle = *throttle;
+
+	return write_config();
+}
+
 bool is_cluster_formatted(void)
 {
 	struct cluster_info cinfo;
@@ -0,0 +1,300 @@
+/*
+ * Copyright (C) 2013 Nippon Telegraph and Telephone Corporation.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License version
+ * 2 as published by the Free Software Foundation.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Open file descriptor cache for the plain store
+ *
+ * Every object I/O of the plain store used to build the object path, check it
+ * with md_exist() and open/close the file around a single pread/pwrite.  This
+ * cache keeps the descriptors of hot objects open so that the hot path is just
+ * the pread/pwrite.
+ *
+ * Entries are keyed by (oid, ec_index, open flags) and spread over shards to
+ * keep the lock contention of the worker threads low.  Each shard has its own
+ * LRU list and the total number of cached descriptors is bounded by
+ * FD_CACHE_PER_DISK times the number of the md disks.
+ *
+ * Whoever renames, unlinks or moves an object file must call fd_cache_del()
+ * *after* the operation, and fd_cache_purge() when the disk layout changes.
+ * A per-shard generation protects against racing with an opener which
+ * resolved the old path: the descriptor is still handed back to the opener,
+ * but never becomes visible to others.
+ */
+
+#include <sys/resource.h>
+
+#include "sheep_priv.h"
+
+#define FD_CACHE_SHARD_BITS	6
+#define NR_FD_CACHE_SHARDS	(1 << FD_CACHE_SHARD_BITS)
+#define FD_CACHE_HASH_BITS	8
+#define FD_CACHE_HASH_SIZE	(1 << FD_CACHE_HASH_BITS)
+#define FD_CACHE_PER_DISK	1024
+
+struct fd_cache_entry {
+	struct hlist_node hash;
+	struct list_node lru;
+	uint64_t oid;
+	uint8_t ec_index;
+	int flags;
+	int fd;
+	int refcnt;
+	bool cached;
+};
+
+struct fd_cache_shard {
+	struct sd_mutex lock;
+	struct hlist_head hash[FD_CACHE_HASH_SIZE];
+	struct list_head lru;
+	uint32_t nr;
+	uint64_t gen;
+} __attribute__((aligned(64)));
+
+static struct fd_cache_shard shards[NR_FD_CACHE_SHARDS];
+static uint32_t nofile_limit;
+
+/* ec_index is meaningless for replicated objects, callers pass 0 or more */
+static inline uint8_t fd_cache_ec_index(uint64_t oid, uint8_t ec_index)
+{
+	return is_erasure_oid(oid) ? ec_index : 0;
+}
+
+static inline uint64_t fd_cache_hash(uint64_t oid, uint8_t ec_index)
+{
+	return sd_hash_64(oid ^ ec_index);
+}
+
+static inline struct fd_cache_shard *oid_to_shard(uint64_t hval)
+{
+	return shards + (hval & (NR_FD_CACHE_SHARDS - 1));
+}
+
+static inline struct hlist_head *oid_to_bucket(struct fd_cache_shard *shard,
+					       uint64_t hval)
+{
+	hval >>= FD_CACHE_SHARD_BITS;
+	return shard->hash + (hval & (FD_CACHE_HASH_SIZE - 1));
+}
+
+/*
+ * Don't let the cache eat up all the descriptors the process is allowed to
+ * open, the client and peer connections need them more.
+ */
+static uint32_t shard_capacity(void)
+{
+	uint32_t max = FD_CACHE_PER_DISK * md_nr_disks();
+
+	if (nofile_limit && max > nofile_limit / 4)
+		max = nofile_limit / 4;
+
+	return DIV_ROUND_UP(max, NR_FD_CACHE_SHARDS);
+}
+
+static void free_entry(struct fd_cache_entry *entry)
+{
+	close(entry->fd);
+	free(entry);
+}
+
+/* Unhash the entry and free it unless somebody is still using it */
+static void drop_entry(struct fd_cache_shard *shard,
+		       struct fd_cache_entry *entry)
+{
+	hlist_del(&entry->hash);
+	list_del(&entry->lru);
+	entry->cached = false;
+	shard->nr--;
+	uatomic_dec(&sys->stat.s.fd_cache_nr);
+	if (entry->refcnt == 0)
+		free_entry(entry);
+}
+
+static void shrink_shard(struct fd_cache_shard *shard, uint32_t capacity)
+{
+	struct fd_cache_entry *entry;
+
+	list_for_each_entry(entry, &shard->lru, lru) {
+		if (shard->nr <= capacity)
+			break;
+		/* Entries in use will be reclaimed by later insertions */
+		if (entry->refcnt)
+			continue;
+		drop_entry(shard, entry);
+	}
+}
+
+/*
+ * Look up a cached descriptor and take a reference to it.
+ *
+ * On a miss, NULL is returned and 'gen' is set to the generation which the
+ * caller has to pass to fd_cache_add() after it opens the object.
+ */
+struct fd_cache_entry *fd_cache_get(uint64_t oid, uint8_t ec_index, int flags,
+				    uint64_t *gen)
+{
+	uint64_t hval;
+	struct fd_cache_shard *shard;
+	struct hlist_head *head;
+	struct fd_cache_entry *entry;
+	struct hlist_node *node;
+
+	ec_index = fd_cache_ec_index(oid, ec_index);
+	hval = fd_cache_hash(oid, ec_index);
+	shard = oid_to_shard(hval);
+	head = oid_to_bucket(shard, hval);
+
+	sd_mutex_lock(&shard->lock);
+	hlist_for_each_entry(entry, node, head, hash) {
+		if (entry->oid == oid && entry->ec_index == ec_index &&
+		    entry->flags == flags) {
+			entry->refcnt++;
+			list_move_tail(&entry->lru, &shard->lru);
+			sd_mutex_unlock(&shard->lock);
+			uatomic_inc(&sys->stat.s.fd_cache_hit);
+			return entry;
+		}
+	}
+	*gen = shard->gen;
+	sd_mutex_unlock(&shard->lock);
+	uatomic_inc(&sys->stat.s.fd_cache_miss);
+
+	return NULL;
+}
+
+/*
+ * Insert a newly opened descriptor and return the referenced entry.  The
+ * cache owns the descriptor from now on, so the caller must not close it.
+ *
+ * If the shard was invalidated since fd_cache_get() or another thread has
+ * raced us, the entry is private to the caller and closed on fd_cache_put().
+ */
+struct fd_cache_entry *fd_cache_add(uint64_t oid, uint8_t ec_index, int flags,
+				    int fd, uint64_t gen)
+{
+	uint64_t hval;
+	struct fd_cache_shard *shard;
+	struct hlist_head *head;
+	struct fd_cache_entry *entry, *new = xzalloc(sizeof(*new));
+	struct hlist_node *node;
+	uint32_t capacity = shard_capacity();
+
+	ec_index = fd_cache_ec_index(oid, ec_index);
+	hval = fd_cache_hash(oid, ec_index);
+	shard = oid_to_shard(hval);
+	head = oid_to_bucket(shard, hval);
+
+	new->oid = oid;
+	new->ec_index = ec_index;
+	new->flags = flags;
+	new->fd = fd;
+	new->refcnt = 1;
+	INIT_LIST_NODE(&new->lru);
+
+	sd_mutex_lock(&shard->lock);
+	if (shard->gen != gen)
+		goto out;
+
+	hlist_for_each_entry(entry, node, head, hash) {
+		if (entry->oid == oid && entry->ec_index == ec_index &&
+		    entry->flags == flags)
+			goto out;
+	}
+
+	new->cached = true;
+	hlist_add_head(&new->hash, head);
+	list_add_tail(&new->lru, &shard->lru);
+	shard->nr++;
+	uatomic_inc(&sys->stat.s.fd_cache_nr);
+	shrink_shard(shard, capacity);
+out:
+	sd_mutex_unlock(&shard->lock);
+	return new;
+}
+
+int fd_cache_fd(const struct fd_cache_entry *entry)
+{
+	return entry->fd;
+}
+
+void fd_cache_put(struct fd_cache_entry *entry)
+{
+	uint64_t hval = fd_cache_hash(entry->oid, entry->ec_index);
+	struct fd_cache_shard *shard = oid_to_shard(hval);
+	bool release;
+
+	sd_mutex_lock(&shard->lock);
+	release = --entry->refcnt == 0 && !entry->cached;
+	sd_mutex_unlock(&shard->lock);
+
+	if (release)
+		free_entry(entry);
+}
+
+/* Drop all the descriptors of the object, regardless of the open flags */
+void fd_cache_del(uint64_t oid, uint8_t ec_index)
+{
+	uint64_t hval;
+	struct fd_cache_shard *shard;
+	struct hlist_head *head;
+	struct fd_cache_entry *entry;
+	struct hlist_node *node;
+
+	ec_index = fd_cache_ec_index(oid, ec_index);
+	hval = fd_cache_hash(oid, ec_index);
+	shard = oid_to_shard(hval);
+	head = oid_to_bucket(shard, hval);
+
+	sd_mutex_lock(&shard->lock);
+	hlist_for_each_entry(entry, node, head, hash) {
+		if (entry->oid == oid && entry->ec_index == ec_index)
+			drop_entry(shard, entry);
+	}
+	shard->gen++;
+	sd_mutex_unlock(&shard->lock);
+}
+
+/* Drop everything, used when objects can change their location en masse */
+void fd_cache_purge(void)
+{
+	struct fd_cache_entry *entry;
+
+	for (int i = 0; i < NR_FD_CACHE_SHARDS; i++) {
+		struct fd_cache_shard *shard = shards + i;
+
+		sd_mutex_lock(&shard->lock);
+		list_for_each_entry(entry, &shard->lru, lru)
+			drop_entry(shard, entry);
+		shard->gen++;
+		sd_mutex_unlock(&shard->lock);
+	}
+}
+
+/*
+ * The shards must be usable before the store is initialized, because
+ * default_format() and the md plug operations purge the cache.
+ */
+static void __attribute__((constructor)) fd_cache_init_shards(void)
+{
+	for (int i = 0; i < NR_FD_CACHE_SHARDS; i++) {
+		sd_init_mutex(&shards[i].lock);
+		INIT_LIST_HEAD(&shards[i].lru);
+	}
+}
+
+int fd_cache_init(void)
+{
+	struct rlimit r;
+
+	if (getrlimit(RLIMIT_NOFILE, &r) == 0 && r.rlim_cur != RLIM_INFINITY)
+		nofile_limit = r.rlim_cur;
+
+	return 0;
+}
@@ -0,0 +1,732 @@
+/*
+ * Copyright (C) 2013 Nippon Telegraph and Telephone Corporation.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License version
+ * 2 as published by the Free Software Foundation.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Asynchronous forwarding of the gateway requests
+ *
+ * A gateway worker used to send a request to each replica and then poll()
+ * until all of them replied, so the number of requests in flight was bounded
+ * by the number of gateway workers, each of them mostly sleeping.
+ *
+ * Now the worker only prepares the requests to the replicas and hands them
+ * over with forward_submit().  A few forwarder threads, each with its own
+ * epoll set, drive the sockets with non-blocking calls through a small state
+ * machine per rpc: send the header and the data, wait for the response
+ * header, then receive its data.  When the last rpc of a request is done, its
+ * end() callback is called in the forwarder thread and its done() callback in
+ * the main thread.
+ *
+ * An rpc either borrows a connection of the sockfd cache for itself, or, with
+ * '-m', shares one of the multiplexed connections of its forwarder to the
+ * peer.  The requests over a shared connection are tagged with sd_req.id and
+ * the peer, which serves the requests of a connection concurrently anyway,
+ * answers them in any order.  Only the peers advertising SD_PEER_VER_MUX get
+ * shared connections.
+ *
+ * All the rpcs of a request and all the connections of a forwarder are only
+ * touched by the forwarder thread, so their bookkeeping takes no lock.  The
+ * only exception is the lookup of the shared connections by the submitting
+ * workers, which connect to the peer themselves if there is none, so that
+ * the forwarder never blocks in connect().  The forwarder changes the tree
+ * of the shared connections under its lock for them.
+ */
+
+#include <sys/eventfd.h>
+
+#include "sheep_priv.h"
+
+#define NR_FORWARDERS		2
+#define NR_FORWARD_EVENTS	128
+/* how often the forwarders look for the rpcs timing out, in ms */
+#define FORWARD_TICK		1000
+
+enum rpc_state {
+	RPC_SEND,	/* queued or being sent */
+	RPC_WAIT,	/* waiting for the response header */
+	RPC_RECV,	/* receiving the response data */
+};
+
+struct forward_conn {
+	struct rb_node rb;		/* in the shared connections */
+	struct node_id nid;
+	int fd;
+	struct sockfd *sfd;		/* NULL if shared */
+	uint32_t events;
+	uint32_t next_id;
+
+	struct list_head send_list;	/* the rpcs to send, in order */
+	struct rb_root rpc_root;	/* all the rpcs, by id */
+
+	struct sd_rsp rsp;		/* the response header being received */
+	size_t rsp_len;
+	struct forward_rpc *recv_rpc;	/* the rpc receiving its data */
+};
+
+struct forwarder {
+	int efd;
+	int submit_fd;
+	struct sd_mutex lock;
+	struct list_head submit_list;
+
+	/* only used by the forwarder thread */
+	struct list_head rpc_list;
+	struct rb_root conn_root;	/* changed under 'lock' */
+	uint64_t last_tick;
+};
+
+static struct forwarder forwarders[NR_FORWARDERS];
+static uint32_t next_forwarder;
+
+static int done_fd;
+static struct sd_mutex done_lock = SD_MUTEX_INITIALIZER;
+static LIST_HEAD(done_list);
+
+static int conn_cmp(const struct forward_conn *a, const struct forward_conn *b)
+{
+	return node_id_cmp(&a->nid, &b->nid);
+}
+
+static int rpc_cmp(const struct forward_rpc *a, const struct forward_rpc *b)
+{
+	return intcmp(a->hdr.id, b->hdr.id);
+}
+
+/* Whether the requests to 'nid' share the multiplexed connections */
+bool forward_multiplexed(const struct node_id *nid)
+{
+	return sys->peer_mux && nid->peer_ver >= SD_PEER_VER_MUX;
+}
+
+static void forward_end(struct forward_req *fr)
+{
+	void (*done)(struct forward_req *) = fr->done;
+
+	/* 'fr' may be gone after end() if there is nothing else to do */
+	if (fr->end)
+		fr->end(fr);
+	if (!done)
+		return;
+
+	sd_mutex_lock(&done_lock);
+	list_add_tail(&fr->list, &done_list);
+	sd_mutex_unlock(&done_lock);
+	eventfd_xwrite(done_fd, 1);
+}
+
+static void conn_update_events(struct forwarder *fw, struct forward_conn *conn)
+{
+	struct epoll_event ev = {
+		.events = EPOLLIN,
+		.data.ptr = conn,
+	};
+
+	if (!list_empty(&conn->send_list))
+		ev.events |= EPOLLOUT;
+	if (ev.events == conn->events)
+		return;
+
+	if (epoll_ctl(fw->efd, conn->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD,
+		      conn->fd, &ev) < 0)
+		panic("failed to update the events of %d, %m", conn->fd);
+	conn->events = ev.events;
+}
+
+static void conn_close(struct forwarder *fw, struct forward_conn *conn,
+		       int ret)
+{
+	if (conn->events)
+		epoll_ctl(fw->efd, EPOLL_CTL_DEL, conn->fd, NULL);
+
+	if (!conn->sfd) {
+		sd_debug("%s:%d", addr_to_str(conn->nid.addr, 0),
+			 conn->nid.port);
+		sd_mutex_lock(&fw->lock);
+		rb_erase(&conn->rb, &fw->conn_root);
+		sd_mutex_unlock(&fw->lock);
+		close(conn->fd);
+	} else if (ret == SD_RES_NETWORK_ERROR)
+		sockfd_cache_del(&conn->nid, conn->sfd);
+	else
+		sockfd_cache_put(&conn->nid, conn->sfd);
+	free(conn);
+}
+
+/* Called once the rpc is out of the hands of the connection */
+static void rpc_end(struct forwarder *fw, struct forward_rpc *rpc, int ret)
+{
+	struct forward_req *fr = rpc->fr;
+	struct forward_conn *conn = rpc->conn;
+
+	if (conn) {
+		rb_erase(&rpc->rb, &conn->rpc_root);
+		if (rpc->state == RPC_SEND)
+			list_del(&rpc->queue);
+		if (conn->sfd)
+			conn_close(fw, conn, ret);
+	}
+	list_del(&rpc->list);
+	free(rpc->vec_buf);
+	peer_io_end(rpc->ps, rpc->start, ret);
+
+	if (ret != SD_RES_SUCCESS) {
+		sd_err("fail %s:%d, %s", addr_to_str(rpc->nid->addr, 0),
+		       rpc->nid->port, sd_strerror(ret));
+		fr->result = ret;
+	}
+
+	if (--fr->nr_pending == 0)
+		forward_end(fr);
+}
+
+/* Fail all the rpcs of the connection and close it */
+static void conn_fail(struct forwarder *fw, struct forward_conn *conn)
+{
+	struct rb_node *n;
+
+	if (conn->sfd) {
+		/* the only rpc closes it */
+		n = rb_first(&conn->rpc_root);
+		rpc_end(fw, rb_entry(n, struct forward_rpc, rb),
+			SD_RES_NETWORK_ERROR);
+		return;
+	}
+
+	while ((n = rb_first(&conn->rpc_root)))
+		rpc_end(fw, rb_entry(n, struct forward_rpc, rb),
+			SD_RES_NETWORK_ERROR);
+	conn_close(fw, conn, SD_RES_NETWORK_ERROR);
+}
+
+static struct forward_conn *conn_new(const struct node_id *nid, int fd,
+				     struct sockfd *sfd)
+{
+	struct forward_conn *conn = xzalloc(sizeof(*conn));
+
+	conn->nid = *nid;
+	conn->fd = fd;
+	conn->sfd = sfd;
+	INIT_LIST_HEAD(&conn->send_list);
+	INIT_RB_ROOT(&conn->rpc_root);
+
+	return conn;
+}
+
+/*
+ * Return the shared connection of the forwarder to the peer of 'rpc', or NULL
+ *
+ * A new one is set up with the socket which the submitting worker connected,
+ * if any.  There is none if the connection was still there when the request
+ * was submitted, but has failed since.
+ */
+static struct forward_conn *get_shared_conn(struct forwarder *fw,
+					    struct forward_rpc *rpc)
+{
+	struct forward_conn key = { .nid = *rpc->nid }, *conn;
+
+	conn = rb_search(&fw->conn_root, &key, rb, conn_cmp);
+	if (conn) {
+		/* another worker connected first */
+		if (rpc->fd >= 0)
+			close(rpc->fd);
+		return conn;
+	}
+	if (rpc->fd < 0)
+		return NULL;
+
+	sd_debug("%s:%d, %d", addr_to_str(rpc->nid->addr, 0), rpc->nid->port,
+		 rpc->fd);
+	conn = conn_new(rpc->nid, rpc->fd, NULL);
+	sd_mutex_lock(&fw->lock);
+	rb_insert(&fw->conn_root, conn, rb, conn_cmp);
+	sd_mutex_unlock(&fw->lock);
+
+	return conn;
+}
+
+static void rpc_advance(struct forward_rpc *rpc, size_t len)
+{
+	while (rpc->vcnt > 0 && rpc->vec->iov_len <= len) {
+		len -= rpc->vec->iov_len;
+		rpc->vec++;
+		rpc->vcnt--;
+	}
+	if (len) {
+		rpc->vec->iov_base = (char *)rpc->vec->iov_base + len;
+		rpc->vec->iov_len -= len;
+	}
+}
+
+/*
+ * Transfer as much of the iovecs as the socket takes without blocking
+ *
+ * Return the nr of bytes transferred, or -1 on error.  Less than 'len' means
+ * the socket would block.
+ */
+static ssize_t xfer(int fd, struct iovec *iov, int iovcnt, bool out)
+{
+	struct msghdr msg = {
+		.msg_iov = iov,
+		.msg_iovlen = min(iovcnt, IOV_MAX),
+	};
+	ssize_t ret;
+
+again:
+	if (out)
+		ret = sendmsg(fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+	else
+		ret = recvmsg(fd, &msg, MSG_DONTWAIT);
+	if (ret < 0) {
+		if (errno == EINTR)
+			goto again;
+		if (errno == EAGAIN)
+			return 0;
+		sd_err("failed to %s, %m", out ? "send" : "receive");
+		return -1;
+	}
+	if (ret == 0 && !out && iovcnt > 0) {
+		sd_err("remote node might have gone away");
+		return -1;
+	}
+
+	return ret;
+}
+
+/* Return 1 if the rpc has transferred all its iovecs, 0 if not yet, or -1 */
+static int rpc_xfer(struct forward_rpc *rpc, bool out)
+{
+	while (rpc->vcnt > 0) {
+		ssize_t ret = xfer(rpc->conn->fd, rpc->vec, rpc->vcnt, out);
+
+		if (ret <= 0)
+			return ret;
+		rpc_advance(rpc, ret);
+		rpc->last = clock_get_time();
+	}
+
+	return 1;
+}
+
+/* Prepare to receive the response data into rpc->iov */
+static int rpc_recv_data(struct forward_rpc *rpc, uint32_t len)
+{
+	int i;
+
+	for (i = 0; i < rpc->iovcnt && len > 0; i++) {
+		rpc->vec_buf[i] = rpc->iov[i];
+		rpc->vec_buf[i].iov_len = min(rpc->iov[i].iov_len, (size_t)len);
+		len -= rpc->vec_buf[i].iov_len;
+	}
+	if (len > 0) {
+		sd_err("too long response, %"PRIu32" bytes left", len);
+		return -1;
+	}
+	rpc->vec = rpc->vec_buf;
+	rpc->vcnt = i;
+	rpc->state = RPC_RECV;
+
+	return 0;
+}
+
+/* Send the queued rpcs, return -1 on error */
+static int conn_send(struct forward_conn *conn)
+{
+	while (!list_empty(&conn->send_list)) {
+		struct forward_rpc *rpc;
+		int ret;
+
+		rpc = list_first_entry(&conn->send_list, struct forward_rpc,
+				       queue);
+		ret = rpc_xfer(rpc, true);
+		if (ret <= 0)
+			return ret;
+		list_del(&rpc->queue);
+		rpc->state = RPC_WAIT;
+	}
+
+	return 0;
+}
+
+static void rpc_replied(struct forwarder *fw, struct forward_rpc *rpc)
+{
+	struct sd_rsp *rsp = (struct sd_rsp *)&rpc->hdr;
+
+	memcpy(&rpc->fr->rsp, rsp, sizeof(*rsp));
+	rpc->fr->nr_replies++;
+	rpc_end(fw, rpc, rsp->result);
+}
+
+/*
+ * Receive the responses of the connection, return -1 on error
+ *
+ * The connection is gone when it returns 1, after the response of the rpc
+ * which had it for itself.
+ */
+static int conn_recv(struct forwarder *fw, struct forward_conn *conn)
+{
+	struct forward_rpc *rpc, key;
+	struct iovec iov;
+	bool exclusive = conn->sfd != NULL;
+	ssize_t ret;
+
+	for (;;) {
+		rpc = conn->recv_rpc;
+		if (rpc) {
+			ret = rpc_xfer(rpc, false);
+			if (ret <= 0)
+				return ret;
+			conn->recv_rpc = NULL;
+			goto replied;
+		}
+
+		iov.iov_base = (char *)&conn->rsp + conn->rsp_len;
+		iov.iov_len = sizeof(conn->rsp) - conn->rsp_len;
+		ret = xfer(conn->fd, &iov, 1, false);
+		if (ret < 0)
+			return -1;
+		conn->rsp_len += ret;
+		if (conn->rsp_len < sizeof(conn->rsp))
+			return 0;
+		conn->rsp_len = 0;
+
+		key.hdr.id = conn->rsp.id;
+		rpc = rb_search(&conn->rpc_root, &key, rb, rpc_cmp);
+		if (!rpc || rpc->state != RPC_WAIT) {
+			sd_err("unexpected response %"PRIx32" from %s:%d",
+			       conn->rsp.id, addr_to_str(conn->nid.addr, 0),
+			       conn->nid.port);
+			return -1;
+		}
+		memcpy(&rpc->hdr, &conn->rsp, sizeof(conn->rsp));
+		rpc->last = clock_get_time();
+		if (conn->rsp.data_length) {
+			if (rpc_recv_data(rpc, conn->rsp.data_length) < 0)
+				return -1;
+			conn->recv_rpc = rpc;
+			continue;
+		}
+replied:
+		/* an exclusive connection is freed with its rpc */
+		rpc_replied(fw, rpc);
+		if (exclusive)
+			return 1;
+	}
+}
+
+static void conn_handle(struct forwarder *fw, struct forward_conn *conn,
+			uint32_t events)
+{
+	if (events & EPOLLOUT && conn_send(conn) < 0)
+		goto err;
+	if (events & EPOLLIN) {
+		switch (conn_recv(fw, conn)) {
+		case -1:
+			goto err;
+		case 1:
+			return;
+		}
+	} else if (events & (EPOLLERR | EPOLLHUP))
+		goto err;
+
+	conn_update_events(fw, conn);
+	return;
+err:
+	conn_fail(fw, conn);
+}
+
+static void rpc_start(struct forwarder *fw, struct forward_rpc *rpc)
+{
+	struct forward_conn *conn;
+	int nr = 1;
+
+	rpc->vec_buf = xmalloc(sizeof(struct iovec) * (rpc->iovcnt + 1));
+	rpc->vec_buf[0].iov_base = &rpc->hdr;
+	rpc->vec_buf[0].iov_len = sizeof(rpc->hdr);
+	if (rpc->wlen) {
+		memcpy(rpc->vec_buf + 1, rpc->iov,
+		       sizeof(struct iovec) * rpc->iovcnt);
+		nr += rpc->iovcnt;
+	}
+	rpc->vec = rpc->vec_buf;
+	rpc->vcnt = nr;
+	rpc->state = RPC_SEND;
+
+	rpc->ps = peer_io_start(rpc->nid);
+	rpc->start = rpc->last = clock_get_time();
+	list_add_tail(&rpc->list, &fw->rpc_list);
+
+	if (rpc->sfd)
+		conn = conn_new(rpc->nid, rpc->sfd->fd, rpc->sfd);
+	else if (forward_multiplexed(rpc->nid))
+		conn = get_shared_conn(fw, rpc);
+	else
+		conn = NULL;
+	if (!conn) {
+		rpc_end(fw, rpc, SD_RES_NETWORK_ERROR);
+		return;
+	}
+
+	rpc->conn = conn;
+	rpc->hdr.id = conn->next_id++;
+	rb_insert(&conn->rpc_root, rpc, rb, rpc_cmp);
+	list_add_tail(&rpc->queue, &conn->send_list);
+
+	/*
+	 * Don't send right away, since a failure would free the connection,
+	 * which the events yet to handle in this batch may point to
+	 */
+	conn_update_events(fw, conn);
+}
+
+static void forwarder_submitted(struct forwarder *fw)
+{
+	struct forward_req *fr;
+	LIST_HEAD(submit_list);
+
+	eventfd_xread(fw->submit_fd);
+
+	sd_mutex_lock(&fw->lock);
+	list_splice_init(&fw->submit_list, &submit_list);
+	sd_mutex_unlock(&fw->lock);
+
+	list_for_each_entry(fr, &submit_list, list) {
+		list_del(&fr->list);
+		for (int i = 0, nr = fr->nr_rpcs; i < nr; i++)
+			rpc_start(fw, fr->rpcs + i);
+	}
+}
+
+/*
+ * The rpcs which made no progress for POLL_TIMEOUT fail if the epoch has
+ * changed since, and after MAX_POLLTIME anyway, because the epoch isn't
+ * incremented when the network of some node is down.  The other rpcs of the
+ * connection fail with them, since we can't resynchronize with the peer.
+ */
+static void forwarder_tick(struct forwarder *fw)
+{
+	uint64_t now = clock_get_time();
+	struct forward_rpc *rpc;
+
+	if (now - fw->last_tick < FORWARD_TICK * 1000000ULL)
+		return;
+	fw->last_tick = now;
+again:
+	list_for_each_entry(rpc, &fw->rpc_list, list) {
+		uint64_t idle = (now - rpc->last) / 1000000000;
+
+		if (idle < POLL_TIMEOUT)
+			continue;
+		if (sheep_need_retry(rpc->fr->epoch) && idle < MAX_POLLTIME)
+			continue;
+
+		sd_warn("%s:%d timed out, disks of the node or network is busy",
+			addr_to_str(rpc->nid->addr, 0), rpc->nid->port);
+		conn_fail(fw, rpc->conn);
+		goto again;
+	}
+}
+
+static void *forwarder_routine(void *arg)
+{
+	struct forwarder *fw = arg;
+	struct epoll_event events[NR_FORWARD_EVENTS];
+	int nr;
+
+	set_thread_name("forward", true);
+
+	for (;;) {
+		nr = epoll_wait(fw->efd, events, ARRAY_SIZE(events),
+				FORWARD_TICK);
+		if (nr < 0) {
+			if (errno == EINTR)
+				continue;
+			panic("epoll_wait failed, %m");
+		}
+
+		for (int i = 0; i < nr; i++) {
+			if (events[i].data.ptr)
+				conn_handle(fw, events[i].data.ptr,
+					    events[i].events);
+			else
+				forwarder_submitted(fw);
+		}
+
+		forwarder_tick(fw);
+	}
+
+	return NULL;
+}
+
+static bool has_shared_conn(struct forwarder *fw, const struct node_id *nid)
+{
+	struct forward_conn key = { .nid = *nid };
+	bool ret;
+
+	sd_mutex_lock(&fw->lock);
+	ret = rb_search(&fw->conn_root, &key, rb, conn_cmp) != NULL;
+	sd_mutex_unlock(&fw->lock);
+
+	return ret;
+}
+
+static int connect_to_peer(const struct node_id *nid)
+{
+	bool use_io = nid->io_port ? true : false;
+	int fd;
+
+	fd = connect_to_addr(use_io ? nid->io_addr : nid->addr,
+			     use_io ? nid->io_port : nid->port);
+	if (fd < 0 && use_io) {
+		sd_err("fallback to non-io connection");
+		fd = connect_to_addr(nid->addr, nid->port);
+	}
+
+	return fd;
+}
+
+/*
+ * Send the rpcs of 'fr' and call its callbacks when all of them are done
+ *
+ * The rpcs which come with a sockfd use it and release it.  The others get
+ * one from the sockfd cache, or share a connection with the other requests
+ * to a multiplexed peer.  Any connecting is done here, in the worker.
+ */
+worker_fn void forward_submit(struct forward_req *fr)
+{
+	uint32_t idx = uatomic_add_return(&next_forwarder, 1);
+	struct forwarder *fw = forwarders + idx % NR_FORWARDERS;
+
+	fr->nr_pending = fr->nr_rpcs;
+	for (int i = 0; i < fr->nr_rpcs; i++) {
+		struct forward_rpc *rpc = fr->rpcs + i;
+
+		rpc->fr = fr;
+		rpc->fd = -1;
+		if (rpc->sfd)
+			continue;
+		if (!forward_multiplexed(rpc->nid))
+			rpc->sfd = sockfd_cache_get(rpc->nid);
+		else if (!has_shared_conn(fw, rpc->nid))
+			rpc->fd = connect_to_peer(rpc->nid);
+	}
+
+	sd_mutex_lock(&fw->lock);
+	list_add_tail(&fr->list, &fw->submit_list);
+	sd_mutex_unlock(&fw->lock);
+	eventfd_xwrite(fw->submit_fd, 1);
+}
+
+struct forward_sync {
+	struct forward_req fr;
+	struct forward_rpc rpc;
+	struct iovec iov;
+	int efd;
+};
+
+static void forward_sync_end(struct forward_req *fr)
+{
+	struct forward_sync *fs = container_of(fr, struct forward_sync, fr);
+
+	eventfd_xwrite(fs->efd, 1);
+}
+
+/* Like exec_req() but through a forwarder, for the multiplexed peers */
+worker_fn int forward_exec_req(const struct node_id *nid, struct sd_req *hdr,
+			       void *buf)
+{
+	struct forward_sync fs = {};
+
+	fs.efd = eventfd(0, 0);
+	if (fs.efd < 0) {
+		sd_err("failed to create an eventfd, %m");
+		return SD_RES_SYSTEM_ERROR;
+	}
+
+	fs.iov.iov_base = buf;
+	fs.iov.iov_len = hdr->data_length;
+	fs.rpc.nid = nid;
+	fs.rpc.hdr = *hdr;
+	fs.rpc.iov = &fs.iov;
+	fs.rpc.iovcnt = 1;
+	if (hdr->flags & SD_FLAG_CMD_WRITE)
+		fs.rpc.wlen = hdr->data_length;
+	fs.fr.rpcs = &fs.rpc;
+	fs.fr.nr_rpcs = 1;
+	fs.fr.epoch = hdr->epoch;
+	fs.fr.end = forward_sync_end;
+
+	forward_submit(&fs.fr);
+	eventfd_xread(fs.efd);
+	close(fs.efd);
+
+	if (fs.fr.nr_replies)
+		memcpy(hdr, &fs.fr.rsp, sizeof(*hdr));
+	return fs.fr.result;
+}
+
+static void forward_done_handler(int fd, int events, void *data)
+{
+	struct forward_req *fr;
+	LIST_HEAD(list);
+
+	eventfd_xread(fd);
+
+	sd_mutex_lock(&done_lock);
+	list_splice_init(&done_list, &list);
+	sd_mutex_unlock(&done_lock);
+
+	list_for_each_entry(fr, &list, list) {
+		list_del(&fr->list);
+		fr->done(fr);
+	}
+}
+
+int forward_init(void)
+{
+	struct epoll_event ev = { .events = EPOLLIN };
+
+	done_fd = eventfd(0, EFD_NONBLOCK);
+	if (done_fd < 0) {
+		sd_err("failed to create an eventfd, %m");
+		return -1;
+	}
+	register_event(done_fd, forward_done_handler, NULL);
+
+	for (int i = 0; i < NR_FORWARDERS; i++) {
+		struct forwarder *fw = forwarders + i;
+		pthread_t thread;
+		int ret;
+
+		sd_init_mutex(&fw->lock);
+		INIT_LIST_HEAD(&fw->submit_list);
+		INIT_LIST_HEAD(&fw->rpc_list);
+		INIT_RB_ROOT(&fw->conn_root);
+
+		fw->efd = epoll_create(NR_FORWARD_EVENTS);
+		fw->submit_fd = eventfd(0, EFD_NONBLOCK);
+		if (fw->efd < 0 || fw->submit_fd < 0) {
+			sd_err("failed to create a forwarder, %m");
+			return -1;
+		}
+		if (epoll_ctl(fw->efd, EPOLL_CTL_ADD, fw->submit_fd, &ev) < 0) {
+			sd_err("failed to add the submit fd, %m");
+			return -1;
+		}
+
+		ret = pthread_create(&thread, NULL, forwarder_routine, fw);
+		if (ret) {
+			sd_err("failed to create a forwarder, %s",
+			       strerror(ret));
+			return -1;
+		}
+	}
+
+	return 0;
+}
@@ -20,12 +20,24 @@ static inline void gateway_init_fwd_hdr(struct sd_req *fwd, struct sd_req *hdr)
 }
 
 struct req_iter {
-	uint8_t *buf;
+	uint8_t *buf;		/* private buffer, freed by finish_requests() */
+	struct iovec *iov;	/* where the data is sent from or read into */
+	int iovcnt;
+	struct iovec vec;	/* iov of a single segment */
 	uint32_t wlen;
 	uint32_t dlen;
 	uint64_t off;
 };
 
+static inline void req_iter_set_buf(struct req_iter *ri, void *buf,
+				    uint32_t len)
+{
+	ri->vec.iov_base = buf;
+	ri->vec.iov_len = len;
+	ri->iov = &ri->vec;
+	ri->iovcnt = 1;
+}
+
 static struct req_iter *prepare_replication_requests(struct request *req,
 						     int *nr)
 {
@@ -39,7 +51,7 @@ static struct req_iter *prepare_replication_requests(struct request *req,
 
 	*nr = nr_copies;
 	for (int i = 0; i < nr_copies; i++) {
-		reqs[i].buf = data;
+		req_iter_set_buf(&reqs[i], data, len);
 		reqs[i].dlen = len;
 		reqs[i].off = off;
 		reqs[i].wlen = len;
@@ -47,6 +59,58 @@ static struct req_iter *prepare_replication_requests(struct request *req,
 	return reqs;
 }
 
+/*
+ * Erasure coded requests are handled in whole stripes of
+ * SD_EC_DATA_STRIPE_SIZE bytes.  The strips are sent from and read into the
+ * request buffer directly with scatter-gather I/O, except for the partial
+ * stripes at the head and the tail of a misaligned request, which are staged
+ * in a separate buffer.
+ */
+static inline bool stripe_is_partial(struct request *req, int i, int nr_stripe)
+{
+	uint64_t off = req->rq.obj.offset;
+	uint32_t len = req->rq.data_length;
+
+	return (i == 0 && off % SD_EC_DATA_STRIPE_SIZE) ||
+		(i == nr_stripe - 1 && (off + len) % SD_EC_DATA_STRIPE_SIZE);
+}
+
+/* Return where the i-th stripe of the request lives */
+static uint8_t *erasure_stripe(struct request *req, uint8_t *stage, int i,
+			       int nr_stripe)
+{
+	uint64_t off = req->rq.obj.offset;
+	uint64_t soff = round_down(off, SD_EC_DATA_STRIPE_SIZE) +
+		(uint64_t)i * SD_EC_DATA_STRIPE_SIZE;
+
+	if (!stripe_is_partial(req, i, nr_stripe))
+		return (uint8_t *)req->data + (soff - off);
+
+	return i == 0 ? stage : stage + SD_EC_DATA_STRIPE_SIZE;
+}
+
+/*
+ * Copy the part of the i-th stripe which the request covers between the
+ * staging buffer and the request buffer
+ */
+static void copy_partial_stripe(struct request *req, uint8_t *stage, int i,
+				int nr_stripe, bool to_stage)
+{
+	uint64_t off = req->rq.obj.offset;
+	uint32_t len = req->rq.data_length;
+	uint64_t soff = round_down(off, SD_EC_DATA_STRIPE_SIZE) +
+		(uint64_t)i * SD_EC_DATA_STRIPE_SIZE;
+	uint64_t s = max(off, soff);
+	uint64_t e = min(off + len, soff + SD_EC_DATA_STRIPE_SIZE);
+	uint8_t *stripe = erasure_stripe(req, stage, i, nr_stripe);
+	char *data = (char *)req->data + (s - off);
+
+	if (to_stage)
+		memcpy(stripe + (s - soff), data, e - s);
+	else
+		memcpy(data, stripe + (s - soff), e - s);
+}
+
 /*
  * Make sure we don't overwrite the existing data for misaligned write
  *
@@ -55,56 +119,46 @@ static struct req_iter *prepare_replication_requests(struct request *req,
  * This kind of write amplification indeed slow down the write operation with
  * extra read overhead.
  */
-static void *init_erasure_buffer(struct request *req, int buf_len)
+static int init_erasure_stage(struct request *req, uint8_t *stage,
+			      int nr_stripe)
 {
-	char *buf = xvalloc(buf_len);
-	uint32_t len = req->rq.data_length;
-	uint64_t off = req->rq.obj.offset;
-	uint64_t oid = req->rq.obj.oid;
-	int opcode = req->rq.opcode;
+	uint64_t head = round_down(req->rq.obj.offset, SD_EC_DATA_STRIPE_SIZE);
 	struct sd_req hdr;
-	uint64_t head = round_down(off, SD_EC_DATA_STRIPE_SIZE);
-	uint64_t tail = round_down(off + len, SD_EC_DATA_STRIPE_SIZE);
 	int ret;
 
-	if (opcode != SD_OP_WRITE_OBJ)
-		goto out;
+	for (int i = 0; i < nr_stripe; i += max(nr_stripe - 1, 1)) {
+		uint8_t *stripe = erasure_stripe(req, stage, i, nr_stripe);
 
-	if (off % SD_EC_DATA_STRIPE_SIZE) {
-		/* Read head */
-		sd_init_req(&hdr, SD_OP_READ_OBJ);
-		hdr.obj.oid = oid;
-		hdr.data_length = SD_EC_DATA_STRIPE_SIZE;
-		hdr.obj.offset = head;
-		ret = exec_local_req(&hdr, buf);
-		if (ret != SD_RES_SUCCESS) {
-			free(buf);
-			return NULL;
-		}
-	}
+		if (!stripe_is_partial(req, i, nr_stripe))
+			continue;
 
-	if ((len + off) % SD_EC_DATA_STRIPE_SIZE && tail - head > 0) {
-		/* Read tail */
-		sd_init_req(&hdr, SD_OP_READ_OBJ);
-		hdr.obj.oid = oid;
-		hdr.data_length = SD_EC_DATA_STRIPE_SIZE;
-		hdr.obj.offset = tail;
-		ret = exec_local_req(&hdr, buf + tail - head);
-		if (ret != SD_RES_SUCCESS) {
-			free(buf);
-			return NULL;
-		}
+		if (req->rq.opcode == SD_OP_WRITE_OBJ) {
+			sd_init_req(&hdr, SD_OP_READ_OBJ);
+			hdr.obj.oid = req->rq.obj.oid;
+			hdr.data_length = SD_EC_DATA_STRIPE_SIZE;
+			hdr.obj.offset = head +
+				(uint64_t)i * SD_EC_DATA_STRIPE_SIZE;
+			ret = exec_local_req(&hdr, stripe);
+			if (ret != SD_RES_SUCCESS)
+				return ret;
+		} else
+			memset(stripe, 0, SD_EC_DATA_STRIPE_SIZE);
+
+		copy_partial_stripe(req, stage, i, nr_stripe, true);
 	}
-out:
-	memcpy(buf + off % SD_EC_DATA_STRIPE_SIZE, req->data, len);
-	return buf;
+
+	return SD_RES_SUCCESS;
 }
 
 /*
  * We spread data strips of req along with its parity strips onto replica for
  * write opertaion. For read we only need to prepare data strip buffers.
+ *
+ * Only the parity strips get buffers of their own, the data strips are
+ * described by iovecs over the request buffer.
  */
-static struct req_iter *prepare_erasure_requests(struct request *req, int *nr)
+static struct req_iter *prepare_erasure_requests(struct request *req, int *nr,
+						 uint8_t **stage)
 {
 	uint32_t len = req->rq.data_length;
 	uint64_t off = req->rq.obj.offset;
@@ -115,7 +169,8 @@ static struct req_iter *prepare_erasure_requests(struct request *req, int *nr)
 	struct fec *ctx;
 	int strip_size, nr_to_send;
 	struct req_iter *reqs;
-	char *p, *buf = NULL;
+	bool is_write = opcode == SD_OP_WRITE_OBJ ||
+		opcode == SD_OP_CREATE_AND_WRITE_OBJ;
 	uint8_t policy = req->rq.obj.copy_policy ?:
 		get_vdi_copy_policy(oid_to_vid(req->rq.obj.oid));
 	int ed = 0, ep = 0, edp;
@@ -132,49 +187,61 @@ static struct req_iter *prepare_erasure_requests(struct request *req, int *nr)
 	for (i = 0; i < nr_to_send; i++) {
 		int l = strip_size * nr_stripe;
 
-		reqs[i].buf = xmalloc(l);
 		reqs[i].dlen = l;
 		reqs[i].off = start * strip_size;
-		switch (opcode) {
-		case SD_OP_CREATE_AND_WRITE_OBJ:
-		case SD_OP_WRITE_OBJ:
+		if (is_write)
 			reqs[i].wlen = l;
-			break;
-		default:
-			break;
-		}
 	}
 
-	if (opcode != SD_OP_WRITE_OBJ && opcode != SD_OP_CREATE_AND_WRITE_OBJ)
-		goto out; /* Read and remove operation */
+	if (!is_write && opcode != SD_OP_READ_OBJ)
+		goto out; /* Remove operation */
 
-	p = buf = init_erasure_buffer(req, SD_EC_DATA_STRIPE_SIZE * nr_stripe);
-	if (!buf) {
+	if (stripe_is_partial(req, 0, nr_stripe) ||
+	    stripe_is_partial(req, nr_stripe - 1, nr_stripe))
+		*stage = xvalloc(SD_EC_DATA_STRIPE_SIZE * min(nr_stripe, 2));
+
+	if (is_write && *stage &&
+	    init_erasure_stage(req, *stage, nr_stripe) != SD_RES_SUCCESS) {
 		sd_err("failed to init erasure buffer %"PRIx64,
 		       req->rq.obj.oid);
+		free(*stage);
+		*stage = NULL;
 		free(reqs);
 		reqs = NULL;
 		goto out;
 	}
+
+	for (j = 0; j < ed; j++) {
+		reqs[j].iov = xmalloc(sizeof(struct iovec) * nr_stripe);
+		reqs[j].iovcnt = nr_stripe;
+		for (i = 0; i < nr_stripe; i++) {
+			uint8_t *p = erasure_stripe(req, *stage, i, nr_stripe);
+
+			reqs[j].iov[i].iov_base = p + j * strip_size;
+			reqs[j].iov[i].iov_len = strip_size;
+		}
+	}
+
+	if (!is_write)
+		goto out;
+
+	for (j = 0; j < ep; j++) {
+		reqs[ed + j].buf = xmalloc(strip_size * nr_stripe);
+		req_iter_set_buf(&reqs[ed + j], reqs[ed + j].buf,
+				 strip_size * nr_stripe);
+	}
 	for (i = 0; i < nr_stripe; i++) {
 		const uint8_t *ds[ed];
 		uint8_t *ps[ep];
 
 		for (j = 0; j < ed; j++)
-			ds[j] = reqs[j].buf + strip_size * i;
-
+			ds[j] = reqs[j].iov[i].iov_base;
 		for (j = 0; j < ep; j++)
 			ps[j] = reqs[ed + j].buf + strip_size * i;
-
-		for (j = 0; j < ed; j++)
-			memcpy((uint8_t *)ds[j], p + j * strip_size,
-			       strip_size);
 		ec_encode(ctx, ds, ps);
-		p += SD_EC_DATA_STRIPE_SIZE;
 	}
 out:
 	ec_destroy(ctx);
-	free(buf);
 
 	return reqs;
 }
@@ -186,23 +253,24 @@ bool is_erasure_oid(uint64_t oid)
 }
 
 /* Prepare request iterator and buffer for each replica */
-static struct req_iter *prepare_requests(struct request *req, int *nr)
+static struct req_iter *prepare_requests(struct request *req, int *nr,
+					 uint8_t **stage)
 {
+	*stage = NULL;
 	if (is_erasure_oid(req->rq.obj.oid))
-		return prepare_erasure_requests(req, nr);
+		return prepare_erasure_requests(req, nr, stage);
 	else
 		return prepare_replication_requests(req, nr);
 }
 
 static void finish_requests(struct request *req, struct req_iter *reqs,
-			    int nr_to_send)
+			    int nr_to_send, uint8_t *stage)
 {
 	uint64_t oid = req->rq.obj.oid;
 	uint32_t len = req->rq.data_length;
 	uint64_t off = req->rq.obj.offset;
-	int opcode = req->rq.opcode;
 	int start = off / SD_EC_DATA_STRIPE_SIZE;
-	int end = DIV_ROUND_UP(off + len, SD_EC_DATA_STRIPE_SIZE), i, j;
+	int end = DIV_ROUND_UP(off + len, SD_EC_DATA_STRIPE_SIZE), i;
 	int nr_stripe = end - start;
 
 	if (!is_erasure_oid(oid))
@@ -211,32 +279,189 @@ static void finish_requests(struct request *req, struct req_iter *reqs,
 	sd_debug("start %d, end %d, send %d, off %"PRIu64 ", len %"PRIu32,
 		 start, end, nr_to_send, off, len);
 
-	/* We need to assemble the data strips into the req buffer for read */
-	if (opcode == SD_OP_READ_OBJ) {
-		char *p, *buf = xmalloc(SD_EC_DATA_STRIPE_SIZE * nr_stripe);
-		uint8_t policy = req->rq.obj.copy_policy ?:
-			get_vdi_copy_policy(oid_to_vid(req->rq.obj.oid));
-		int ed = 0, strip_size;
+	/*
+	 * The data strips were read into the req buffer in place, only the
+	 * partial stripes need to be copied.
+	 */
+	if (req->rq.opcode == SD_OP_READ_OBJ) {
+		for (i = 0; i < nr_stripe; i += max(nr_stripe - 1, 1))
+			if (stripe_is_partial(req, i, nr_stripe))
+				copy_partial_stripe(req, stage, i, nr_stripe,
+						    false);
+	}
+out:
+	for (i = 0; i < nr_to_send; i++) {
+		free(reqs[i].buf);
+		if (reqs[i].iov != &reqs[i].vec)
+			free(reqs[i].iov);
+	}
+	free(stage);
+	free(reqs);
+}
 
-		ec_policy_to_dp(policy, &ed, NULL);
-		strip_size = SD_EC_DATA_STRIPE_SIZE / ed;
+struct hedge_read {
+	const struct node_id *nid;
+	struct sockfd *sfd;
+	struct peer_stat *ps;
+	uint64_t start;
+	struct sd_req hdr;
+	void *buf;
+	bool done;
+};
 
-		p = buf;
-		for (i = 0; i < nr_stripe; i++) {
-			for (j = 0; j < nr_to_send; j++) {
-				memcpy(p, reqs[j].buf + strip_size * i,
-				       strip_size);
-				p += strip_size;
+static int hedge_send(struct request *req, struct hedge_read *h,
+		      const struct sd_node *n, void *buf)
+{
+	h->nid = &n->nid;
+	h->buf = buf;
+	h->sfd = sockfd_cache_get(h->nid);
+	if (!h->sfd)
+		return -1;
+
+	gateway_init_fwd_hdr(&h->hdr, &req->rq);
+	h->ps = peer_io_start(h->nid);
+	h->start = clock_get_time();
+	if (send_req(h->sfd->fd, &h->hdr, NULL, 0, sheep_need_retry,
+		     req->rq.epoch, MAX_RETRY_COUNT)) {
+		sockfd_cache_del(h->nid, h->sfd);
+		peer_io_end(h->ps, h->start, SD_RES_NETWORK_ERROR);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int hedge_recv(struct request *req, struct hedge_read *h)
+{
+	struct sd_rsp *rsp = (struct sd_rsp *)&h->hdr;
+	uint32_t rlen = req->rq.data_length;
+	int ret;
+
+	h->done = true;
+	if (do_read(h->sfd->fd, rsp, sizeof(*rsp), sheep_need_retry,
+		    req->rq.epoch, MAX_RETRY_COUNT))
+		goto err;
+	rlen = min(rlen, rsp->data_length);
+	if (rlen && do_read(h->sfd->fd, h->buf, rlen, sheep_need_retry,
+			    req->rq.epoch, MAX_RETRY_COUNT))
+		goto err;
+
+	sockfd_cache_put(h->nid, h->sfd);
+	ret = rsp->result;
+	peer_io_end(h->ps, h->start, ret);
+	if (ret == SD_RES_SUCCESS)
+		account_read_latency(clock_get_time() - h->start);
+	else
+		sd_err("failed %s", sd_strerror(ret));
+
+	return ret;
+err:
+	sd_err("remote node might have gone away");
+	sockfd_cache_del(h->nid, h->sfd);
+	peer_io_end(h->ps, h->start, SD_RES_NETWORK_ERROR);
+	return SD_RES_NETWORK_ERROR;
+}
+
+/*
+ * Read from the first peer, and if it doesn't answer within 'delay' ns, from
+ * the second one too.  The first successful response wins.  A request can't
+ * be cancelled, so the connection of the other one is closed.
+ *
+ * '*nr_tried' is set to the number of peers asked.
+ */
+static int gateway_hedged_read(struct request *req,
+			       const struct sd_node **peers, int *nr_tried,
+			       uint64_t delay)
+{
+	struct hedge_read h[2] = {};
+	struct timespec ts = {
+		.tv_sec = delay / 1000000000,
+		.tv_nsec = delay % 1000000000,
+	};
+	struct pollfd pfds[2];
+	int nr = 0, nr_pending, ret = SD_RES_NETWORK_ERROR, winner = -1,
+	    repeat = MAX_RETRY_COUNT, i, n, pollret;
+	uint32_t len = req->rq.data_length;
+	void *buf;
+
+	*nr_tried = 1;
+	if (hedge_send(req, h, peers[0], req->data) < 0)
+		return SD_RES_NETWORK_ERROR;
+	nr = 1;
+
+	pfds[0].fd = h[0].sfd->fd;
+	pfds[0].events = POLLIN;
+	do {
+		pollret = ppoll(pfds, 1, &ts, NULL);
+	} while (pollret < 0 && errno == EINTR);
+	if (pollret == 0) {
+		/* the first peer is slow, ask the second one too */
+		*nr_tried = 2;
+		buf = alloc_data_buffer(len);
+		if (buf && hedge_send(req, h + 1, peers[1], buf) == 0) {
+			nr = 2;
+			uatomic_inc(&sys->stat.r.gway_hedge_nr);
+		} else
+			free_data_buffer(buf);
+	}
+
+	nr_pending = nr;
+	while (nr_pending > 0 && winner < 0) {
+		for (i = 0, n = 0; i < nr; i++) {
+			if (h[i].done)
+				continue;
+			pfds[n].fd = h[i].sfd->fd;
+			pfds[n].events = POLLIN;
+			n++;
+		}
+		pollret = poll(pfds, n, 1000 * POLL_TIMEOUT);
+		if (pollret < 0) {
+			if (errno == EINTR)
+				continue;
+			panic("%m");
+		} else if (pollret == 0) {
+			if (sheep_need_retry(req->rq.epoch) && repeat--)
+				continue;
+			break;
+		}
+
+		for (i = 0, n = 0; i < nr && winner < 0; i++) {
+			if (h[i].done)
+				continue;
+			if (pfds[n++].revents) {
+				nr_pending--;
+				ret = hedge_recv(req, h + i);
+				if (ret == SD_RES_SUCCESS)
+					winner = i;
 			}
 		}
-		memcpy(req->data, buf + off % SD_EC_DATA_STRIPE_SIZE, len);
-		req->rp.data_length = req->rq.data_length;
-		free(buf);
 	}
-	for (i = 0; i < nr_to_send; i++)
-		free(reqs[i].buf);
-out:
-	free(reqs);
+
+	for (i = 0; i < nr; i++) {
+		if (h[i].done)
+			continue;
+		/* cancel it, the latency is at least what we waited */
+		sockfd_cache_del(h[i].nid, h[i].sfd);
+		peer_io_end(h[i].ps, h[i].start, SD_RES_SUCCESS);
+	}
+
+	if (winner >= 0)
+		memcpy(&req->rp, &h[winner].hdr, sizeof(req->rp));
+	if (winner == 1) {
+		uatomic_inc(&sys->stat.r.gway_hedge_win_nr);
+		/* a local request's buffer belongs to the caller */
+		if (req->local || req->data_length != len)
+			memcpy(req->data, h[1].buf, len);
+		else {
+			buf = req->data;
+			req->data = h[1].buf;
+			h[1].buf = buf;
+		}
+	}
+	if (nr > 1)
+		free_data_buffer(h[1].buf);
+
+	return ret;
 }
 
 /*
@@ -252,12 +477,13 @@ static int gateway_replication_read(struct request *req)
 	struct sd_rsp *rsp = (struct sd_rsp *)&fwd_hdr;
 	const struct sd_vnode *v;
 	const struct sd_vnode *obj_vnodes[SD_MAX_COPIES];
-	uint64_t oid = req->rq.obj.oid;
-	int nr_copies, j;
+	const struct sd_node *peers[SD_MAX_COPIES];
+	uint64_t oid = req->rq.obj.oid, delay, start;
+	int nr_copies, nr_peers = 0;
 
 	nr_copies = get_req_copy_number(req);
 
-	oid_to_vnodes(oid, &req->vinfo->vroot, nr_copies, obj_vnodes);
+	ring_oid_to_vnodes(oid, &req->vinfo->ring, nr_copies, obj_vnodes);
 	for (i = 0; i < nr_copies; i++) {
 		v = obj_vnodes[i];
 		if (!vnode_is_local(v))
@@ -272,26 +498,36 @@ static int gateway_replication_read(struct request *req)
 	}
 
 	/*
-	 * Read random copy from cluster for better load balance, useful for
-	 * reading base VM's COW objects
+	 * Read from the copy expected to be the fastest, the ties are broken
+	 * randomly for better load balance, useful for reading base VM's COW
+	 * objects
 	 */
-	j = random();
-	for (i = 0; i < nr_copies; i++) {
-		int idx = (i + j) % nr_copies;
+	for (i = 0; i < nr_copies; i++)
+		if (!vnode_is_local(obj_vnodes[i]))
+			peers[nr_peers++] = obj_vnodes[i]->node;
+	sort_peers_for_read(peers, nr_peers);
+
+	i = 0;
+	delay = read_hedge_delay();
+	if (nr_peers > 1 && delay) {
+		ret = gateway_hedged_read(req, peers, &i, delay);
+		if (ret == SD_RES_SUCCESS)
+			goto out;
+	}
 
-		v = obj_vnodes[idx];
-		if (vnode_is_local(v))
-			continue;
+	for (; i < nr_peers; i++) {
 		/*
 		 * We need to re-init it because rsp and req share the same
 		 * structure.
 		 */
 		gateway_init_fwd_hdr(&fwd_hdr, &req->rq);
-		ret = sheep_exec_req(&v->node->nid, &fwd_hdr, req->data);
+		start = clock_get_time();
+		ret = sheep_exec_req(&peers[i]->nid, &fwd_hdr, req->data);
 		if (ret != SD_RES_SUCCESS)
 			continue;
 
 		/* Read success */
+		account_read_latency(clock_get_time() - start);
 		memcpy(&req->rp, rsp, sizeof(*rsp));
 		break;
 	}
@@ -299,190 +535,77 @@ out:
 	return ret;
 }
 
-struct forward_info_entry {
-	struct pollfd pfd;
-	const struct node_id *nid;
-	struct sockfd *sfd;
-	void *buf;
-};
-
-struct forward_info {
-	struct forward_info_entry ent[SD_MAX_NODES];
-	int nr_sent;
+struct gateway_forward {
+	struct forward_req fr;
+	struct forward_rpc rpcs[SD_MAX_COPIES];
+	struct request *req;
+	struct req_iter *reqs;
+	int nr_reqs;
+	uint8_t *stage;
+	int nr_refs;
 };
 
-static inline void forward_info_update(struct forward_info *fi, int pos)
+static void gateway_forward_end(struct forward_req *fr)
 {
-	sd_debug("%d, %d", fi->nr_sent, pos);
-	fi->nr_sent--;
-	memmove(fi->ent + pos, fi->ent + pos + 1,
-		sizeof(struct forward_info_entry) * (fi->nr_sent - pos));
-}
+	struct gateway_forward *gf = container_of(fr, struct gateway_forward,
+						  fr);
 
-static inline void finish_one_entry(struct forward_info *fi, int i)
-{
-	sockfd_cache_put(fi->ent[i].nid, fi->ent[i].sfd);
-	forward_info_update(fi, i);
+	finish_requests(gf->req, gf->reqs, gf->nr_reqs, gf->stage);
 }
 
-static inline void finish_one_entry_err(struct forward_info *fi, int i)
+static void gateway_forward_done(struct forward_req *fr)
 {
-	sockfd_cache_del(fi->ent[i].nid, fi->ent[i].sfd);
-	forward_info_update(fi, i);
-}
-
-static inline struct forward_info_entry *
-forward_info_find(struct forward_info *fi, int fd)
-{
-	for (int i = 0; i < fi->nr_sent; i++)
-		if (fi->ent[i].pfd.fd == fd)
-			return &fi->ent[i];
+	struct gateway_forward *gf = container_of(fr, struct gateway_forward,
+						  fr);
 
-	panic("can't find entry for %d", fd);
-	return NULL;
-}
-
-struct pfd_info {
-	struct pollfd pfds[SD_MAX_NODES];
-	int nr;
-};
-
-static inline void pfd_info_init(struct forward_info *fi, struct pfd_info *pi)
-{
-	int i;
-	for (i = 0; i < fi->nr_sent; i++)
-		pi->pfds[i] = fi->ent[i].pfd;
-	pi->nr = fi->nr_sent;
+	gateway_op_done(&gf->req->work);
 }
 
 /*
- * Wait for all forward requests completion.
- *
- * Even if something goes wrong, we have to wait forward requests completion to
- * avoid interleaved requests.
- *
- * Return error code if any one request fails.
+ * Called in the main thread when the work of a forwarded request is done and
+ * when its forwarding is, in any order.  The last one gets true, with the
+ * response of the replicas in the request.
  */
-static int wait_forward_request(struct forward_info *fi, struct request *req)
+bool gateway_forward_finish(struct request *req)
 {
-	int nr_sent, err_ret = SD_RES_SUCCESS, ret, pollret, i,
-	    repeat = MAX_RETRY_COUNT;
-	struct pfd_info pi;
-	struct sd_rsp *rsp = &req->rp;
-again:
-	pfd_info_init(fi, &pi);
-	pollret = poll(pi.pfds, pi.nr, 1000 * POLL_TIMEOUT);
-	if (pollret < 0) {
-		if (errno == EINTR)
-			goto again;
-
-		panic("%m");
-	} else if (pollret == 0) {
-		/*
-		 * If IO NIC is down, epoch isn't incremented, so we can't retry
-		 * for ever.
-		 */
-		if (sheep_need_retry(req->rq.epoch) && repeat) {
-			repeat--;
-			sd_warn("poll timeout %d, disks of some nodes or "
-				"network is busy. Going to poll-wait again",
-				fi->nr_sent);
-			goto again;
-		}
-
-		nr_sent = fi->nr_sent;
-		/* XXX Blinedly close all the connections */
-		for (i = 0; i < nr_sent; i++)
-			sockfd_cache_del(fi->ent[i].nid, fi->ent[i].sfd);
-
-		return SD_RES_NETWORK_ERROR;
-	}
-
-	nr_sent = fi->nr_sent;
-	for (i = 0; i < nr_sent; i++)
-		if (pi.pfds[i].revents & POLLIN)
-			break;
-	if (i < nr_sent) {
-		int re = pi.pfds[i].revents;
-		sd_debug("%d, revents %x", i, re);
-		if (re & (POLLERR | POLLHUP | POLLNVAL)) {
-			err_ret = SD_RES_NETWORK_ERROR;
-			finish_one_entry_err(fi, i);
-			goto out;
-		}
-		if (do_read(pi.pfds[i].fd, rsp, sizeof(*rsp), sheep_need_retry,
-			    req->rq.epoch, MAX_RETRY_COUNT)) {
-			sd_err("remote node might have gone away");
-			err_ret = SD_RES_NETWORK_ERROR;
-			finish_one_entry_err(fi, i);
-			goto out;
-		}
-
-		if (rsp->data_length) {
-			struct forward_info_entry *ent;
-
-			ent = forward_info_find(fi, pi.pfds[i].fd);
-			if (do_read(pi.pfds[i].fd, ent->buf, rsp->data_length,
-				    sheep_need_retry, req->rq.epoch,
-				    MAX_RETRY_COUNT)) {
-				sd_err("remote node might have gone away");
-				err_ret = SD_RES_NETWORK_ERROR;
-				finish_one_entry_err(fi, i);
-				goto out;
-			}
-		}
-		ret = rsp->result;
-		if (ret != SD_RES_SUCCESS) {
-			sd_err("fail %"PRIx64", %s", req->rq.obj.oid,
-			       sd_strerror(ret));
-			err_ret = ret;
-		}
-		finish_one_entry(fi, i);
-	}
-out:
-	if (fi->nr_sent > 0)
-		goto again;
+	struct gateway_forward *gf = req->forward;
 
-	return err_ret;
-}
+	if (--gf->nr_refs > 0)
+		return false;
 
-static inline void forward_info_init(struct forward_info *fi, size_t nr_to_send)
-{
-	int i;
-	for (i = 0; i < nr_to_send; i++)
-		fi->ent[i].pfd.fd = -1;
-	fi->nr_sent = 0;
-}
+	if (gf->fr.nr_replies > 0)
+		memcpy(&req->rp, &gf->fr.rsp, sizeof(req->rp));
+	req->rp.result = gf->fr.result;
+	if (req->rq.opcode == SD_OP_READ_OBJ && is_erasure_oid(req->rq.obj.oid))
+		req->rp.data_length = req->rq.data_length;
 
-static inline void
-forward_info_advance(struct forward_info *fi, const struct node_id *nid,
-		     struct sockfd *sfd, void *buf)
-{
-	fi->ent[fi->nr_sent].nid = nid;
-	fi->ent[fi->nr_sent].pfd.fd = sfd->fd;
-	fi->ent[fi->nr_sent].pfd.events = POLLIN;
-	fi->ent[fi->nr_sent].sfd = sfd;
-	fi->ent[fi->nr_sent].buf = buf;
-	fi->nr_sent++;
+	req->forward = NULL;
+	free(gf);
+	return true;
 }
 
+/*
+ * Send the request to the replicas and let the forwarder complete it
+ *
+ * The request is finished by gateway_op_done() when both the work and the
+ * forwarding are done.  Errors before anything is sent are returned as usual.
+ */
 static int gateway_forward_request(struct request *req)
 {
-	int i, err_ret = SD_RES_SUCCESS, ret;
-	unsigned wlen;
+	int i, err_ret = SD_RES_SUCCESS;
 	uint64_t oid = req->rq.obj.oid;
-	struct forward_info fi;
+	struct gateway_forward *gf;
 	struct sd_req hdr;
 	const struct sd_node *target_nodes[SD_MAX_NODES];
 	int nr_copies = get_req_copy_number(req), nr_reqs, nr_to_send = 0;
 	struct req_iter *reqs = NULL;
+	uint8_t *stage;
 
 	sd_debug("%"PRIx64, oid);
 
 	gateway_init_fwd_hdr(&hdr, &req->rq);
-	oid_to_nodes(oid, &req->vinfo->vroot, nr_copies, target_nodes);
-	forward_info_init(&fi, nr_copies);
-	reqs = prepare_requests(req, &nr_to_send);
+	ring_oid_to_nodes(oid, &req->vinfo->ring, nr_copies, target_nodes);
+	reqs = prepare_requests(req, &nr_to_send, &stage);
 	if (!reqs)
 		return SD_RES_NETWORK_ERROR;
 
@@ -502,49 +625,57 @@ static int gateway_forward_request(struct request *req)
 		if (nr_copies < ds) {
 			sd_err("There isn't enough copies(%d) to send out (%d)",
 			       nr_copies, nr_to_send);
-			err_ret = SD_RES_SYSTEM_ERROR;
-			goto out;
+			finish_requests(req, reqs, nr_reqs, stage);
+			return SD_RES_SYSTEM_ERROR;
 		}
 		nr_to_send = ds;
 	}
 
+	gf = xzalloc(sizeof(*gf));
 	for (i = 0; i < nr_to_send; i++) {
-		struct sockfd *sfd;
-		const struct node_id *nid;
-
-		nid = &target_nodes[i]->nid;
-		sfd = sockfd_cache_get(nid);
-		if (!sfd) {
-			err_ret = SD_RES_NETWORK_ERROR;
-			break;
-		}
+		struct forward_rpc *rpc = gf->rpcs + i;
+		const struct node_id *nid = &target_nodes[i]->nid;
 
-		hdr.data_length = reqs[i].dlen;
-		wlen = reqs[i].wlen;
-		hdr.obj.offset = reqs[i].off;
-		hdr.obj.ec_index = i;
-		hdr.obj.copy_policy = req->rq.obj.copy_policy;
-		ret = send_req(sfd->fd, &hdr, reqs[i].buf, wlen,
-			       sheep_need_retry, req->rq.epoch,
-			       MAX_RETRY_COUNT);
-		if (ret) {
-			sockfd_cache_del_node(nid);
-			err_ret = SD_RES_NETWORK_ERROR;
-			sd_debug("fail %d", ret);
-			break;
+		if (!forward_multiplexed(nid)) {
+			rpc->sfd = sockfd_cache_get(nid);
+			if (!rpc->sfd) {
+				err_ret = SD_RES_NETWORK_ERROR;
+				break;
+			}
 		}
-		forward_info_advance(&fi, nid, sfd, reqs[i].buf);
+		rpc->nid = nid;
+		rpc->hdr = hdr;
+		rpc->hdr.data_length = reqs[i].dlen;
+		rpc->hdr.obj.offset = reqs[i].off;
+		rpc->hdr.obj.ec_index = i;
+		rpc->hdr.obj.copy_policy = req->rq.obj.copy_policy;
+		rpc->iov = reqs[i].iov;
+		rpc->iovcnt = reqs[i].iovcnt;
+		rpc->wlen = reqs[i].wlen;
 	}
 
-	sd_debug("nr_sent %d, err %x", fi.nr_sent, err_ret);
-	if (fi.nr_sent > 0) {
-		ret = wait_forward_request(&fi, req);
-		if (ret != SD_RES_SUCCESS)
-			err_ret = ret;
+	sd_debug("nr_sent %d, err %x", i, err_ret);
+	if (i == 0) {
+		free(gf);
+		finish_requests(req, reqs, nr_reqs, stage);
+		return err_ret;
 	}
-out:
-	finish_requests(req, reqs, nr_reqs);
-	return err_ret;
+
+	gf->fr.rpcs = gf->rpcs;
+	gf->fr.nr_rpcs = i;
+	gf->fr.epoch = req->rq.epoch;
+	gf->fr.result = err_ret;
+	gf->fr.end = gateway_forward_end;
+	gf->fr.done = gateway_forward_done;
+	gf->req = req;
+	gf->reqs = reqs;
+	gf->nr_reqs = nr_reqs;
+	gf->stage = stage;
+	gf->nr_refs = 2;
+	req->forward = gf;
+	forward_submit(&gf->fr);
+
+	return SD_RES_SUCCESS;
 }
 
 int gateway_read_obj(struct request *req)
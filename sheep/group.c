@@ -21,6 +21,8 @@ struct get_vdis_work {
 	DECLARE_BITMAP(vdi_inuse, SD_NR_VDIS);
 	struct sd_node joined;
 	struct rb_root nroot;
+	bool got_throttle;
+	struct recovery_throttle throttle;
 };
 
 static struct sd_mutex wait_vdis_lock = SD_MUTEX_INITIALIZER;
@@ -93,6 +95,7 @@ void put_vnode_info(struct vnode_info *vnode_info)
 {
 	if (vnode_info) {
 		if (refcount_dec(&vnode_info->refcnt) == 0) {
+			free_vnode_ring(&vnode_info->ring);
 			rb_destroy(&vnode_info->vroot, struct sd_vnode, rb);
 			rb_destroy(&vnode_info->nroot, struct sd_node, rb);
 			free(vnode_info);
@@ -147,6 +150,7 @@ struct vnode_info *alloc_vnode_info(const struct rb_root *nroot)
 	recalculate_vnodes(&vnode_info->nroot);
 
 	nodes_to_vnodes(&vnode_info->nroot, &vnode_info->vroot);
+	vnodes_to_ring(&vnode_info->vroot, &vnode_info->ring);
 	vnode_info->nr_zones = get_zones_nr_from(&vnode_info->nroot);
 	refcount_set(&vnode_info->refcnt, 1);
 	return vnode_info;
@@ -483,6 +487,23 @@ out:
 	return ret;
 }
 
+/*
+ * The recovery throttle isn't in cluster_info, so a joining node asks the
+ * others for it.  The nodes older than SD_PEER_VER_THROTTLE don't know it.
+ */
+static bool get_recovery_throttle_from(const struct sd_node *node,
+				       struct recovery_throttle *throttle)
+{
+	struct sd_req hdr;
+
+	if (node->nid.peer_ver < SD_PEER_VER_THROTTLE)
+		return false;
+
+	sd_init_req(&hdr, SD_OP_GET_RECOVERY_THROTTLE);
+	hdr.data_length = sizeof(*throttle);
+	return sheep_exec_req(&node->nid, &hdr, throttle) == SD_RES_SUCCESS;
+}
+
 static void do_get_vdis(struct work *work)
 {
 	struct get_vdis_work *w =
@@ -514,6 +535,10 @@ static void do_get_vdis(struct work *work)
 			continue;
 		}
 
+		if (!w->got_throttle)
+			w->got_throttle = get_recovery_throttle_from(n,
+								&w->throttle);
+
 		/*
 		 * TODO: If the target node has a valid vdi bitmap (the node has
 		 * already called do_get_vdis against all the nodes), we can
@@ -532,6 +557,11 @@ static void get_vdis_done(struct work *work)
 	sd_cond_broadcast(&wait_vdis_cond);
 	sd_mutex_unlock(&wait_vdis_lock);
 
+	if (w->got_throttle) {
+		set_recovery_throttle(&w->throttle);
+		set_recovery_throttle_config(&w->throttle);
+	}
+
 	rb_destroy(&w->nroot, struct sd_node, rb);
 	free(w);
 }
@@ -615,6 +645,7 @@ static void get_vdis(const struct rb_root *nroot, const struct sd_node *joined)
 
 	w = xmalloc(sizeof(*w));
 	w->joined = *joined;
+	w->got_throttle = false;
 	INIT_RB_ROOT(&w->nroot);
 	rb_copy(nroot, struct sd_node, rb, &w->nroot, node_cmp);
 	refcount_inc(&nr_get_vdis_works);
@@ -1015,6 +1046,7 @@ int create_cluster(int port, int64_t zone, int nr_vnodes,
 	}
 
 	sys->this_node.nid.port = port;
+	sys->this_node.nid.peer_ver = SD_PEER_VER;
 	sys->this_node.nr_vnodes = nr_vnodes;
 	if (zone == -1) {
 		/* use last 4 bytes as zone id */
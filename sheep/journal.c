@@ -11,6 +11,8 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <sys/uio.h>
+
 #include "sheep_priv.h"
 
 struct journal_file {
@@ -54,10 +56,33 @@ static int jfile_fds[2];
 static size_t jfile_size;
 
 static struct journal_file jfile;
-static struct sd_mutex jfile_lock = SD_MUTEX_INITIALIZER;
 
 static struct work_queue *commit_wq;
 
+/*
+ * Group commit
+ *
+ * Writers don't write the journal file by themselves.  They queue their
+ * entries and sleep, and the flusher thread writes everything queued so far
+ * with a single pwritev() at contiguous offsets.  The journal files are opened
+ * with O_DSYNC, so a batch is stable as soon as pwritev() returns, which costs
+ * one device flush for the whole batch instead of one per write.
+ *
+ * Only the flusher touches jfile, so it needs no lock.
+ */
+struct journal_entry {
+	struct list_node list;
+	void *buf;
+	size_t size;
+	int ret;
+	bool done;
+};
+
+static LIST_HEAD(jqueue);
+static struct sd_mutex jqueue_lock = SD_MUTEX_INITIALIZER;
+static struct sd_cond jqueue_cond = SD_COND_INITIALIZER;
+static struct sd_cond jdone_cond = SD_COND_INITIALIZER;
+
 static int create_journal_file(const char *root, const char *name)
 {
 	int fd, flags = O_DSYNC | O_RDWR | O_TRUNC | O_CREAT | O_DIRECT;
@@ -234,8 +259,9 @@ skip:
 		p += JOURNAL_META_SIZE + round_up(jd->size, SECTOR_SIZE);
 	}
 	munmap(map, st.st_size);
-	/* Do a final sync() to assure data is reached to the disk */
-	sync();
+	/* Do a final sync to assure data is reached to the disk */
+	if (md_sync_disks() != SD_RES_SUCCESS)
+		return -1;
 	return 0;
 }
 
@@ -262,9 +288,12 @@ static void check_recover_journal_file(const char *p)
 		panic("recoverying from journal file (new) failed");
 }
 
+static void *journal_flusher(void *arg);
+
 int journal_file_init(const char *path, size_t size, bool skip)
 {
-	int fd;
+	int fd, ret;
+	pthread_t flusher;
 
 	if (!skip)
 		check_recover_journal_file(path);
@@ -285,6 +314,13 @@ int journal_file_init(const char *path, size_t size, bool skip)
 		return -1;
 	}
 
+	ret = pthread_create(&flusher, NULL, journal_flusher, NULL);
+	if (ret) {
+		sd_err("failed to create the journal flusher, %s",
+		       strerror(ret));
+		return -1;
+	}
+
 	return 0;
 }
 
@@ -293,7 +329,8 @@ void clean_journal_file(const char *p)
 	int ret;
 	char path[PATH_MAX];
 
-	sync();
+	if (md_sync_disks() != SD_RES_SUCCESS)
+		sync();
 
 	snprintf(path, sizeof(path), "%s/%s", p, jfile_name[0]);
 	ret = unlink(path);
@@ -316,12 +353,30 @@ static struct sd_mutex journal_commit_mutex = SD_MUTEX_INITIALIZER;
 /*
  * We rely on the kernel's page cache to cache data objects to 1) boost read
  * perfmance 2) simplify read path so that data commiting is simply a
- * sync() operation and We do it in a dedicated thread to avoid blocking
+ * sync operation and We do it in a dedicated thread to avoid blocking
  * the writer by switch back and forth between two journal files.
+ *
+ * The objects only live on the md disks, so only their file systems are
+ * flushed instead of calling sync(), which writes back every file system
+ * of the host.
  */
+static void commit_data(void)
+{
+	uint64_t start = clock_get_time();
+
+	if (md_sync_disks() != SD_RES_SUCCESS) {
+		sd_err("failed to sync the md disks, falling back to sync()");
+		sync();
+	}
+
+	uatomic_inc(&sys->stat.s.journal_commit_nr);
+	uatomic_add(&sys->stat.s.journal_commit_time,
+		    clock_get_time() - start);
+}
+
 static void journal_commit_data_work(struct work *work)
 {
-	sync();
+	commit_data();
 
 	if (unlikely(xftruncate(jfile.commit_fd, 0) < 0))
 		panic("truncate %m");
@@ -342,9 +397,14 @@ static void switch_journal_file(void)
 	struct work *w;
 
 	if (sd_mutex_trylock(&journal_commit_mutex) == EBUSY) {
+		uint64_t start = clock_get_time();
+
 		sd_err("journal file in commiting, you might need"
 		       " enlarge jfile size");
 		sd_mutex_lock(&journal_commit_mutex);
+		uatomic_inc(&sys->stat.s.journal_stall_nr);
+		uatomic_add(&sys->stat.s.journal_stall_time,
+			    clock_get_time() - start);
 	}
 
 	if (old == jfile_fds[0])
@@ -360,23 +420,91 @@ static void switch_journal_file(void)
 	queue_work(commit_wq, w);
 }
 
+/*
+ * Write as many entries from the head of 'batch' as one pwritev() can take.
+ * The number of the written entries is returned in 'nr'.
+ */
+static int journal_write_batch(struct list_head *batch, int *nr)
+{
+	struct iovec iov[IOV_MAX];
+	struct journal_entry *e;
+	size_t len = 0;
+	ssize_t written;
+	off_t woff;
+	int n = 0, ret = SD_RES_SUCCESS;
+
+	list_for_each_entry(e, batch, list) {
+		if (n == ARRAY_SIZE(iov))
+			break;
+		if (!jfile_enough_space(len + e->size)) {
+			if (n)
+				break;
+			switch_journal_file();
+		}
+		iov[n].iov_base = e->buf;
+		iov[n++].iov_len = e->size;
+		len += e->size;
+	}
+	woff = jfile.pos;
+	jfile.pos += len;
+
+	do {
+		written = pwritev(jfile.fd, iov, n, woff);
+	} while (unlikely(written < 0 && errno == EINTR));
+	if (unlikely(written != len)) {
+		sd_err("failed, written %zd, len %zu, %m", written, len);
+		/* FIXME: teach journal file handle EIO gracefully */
+		ret = SD_RES_EIO;
+	}
+
+	*nr = n;
+	return ret;
+}
+
+static void *journal_flusher(void *arg)
+{
+	LIST_HEAD(batch);
+	struct journal_entry *e;
+	int nr, ret;
+
+	set_thread_name("journal flush", false);
+
+	for (;;) {
+		sd_mutex_lock(&jqueue_lock);
+		while (list_empty(&jqueue))
+			sd_cond_wait(&jqueue_cond, &jqueue_lock);
+		list_splice_tail_init(&jqueue, &batch);
+		sd_mutex_unlock(&jqueue_lock);
+
+		while (!list_empty(&batch)) {
+			ret = journal_write_batch(&batch, &nr);
+			sd_debug("%d entries, %s", nr, sd_strerror(ret));
+
+			sd_mutex_lock(&jqueue_lock);
+			list_for_each_entry(e, &batch, list) {
+				if (nr-- == 0)
+					break;
+				list_del(&e->list);
+				e->ret = ret;
+				e->done = true;
+			}
+			sd_cond_broadcast(&jdone_cond);
+			sd_mutex_unlock(&jqueue_lock);
+		}
+	}
+
+	return NULL;
+}
+
 static int journal_file_write(struct journal_descriptor *jd, const char *buf)
 {
 	uint32_t marker = JOURNAL_END_MARKER;
-	int ret = SD_RES_SUCCESS;
 	uint64_t size = jd->size;
-	ssize_t written, rusize = round_up(size, SECTOR_SIZE),
+	size_t rusize = round_up(size, SECTOR_SIZE),
 		wsize = JOURNAL_META_SIZE + rusize;
-	off_t woff;
+	struct journal_entry e = {};
 	char *wbuffer, *p;
 
-	sd_mutex_lock(&jfile_lock);
-	if (!jfile_enough_space(wsize))
-		switch_journal_file();
-	woff = jfile.pos;
-	jfile.pos += wsize;
-	sd_mutex_unlock(&jfile_lock);
-
 	p = wbuffer = xvalloc(wsize);
 	memcpy(p, jd, JOURNAL_DESC_SIZE);
 	p += JOURNAL_DESC_SIZE;
@@ -387,23 +515,19 @@ static int journal_file_write(struct journal_descriptor *jd, const char *buf)
 		p += rusize - size;
 	}
 	memcpy(p, &marker, JOURNAL_MARKER_SIZE);
-	/*
-	 * Concurrent writes with the same FD is okay because we don't have any
-	 * critical sections that need lock inside kernel write path, since we
-	 * a) bypass page cache, b) don't modify i_size of this inode.
-	 *
-	 * Feel free to correct me If I am wrong.
-	 */
-	written = xpwrite(jfile.fd, wbuffer, wsize, woff);
-	if (unlikely(written != wsize)) {
-		sd_err("failed, written %zd, len %zd", written, wsize);
-		/* FIXME: teach journal file handle EIO gracefully */
-		ret = SD_RES_EIO;
-		goto out;
-	}
-out:
+
+	e.buf = wbuffer;
+	e.size = wsize;
+
+	sd_mutex_lock(&jqueue_lock);
+	list_add_tail(&e.list, &jqueue);
+	sd_cond_signal(&jqueue_cond);
+	while (!e.done)
+		sd_cond_wait(&jdone_cond, &jqueue_lock);
+	sd_mutex_unlock(&jqueue_lock);
+
 	free(wbuffer);
-	return ret;
+	return e.ret;
 }
 
 int journal_write_store(uint64_t oid, const char *buf, size_t size,
@@ -488,6 +488,30 @@ int for_each_obj_path(int (*func)(const char *path))
 	return ret;
 }
 
+static int sync_obj_path(const char *path)
+{
+	int fd, ret = SD_RES_SUCCESS;
+
+	fd = open(path, O_RDONLY | O_DIRECTORY);
+	if (fd < 0) {
+		sd_err("failed to open %s, %m", path);
+		return SD_RES_EIO;
+	}
+	if (syncfs(fd) < 0) {
+		sd_err("failed to sync %s, %m", path);
+		ret = SD_RES_EIO;
+	}
+	close(fd);
+
+	return ret;
+}
+
+/* Flush the file systems which hold the md disks instead of all of them */
+int md_sync_disks(void)
+{
+	return for_each_obj_path(sync_obj_path);
+}
+
 struct md_work {
 	struct work work;
 	char path[PATH_MAX];
@@ -506,6 +530,7 @@ static void md_do_recover(struct work *work)
 	struct md_work *mw = container_of(work, struct md_work, work);
 	struct disk *disk;
 	int nr = 0;
+	bool removed = false;
 
 	sd_write_lock(&md.lock);
 	disk = path_to_disk(mw->path);
@@ -513,10 +538,15 @@ static void md_do_recover(struct work *work)
 		/* Just ignore the duplicate EIO of the same path */
 		goto out;
 	md_remove_disk(disk);
+	removed = true;
 	nr = md.nr_disks;
 out:
 	sd_rw_unlock(&md.lock);
 
+	/* Objects are going to be remapped to the other disks */
+	if (removed)
+		fd_cache_purge();
+
 	if (nr > 0)
 		kick_recover();
 
@@ -643,6 +673,7 @@ static int md_check_and_move(uint64_t oid, uint32_t epoch, uint8_t ec_index,
 		sd_err("move old %s to new %s failed", old, new);
 		return SD_RES_EIO;
 	}
+	fd_cache_del(oid, ec_index);
 
 	sd_debug("from %s to %s", old, new);
 	return SD_RES_SUCCESS;
@@ -763,8 +794,10 @@ static int do_plug_unplug(char *disks, bool plug)
 out:
 	sd_rw_unlock(&md.lock);
 
-	if (ret == SD_RES_SUCCESS)
+	if (ret == SD_RES_SUCCESS) {
+		fd_cache_purge();
 		kick_recover();
+	}
 
 	return ret;
 }
@@ -12,6 +12,7 @@
  */
 
 #include "sheep_priv.h"
+#include "car.h"
 
 /*
  * Object Cache ID
@@ -23,30 +24,79 @@
  */
 #define CACHE_VDI_SHIFT       63 /* if the entry is identified as VDI object */
 #define CACHE_CREATE_SHIFT    59 /* If the entry should be created at backend */
+#define CACHE_REMOVED_SHIFT   58 /* If the object is removed, only in metadata */
+#define CACHE_HOT_SHIFT       57 /* If the object is in T2, only in metadata */
 
 #define CACHE_VDI_BIT         (UINT64_C(1) << CACHE_VDI_SHIFT)
 #define CACHE_CREATE_BIT      (UINT64_C(1) << CACHE_CREATE_SHIFT)
+#define CACHE_REMOVED_BIT     (UINT64_C(1) << CACHE_REMOVED_SHIFT)
+#define CACHE_HOT_BIT         (UINT64_C(1) << CACHE_HOT_SHIFT)
 
-#define CACHE_INDEX_MASK      (CACHE_CREATE_BIT)
+#define CACHE_INDEX_MASK      (CACHE_CREATE_BIT | CACHE_REMOVED_BIT | \
+			       CACHE_HOT_BIT)
 
 #define CACHE_OBJECT_SIZE (SD_DATA_OBJ_SIZE / 1024 / 1024) /* M */
 
 /* Kick background pusher if dirty_count greater than it */
 #define MAX_DIRTY_OBJECT_COUNT	10 /* Just a random number, no rationale */
 
+/* The max nr of the adjacent dirty objects a push worker writes back at once */
+#define CACHE_PUSH_BATCH	8
+
+/* How far a read may start from where the last one ended to be sequential */
+#define CACHE_READAHEAD_SLACK	(SD_DATA_OBJ_SIZE / 4)
+
+/* The xattr of a partially cached object which records its valid blocks */
+#define VALID_XATTR "user.cache.valid"
+
+/*
+ * Each VDI directory has a metadata file of its cached objects, so that we
+ * don't have to mark all of them dirty after restart.  It is rewritten every
+ * CACHE_META_INTERVAL ms if anything changed, and a record is appended in
+ * between whenever an object is added or removed, or gets new dirty or valid
+ * blocks.  Thus the last record of an object never has fewer
+ * dirty blocks than the object, even after a crash.
+ */
+#define CACHE_META_FILE ".meta"
+#define CACHE_META_INTERVAL 10000 /* ms */
+
+struct cache_meta {
+	uint64_t idx; /* Index with the flags of CACHE_INDEX_MASK */
+	uint64_t bmap; /* Dirty blocks */
+	uint64_t valid; /* Valid blocks */
+	uint64_t checksum; /* Hash of the above to detect a torn record */
+};
+
+/*
+ * The references to an object within a second after it is cached are taken
+ * as one, so that a scan doesn't look like a hot working set
+ */
+#define CACHE_REF_PERIOD (1000000000ULL) /* ns */
+
 struct global_cache {
 	uint32_t capacity; /* The real capacity of object cache of this node */
 	uatomic_bool in_reclaim; /* If the relcaimer is working */
+	struct car car; /* Replacement policy across all the VDIs */
+	struct sd_mutex car_lock; /* Serialize the policy but car_hit() */
+	uint64_t hit_bytes; /* Bytes read from the cached blocks */
+	uint64_t partial_bytes; /* Bytes read with some blocks to fetch */
+	uint64_t miss_bytes; /* Bytes read with all the blocks to fetch */
+	uint64_t dirty_bytes; /* Bytes written to the cache in writeback mode */
+	uint64_t push_bytes; /* Bytes pushed back to the cluster */
 };
 
 struct object_cache_entry {
 	uint64_t idx; /* Index of this entry */
 	refcnt_t refcnt; /* Reference count of this entry */
 	uint64_t bmap; /* Each bit represents one dirty block in object */
+	uint64_t valid; /* Each bit represents one block held in the cache */
+	uatomic_bool in_fill; /* If the background filler is queued */
+	uint32_t prefetched; /* If it was read ahead and isn't read yet */
 	struct object_cache *oc; /* Object cache this entry belongs to */
-	struct rb_node node; /* For lru tree of object cache */
+	struct hlist_node hash; /* For the entry hash table */
 	struct list_node dirty_list; /* For dirty list of object cache */
-	struct list_node lru_list; /* For lru list of object cache */
+	struct list_node object_list; /* For object list of object cache */
+	struct car_node car; /* For the replacement policy */
 
 	struct sd_rw_lock lock; /* Entry lock */
 };
@@ -57,24 +107,49 @@ struct object_cache {
 	uint32_t dirty_count; /* How many dirty object in this cache */
 	uint32_t total_count; /* Count of objects include dirty and clean */
 	struct hlist_node hash; /* VDI is linked to the global hash lists */
-	struct rb_root lru_tree; /* For faster object search */
-	struct list_head lru_head; /* Per VDI LRU list for reclaimer */
+	struct list_head object_head; /* All the objects cached for this VDI */
 	struct list_head dirty_head; /* Dirty objects linked to this list */
 	int push_efd; /* Used to synchronize between pusher and push threads */
 	struct sd_mutex push_mutex; /* mutex for pushing cache */
+	int meta_fd; /* Metadata file to append the records */
+	struct sd_mutex meta_lock; /* Serialize the appends and the rewrite */
+	uatomic_bool meta_stale; /* If the metadata file should be rewritten */
+	bool deleted; /* Unhashed by object_cache_delete(), under meta_lock */
+	struct sd_mutex ra_lock; /* Serialize the read-ahead state */
+	uint64_t ra_next; /* Where the next sequential read would start */
+	uint64_t ra_idx; /* The object the sequential reader is in */
+	uint64_t ra_end; /* The objects before it are read ahead already */
+	uint32_t ra_depth; /* How many objects to read ahead of the reader */
+	uint32_t prefetch_count; /* Objects read ahead into this cache */
+	uint32_t prefetch_hits; /* Objects read ahead and then read */
+	refcnt_t refcnt; /* The hash table and the background workers */
 
 	struct sd_rw_lock lock; /* Cache lock */
 };
 
 struct push_work {
 	struct work work;
-	struct object_cache_entry *entry;
+	struct object_cache_entry *entries[CACHE_PUSH_BATCH];
+	int nr_entries;
 	struct object_cache *oc;
 };
 
+/* The writes of the dirty extents which a push worker has in flight */
+struct push_batch {
+	struct request_iocb *iocb;
+	void **bufs;
+	int nr_bufs;
+};
+
 static struct global_cache gcache;
 static char object_cache_dir[PATH_MAX];
 static int def_open_flags = O_RDWR;
+/*
+ * A missed object is cached as a sparse file, filled block by block as it is
+ * accessed, unless the cache directory doesn't support the xattr to record
+ * which blocks are valid
+ */
+static bool partial_fill;
 
 #define HASH_BITS	5
 #define HASH_SIZE	(1 << HASH_BITS)
@@ -85,7 +160,23 @@ static struct sd_rw_lock hashtable_lock[HASH_SIZE] = {
 
 static struct hlist_head cache_hashtable[HASH_SIZE];
 
+/*
+ * The cached objects of all the VDIs are found by a hash table, whose buckets
+ * are split into ENTRY_NR_SHARDS shards with their own locks
+ */
+#define ENTRY_HASH_BITS		16
+#define ENTRY_HASH_SIZE		(1 << ENTRY_HASH_BITS)
+#define ENTRY_NR_SHARDS		64
+
+static struct sd_rw_lock entry_shard_lock[ENTRY_NR_SHARDS] = {
+	[0 ... ENTRY_NR_SHARDS - 1] = SD_RW_LOCK_INITIALIZER
+};
+
+static struct hlist_head entry_hashtable[ENTRY_HASH_SIZE];
+
 static int object_cache_push(struct object_cache *oc);
+static struct object_cache_entry *
+get_cache_entry_from(struct object_cache *cache, uint64_t idx);
 
 static inline bool entry_is_dirty(const struct object_cache_entry *entry)
 {
@@ -103,12 +194,6 @@ static inline uint64_t entry_idx(const struct object_cache_entry *entry)
 	return entry->idx & ~CACHE_INDEX_MASK;
 }
 
-static int object_cache_cmp(const struct object_cache_entry *a,
-			    const struct object_cache_entry *b)
-{
-	return intcmp(entry_idx(a), entry_idx(b));
-}
-
 static inline uint64_t object_cache_oid_to_idx(uint64_t oid)
 {
 	uint64_t idx = data_oid_to_idx(oid);
@@ -148,6 +233,48 @@ static uint64_t calc_object_bmap(uint64_t oid, size_t len, off_t offset)
 	return bmap;
 }
 
+/* The bmap of the first and last blocks if the range covers them partially */
+static uint64_t calc_edge_bmap(uint64_t oid, size_t len, off_t offset)
+{
+	size_t bsize = get_cache_block_size(oid);
+	uint64_t bmap = 0;
+
+	if (!len)
+		return 0;
+	if (offset % bsize)
+		set_bit_64(offset / bsize, &bmap);
+	if ((offset + len) % bsize && offset + len < get_objsize(oid))
+		set_bit_64((offset + len - 1) / bsize, &bmap);
+
+	return bmap;
+}
+
+/* The bmap of all the blocks of the object */
+static uint64_t calc_full_bmap(uint64_t oid)
+{
+	int nr = DIV_ROUND_UP(get_objsize(oid), get_cache_block_size(oid));
+
+	return nr == 64 ? UINT64_MAX : (UINT64_C(1) << nr) - 1;
+}
+
+/*
+ * Find the first run of set bits in 'bmap' from bit 'start', return its first
+ * bit and set '*end' past its last one, or return -1 if there is none
+ */
+static int find_next_run(uint64_t bmap, int start, int *end)
+{
+	int i;
+
+	bmap &= start < 64 ? UINT64_MAX << start : 0;
+	if (!bmap)
+		return -1;
+
+	i = ffsll(bmap) - 1;
+	for (*end = i; *end < 64 && bmap & (UINT64_C(1) << *end); (*end)++)
+		;
+	return i;
+}
+
 static inline void get_cache_entry(struct object_cache_entry *entry)
 {
 	refcount_inc(&entry->refcnt);
@@ -205,18 +332,175 @@ static inline void unlock_entry(struct object_cache_entry *entry)
 	sd_rw_unlock(&entry->lock);
 }
 
+static uint64_t idx_to_oid(uint32_t vid, uint64_t idx)
+{
+	if (idx_has_vdi_bit(idx))
+		return vid_to_vdi_oid(vid);
+	else
+		return vid_to_data_oid(vid, idx);
+}
+
+static inline int entry_hash(uint32_t vid, uint64_t idx)
+{
+	return hash_64(idx_to_oid(vid, idx), ENTRY_HASH_BITS);
+}
+
+static inline struct sd_rw_lock *entry_shard(int h)
+{
+	return entry_shard_lock + h % ENTRY_NR_SHARDS;
+}
+
+/* Must be called with the shard of 'h' locked */
 static struct object_cache_entry *
-lru_tree_insert(struct rb_root *root, struct object_cache_entry *new)
+entry_hash_search(int h, struct object_cache *oc, uint64_t idx)
 {
-	return rb_insert(root, new, node, object_cache_cmp);
+	struct object_cache_entry *entry;
+	struct hlist_node *node;
+
+	hlist_for_each_entry(entry, node, entry_hashtable + h, hash) {
+		if (entry->oc == oc && entry_idx(entry) == idx)
+			return entry;
+	}
+	return NULL;
+}
+
+static void entry_hash_insert(struct object_cache_entry *entry)
+{
+	struct object_cache *oc = entry->oc;
+	int h = entry_hash(oc->vid, entry_idx(entry));
+
+	sd_write_lock(entry_shard(h));
+	if (unlikely(entry_hash_search(h, oc, entry_idx(entry))))
+		panic("the object already exist");
+	hlist_add_head(&entry->hash, entry_hashtable + h);
+	sd_rw_unlock(entry_shard(h));
 }
 
-static struct object_cache_entry *lru_tree_search(struct rb_root *root,
-						  uint64_t idx)
+static void entry_hash_del(struct object_cache_entry *entry)
 {
-	struct object_cache_entry key = { .idx = idx };
+	int h = entry_hash(entry->oc->vid, entry_idx(entry));
 
-	return rb_search(root, &key, node, object_cache_cmp);
+	sd_write_lock(entry_shard(h));
+	hlist_del(&entry->hash);
+	sd_rw_unlock(entry_shard(h));
+}
+
+/* Take the entry out of the replacement policy, if it is still there */
+static void entry_car_del(struct object_cache_entry *entry)
+{
+	sd_mutex_lock(&gcache.car_lock);
+	if (list_linked(&entry->car.list))
+		car_remove(&gcache.car, &entry->car);
+	sd_mutex_unlock(&gcache.car_lock);
+}
+
+static void cache_meta_path(char *p, size_t size, uint32_t vid)
+{
+	if (snprintf(p, size, "%s/%06"PRIx32"/"CACHE_META_FILE,
+		     object_cache_dir, vid) >= size)
+		sd_err("too long path %s", object_cache_dir);
+}
+
+static inline uint64_t cache_meta_checksum(const struct cache_meta *meta)
+{
+	return sd_hash(meta, offsetof(struct cache_meta, checksum));
+}
+
+/*
+ * Append a record to the metadata file.  If it fails, remove the file so that
+ * a restart doesn't trust it, until it is rewritten.
+ *
+ * A record with new dirty blocks is synced, since an older clean record of
+ * the object would make a restart drop them.  Without any record, the object
+ * is loaded as dirty.
+ */
+static void append_cache_meta(struct object_cache *oc, uint64_t idx,
+			      uint64_t bmap, uint64_t valid, bool sync)
+{
+	struct cache_meta meta = {
+		.idx = idx,
+		.bmap = bmap,
+		.valid = valid,
+	};
+	char p[PATH_MAX];
+
+	meta.checksum = cache_meta_checksum(&meta);
+
+	sd_mutex_lock(&oc->meta_lock);
+	uatomic_set_true(&oc->meta_stale);
+	if (oc->meta_fd < 0)
+		goto out;
+	if (unlikely(xwrite(oc->meta_fd, &meta, sizeof(meta)) != sizeof(meta) ||
+		     (sync && fdatasync(oc->meta_fd) < 0))) {
+		cache_meta_path(p, sizeof(p), oc->vid);
+		sd_err("failed to append to %s, %m", p);
+		unlink(p);
+		close(oc->meta_fd);
+		oc->meta_fd = -1;
+	}
+out:
+	sd_mutex_unlock(&oc->meta_lock);
+}
+
+static inline void update_cache_meta(struct object_cache_entry *entry,
+				     bool sync)
+{
+	append_cache_meta(entry->oc, entry->idx, entry->bmap,
+			  uatomic_read(&entry->valid), sync);
+}
+
+/*
+ * Rewrite the metadata file with the records of all the cached objects, and
+ * reopen it for the subsequent appends
+ */
+static void rewrite_cache_meta(struct object_cache *oc)
+{
+	struct object_cache_entry *entry;
+	struct cache_meta *metas;
+	char p[PATH_MAX];
+	int i = 0;
+
+	cache_meta_path(p, sizeof(p), oc->vid);
+
+	/* Appends after the snapshot have to go to the new file */
+	read_lock_cache(oc);
+	sd_mutex_lock(&oc->meta_lock);
+	/* The directory may belong to a new cache of the VDI already */
+	if (oc->deleted) {
+		unlock_cache(oc);
+		sd_mutex_unlock(&oc->meta_lock);
+		return;
+	}
+	metas = xmalloc(sizeof(*metas) * (oc->total_count + 1));
+	list_for_each_entry(entry, &oc->object_head, object_list) {
+		metas[i].idx = entry->idx;
+		if (car_is_frequent(&entry->car))
+			metas[i].idx |= CACHE_HOT_BIT;
+		metas[i].bmap = entry->bmap;
+		metas[i].valid = uatomic_read(&entry->valid);
+		metas[i].checksum = cache_meta_checksum(metas + i);
+		i++;
+	}
+	unlock_cache(oc);
+
+	if (oc->meta_fd >= 0)
+		close(oc->meta_fd);
+	oc->meta_fd = -1;
+	if (atomic_create_and_write(p, (char *)metas, sizeof(*metas) * i,
+				    true) < 0) {
+		unlink(p);
+		uatomic_set_true(&oc->meta_stale);
+		goto out;
+	}
+	oc->meta_fd = open(p, O_WRONLY | O_APPEND);
+	if (oc->meta_fd < 0) {
+		sd_err("failed to open %s, %m", p);
+		unlink(p);
+		uatomic_set_true(&oc->meta_stale);
+	}
+out:
+	sd_mutex_unlock(&oc->meta_lock);
+	free(metas);
 }
 
 static void do_background_push(struct work *work)
@@ -267,12 +551,12 @@ static void add_to_dirty_list(struct object_cache_entry *entry)
 		kick_background_pusher(oc);
 }
 
+/* Must be called with the cache write-locked, after entry_hash_del() */
 static inline void free_cache_entry(struct object_cache_entry *entry)
 {
 	struct object_cache *oc = entry->oc;
 
-	rb_erase(&entry->node, &oc->lru_tree);
-	list_del(&entry->lru_list);
+	list_del(&entry->object_list);
 	oc->total_count--;
 	if (list_linked(&entry->dirty_list))
 		del_from_dirty_list(entry);
@@ -280,12 +564,45 @@ static inline void free_cache_entry(struct object_cache_entry *entry)
 	free(entry);
 }
 
-static uint64_t idx_to_oid(uint32_t vid, uint64_t idx)
+/*
+ * Pin the cache for a background worker.  object_cache_delete() unhashes the
+ * cache and its entries at once, but the last put frees their memory
+ */
+static struct object_cache *get_object_cache(uint32_t vid)
 {
-	if (idx_has_vdi_bit(idx))
-		return vid_to_vdi_oid(vid);
-	else
-		return vid_to_data_oid(vid, idx);
+	int h = hash(vid);
+	struct object_cache *cache;
+	struct hlist_node *node;
+
+	sd_read_lock(&hashtable_lock[h]);
+	hlist_for_each_entry(cache, node, cache_hashtable + h, hash) {
+		if (cache->vid == vid) {
+			refcount_inc(&cache->refcnt);
+			goto out;
+		}
+	}
+	cache = NULL;
+out:
+	sd_rw_unlock(&hashtable_lock[h]);
+	return cache;
+}
+
+static void put_object_cache(struct object_cache *cache)
+{
+	struct object_cache_entry *entry;
+
+	if (refcount_dec(&cache->refcnt) > 0)
+		return;
+
+	list_for_each_entry(entry, &cache->object_head, object_list)
+		free_cache_entry(entry);
+	sd_destroy_rw_lock(&cache->lock);
+	close(cache->push_efd);
+	if (cache->meta_fd >= 0)
+		close(cache->meta_fd);
+	sd_destroy_mutex(&cache->meta_lock);
+	sd_destroy_mutex(&cache->ra_lock);
+	free(cache);
 }
 
 static int remove_cache_object(struct object_cache *oc, uint64_t idx)
@@ -296,6 +613,8 @@ static int remove_cache_object(struct object_cache *oc, uint64_t idx)
 	snprintf(path, sizeof(path), "%s/%06"PRIx32"/%016"PRIx64,
 		 object_cache_dir, oc->vid, idx);
 	sd_debug("%"PRIx64, idx_to_oid(oc->vid, idx));
+	/* a record of the old object mustn't apply to a new one */
+	append_cache_meta(oc, idx | CACHE_REMOVED_BIT, 0, 0, false);
 	if (unlikely(unlink(path) < 0)) {
 		sd_err("failed to remove cached object %m");
 		if (errno == ENOENT)
@@ -380,21 +699,171 @@ out:
 	return ret;
 }
 
+/* Record the valid blocks of the cached object so that they survive restart */
+static int set_cache_valid(struct object_cache_entry *entry, uint64_t valid)
+{
+	uint32_t vid = entry->oc->vid;
+	uint64_t idx = entry_idx(entry);
+	char p[PATH_MAX];
+	int ret;
+
+	if (snprintf(p, sizeof(p), "%s/%06"PRIx32"/%016"PRIx64,
+		     object_cache_dir, vid, idx) >= sizeof(p)) {
+		sd_err("too long path %s", object_cache_dir);
+		return SD_RES_EIO;
+	}
+	if (valid == calc_full_bmap(idx_to_oid(vid, idx))) {
+		ret = removexattr(p, VALID_XATTR);
+		if (ret < 0 && errno == ENODATA)
+			ret = 0;
+	} else
+		ret = setxattr(p, VALID_XATTR, &valid, sizeof(valid), 0);
+	if (unlikely(ret < 0)) {
+		sd_err("failed to record the valid blocks of %s, %m", p);
+		return SD_RES_EIO;
+	}
+
+	uatomic_set(&entry->valid, valid);
+	update_cache_meta(entry, false);
+	return SD_RES_SUCCESS;
+}
+
+/*
+ * Fetch the blocks in 'bmap' which aren't cached yet from the backend, with
+ * one read for their span.  Only the missing ones are written to the cache,
+ * since the others may be dirty.  Must be called with the entry write-locked.
+ */
+static int fill_cache_blocks(struct object_cache_entry *entry, uint64_t bmap)
+{
+	uint32_t vid = entry->oc->vid;
+	uint64_t idx = entry_idx(entry), oid = idx_to_oid(vid, idx);
+	uint64_t missing = bmap & ~entry->valid;
+	size_t bsize = get_cache_block_size(oid), objsize = get_objsize(oid);
+	struct sd_req hdr;
+	int first_bit, i, end, ret;
+	off_t offset;
+	void *buf;
+
+	if (!missing)
+		return SD_RES_SUCCESS;
+
+	first_bit = ffsll(missing) - 1;
+	offset = first_bit * bsize;
+	sd_init_req(&hdr, SD_OP_READ_OBJ);
+	hdr.data_length = min((fls64(missing) - first_bit) * bsize,
+			      objsize - (size_t)offset);
+	hdr.obj.oid = oid;
+	hdr.obj.offset = offset;
+
+	buf = xvalloc(hdr.data_length);
+	ret = exec_local_req(&hdr, buf);
+	if (ret != SD_RES_SUCCESS) {
+		sd_err("failed to fetch object %"PRIx64", %s", oid,
+		       sd_strerror(ret));
+		goto out;
+	}
+
+	for (i = find_next_run(missing, 0, &end); i >= 0;
+	     i = find_next_run(missing, end, &end)) {
+		ret = write_cache_object_noupdate(vid, idx,
+				(char *)buf + (i - first_bit) * bsize,
+				min((end - i) * bsize, objsize - i * bsize),
+				i * bsize);
+		if (ret != SD_RES_SUCCESS)
+			goto out;
+	}
+
+	sd_debug("%"PRIx64" filled 0x%"PRIx64, oid, missing);
+	ret = set_cache_valid(entry, entry->valid | missing);
+out:
+	free(buf);
+	return ret;
+}
+
+/*
+ * The fill work pins the cache and looks the entry up again when it runs,
+ * since object_cache_delete() unhashes the entries regardless of their
+ * references
+ */
+struct fill_work {
+	struct work work;
+	uint64_t oid;
+};
+
+static void do_background_fill(struct work *work)
+{
+	struct fill_work *fw = container_of(work, struct fill_work, work);
+	struct object_cache *oc = get_object_cache(oid_to_vid(fw->oid));
+	struct object_cache_entry *entry;
+
+	if (!oc)
+		return;
+
+	entry = get_cache_entry_from(oc, object_cache_oid_to_idx(fw->oid));
+	if (!entry)
+		goto out;
+
+	write_lock_entry(entry);
+	fill_cache_blocks(entry, calc_full_bmap(fw->oid));
+	unlock_entry(entry);
+
+	uatomic_set_false(&entry->in_fill);
+	put_cache_entry(entry);
+out:
+	put_object_cache(oc);
+}
+
+static void background_fill_done(struct work *work)
+{
+	struct fill_work *fw = container_of(work, struct fill_work, work);
+	free(fw);
+}
+
+static void kick_background_filler(struct object_cache_entry *entry)
+{
+	struct fill_work *fw;
+
+	if (!uatomic_set_true(&entry->in_fill))
+		return;
+
+	fw = xzalloc(sizeof(*fw));
+	fw->oid = idx_to_oid(entry->oc->vid, entry_idx(entry));
+	fw->work.fn = do_background_fill;
+	fw->work.done = background_fill_done;
+	queue_work(sys->oc_push_wqueue, &fw->work);
+}
+
 static int read_cache_object(struct object_cache_entry *entry, void *buf,
 			     size_t count, off_t offset)
 {
 	uint32_t vid = entry->oc->vid;
 	uint64_t idx = entry_idx(entry);
-	struct object_cache *oc = entry->oc;
+	uint64_t oid = idx_to_oid(vid, idx);
+	uint64_t need = calc_object_bmap(oid, count, offset);
+	uint64_t valid = uatomic_read(&entry->valid) & need;
 	int ret;
 
-	ret = read_cache_object_noupdate(vid, idx, buf, count, offset);
+	if (valid == need)
+		uatomic_add(&gcache.hit_bytes, count);
+	else {
+		uatomic_add(valid ? &gcache.partial_bytes : &gcache.miss_bytes,
+			    count);
 
-	if (ret == SD_RES_SUCCESS) {
-		write_lock_cache(oc);
-		list_move_tail(&entry->lru_list, &oc->lru_head);
-		unlock_cache(oc);
+		write_lock_entry(entry);
+		ret = fill_cache_blocks(entry, need);
+		unlock_entry(entry);
+		if (ret != SD_RES_SUCCESS)
+			return ret;
+
+		if (sys->object_cache_bgfill &&
+		    uatomic_read(&entry->valid) != calc_full_bmap(oid))
+			kick_background_filler(entry);
 	}
+
+	ret = read_cache_object_noupdate(vid, idx, buf, count, offset);
+
+	if (ret == SD_RES_SUCCESS)
+		car_hit(&gcache.car, &entry->car, clock_get_time());
 	return ret;
 }
 
@@ -404,26 +873,42 @@ static int write_cache_object(struct object_cache_entry *entry, void *buf,
 {
 	uint32_t vid = entry->oc->vid;
 	uint64_t idx = entry_idx(entry);
-	uint64_t oid = idx_to_oid(vid, idx);
+	uint64_t oid = idx_to_oid(vid, idx), bmap;
 	struct object_cache *oc = entry->oc;
 	struct sd_req hdr;
 	int ret;
 
 	write_lock_entry(entry);
 
+	/* the blocks the write covers only partially have to be cached first */
+	ret = fill_cache_blocks(entry, calc_edge_bmap(oid, count, offset));
+	if (ret != SD_RES_SUCCESS) {
+		unlock_entry(entry);
+		return ret;
+	}
+
 	ret = write_cache_object_noupdate(vid, idx, buf, count, offset);
+	if (ret == SD_RES_SUCCESS && entry->valid != calc_full_bmap(oid))
+		ret = set_cache_valid(entry, entry->valid |
+				      calc_object_bmap(oid, count, offset));
 	if (ret != SD_RES_SUCCESS) {
 		unlock_entry(entry);
 		return ret;
 	}
-	write_lock_cache(oc);
+	bmap = entry->bmap;
 	if (writeback) {
+		write_lock_cache(oc);
 		entry->bmap |= calc_object_bmap(oid, count, offset);
 		if (!list_linked(&entry->dirty_list))
 			add_to_dirty_list(entry);
+		unlock_cache(oc);
+		uatomic_add(&gcache.dirty_bytes, count);
 	}
-	list_move_tail(&entry->lru_list, &oc->lru_head);
-	unlock_cache(oc);
+	car_hit(&gcache.car, &entry->car, clock_get_time());
+
+	/* The new dirty blocks have to be recorded before we ack the write */
+	if (entry->bmap != bmap)
+		update_cache_meta(entry, true);
 
 	unlock_entry(entry);
 
@@ -450,7 +935,33 @@ out:
 	return ret;
 }
 
-static int push_cache_object(uint32_t vid, uint64_t idx, uint64_t bmap,
+static int push_batch_init(struct push_batch *batch)
+{
+	batch->iocb = local_req_init();
+	if (!batch->iocb)
+		return SD_RES_NETWORK_ERROR;
+	batch->bufs = NULL;
+	batch->nr_bufs = 0;
+
+	return SD_RES_SUCCESS;
+}
+
+/* Wait for all the writes of 'batch' */
+static int push_batch_wait(struct push_batch *batch)
+{
+	int ret = local_req_wait(batch->iocb);
+
+	if (ret != SD_RES_SUCCESS)
+		sd_err("failed to push objects, %s", sd_strerror(ret));
+	for (int i = 0; i < batch->nr_bufs; i++)
+		free(batch->bufs[i]);
+	free(batch->bufs);
+
+	return ret;
+}
+
+static int push_cache_blocks(struct push_batch *batch, uint32_t vid,
+			     uint64_t idx, int first_bit, int end_bit,
 			     bool create)
 {
 	struct sd_req hdr;
@@ -458,27 +969,18 @@ static int push_cache_object(uint32_t vid, uint64_t idx, uint64_t bmap,
 	off_t offset;
 	uint64_t oid = idx_to_oid(vid, idx);
 	size_t data_length, bsize = get_cache_block_size(oid);
-	int ret = SD_RES_NO_MEM;
-	int first_bit, last_bit;
-
-	if (!bmap) {
-		sd_debug("WARN: nothing to flush %"PRIx64, oid);
-		return SD_RES_SUCCESS;
-	}
-
-	first_bit = ffsll(bmap) - 1;
-	last_bit = fls64(bmap) - 1;
+	int ret;
 
-	sd_debug("%"PRIx64" bmap(%zd):0x%"PRIx64", first_bit:%d, last_bit:%d",
-		 oid, bsize, bmap, first_bit, last_bit);
 	offset = first_bit * bsize;
-	data_length = min((last_bit - first_bit + 1) * bsize,
+	data_length = min((end_bit - first_bit) * bsize,
 			  get_objsize(oid) - (size_t)offset);
 
 	buf = xvalloc(data_length);
 	ret = read_cache_object_noupdate(vid, idx, buf, data_length, offset);
-	if (ret != SD_RES_SUCCESS)
-		goto out;
+	if (ret != SD_RES_SUCCESS) {
+		free(buf);
+		return ret;
+	}
 
 	if (create)
 		sd_init_req(&hdr, SD_OP_CREATE_AND_WRITE_OBJ);
@@ -488,23 +990,69 @@ static int push_cache_object(uint32_t vid, uint64_t idx, uint64_t bmap,
 	hdr.data_length = data_length;
 	hdr.obj.oid = oid;
 	hdr.obj.offset = offset;
+	uatomic_add(&gcache.push_bytes, data_length);
+
+	if (!create) {
+		batch->bufs = xrealloc(batch->bufs, sizeof(void *) *
+				       (batch->nr_bufs + 1));
+		batch->bufs[batch->nr_bufs++] = buf;
+		return exec_local_req_async(&hdr, buf, batch->iocb);
+	}
 
+	/* The object has to exist before the rest of its extents are written */
 	ret = exec_local_req(&hdr, buf);
 	if (ret != SD_RES_SUCCESS)
 		sd_err("failed to push object %" PRIx64 ", %s", oid,
 		       sd_strerror(ret));
-out:
 	free(buf);
 	return ret;
 }
 
 /*
- * The reclaim algorithm is similar to Linux kernel's page cache:
- *  - only tries to reclaim 'clean' object, which doesn't has any dirty updates,
- *    in a LRU list.
+ * Queue the writes of the dirty extents in 'bmap' to 'batch', skipping the
+ * clean blocks between them and the blocks of a partially cached object which
+ * were never fetched.  The extents are cache block aligned, so they never
+ * share an erasure coded stripe and can be written in parallel.
+ */
+static int push_cache_object(struct push_batch *batch, uint32_t vid,
+			     uint64_t idx, uint64_t bmap, uint64_t valid,
+			     bool create)
+{
+	uint64_t oid = idx_to_oid(vid, idx);
+	int i, end, ret;
+
+	if (!bmap) {
+		sd_debug("WARN: nothing to flush %"PRIx64, oid);
+		return SD_RES_SUCCESS;
+	}
+
+	sd_debug("%"PRIx64" bmap:0x%"PRIx64", valid:0x%"PRIx64, oid, bmap,
+		 valid);
+
+	/* A partially cached object was fetched, so it exists already */
+	if (valid != calc_full_bmap(oid))
+		create = false;
+
+	bmap &= valid;
+	for (i = find_next_run(bmap, 0, &end); i >= 0;
+	     i = find_next_run(bmap, end, &end)) {
+		ret = push_cache_blocks(batch, vid, idx, i, end, create);
+		if (ret != SD_RES_SUCCESS)
+			return ret;
+		create = false;
+	}
+
+	return SD_RES_SUCCESS;
+}
+
+/*
+ * The reclaimer evicts the objects which CAR chooses across all the VDIs:
+ *  - only tries to reclaim 'clean' object, which doesn't has any dirty updates.
  *  - skip the object when it is in R/W operation.
- *  - skip the dirty object if it is not in push(writeback) phase.
- *  - wait on the dirty object if it is in push phase.
+ *  - skip the dirty object, which is reclaimable after it is pushed.
+ *
+ * Only the shard of the victim is write-locked to take it out of the hash
+ * table, and its cache only to unlink it from the object list.
  */
 
 /*
@@ -512,39 +1060,38 @@ out:
  * buffer which is large enough to prevent cache overrun.
  */
 #define HIGH_WATERMARK (sys->object_cache_size * 9 / 10)
-static void do_reclaim_object(struct object_cache *oc)
+
+static bool entry_evictable(struct car_node *node)
 {
-	struct object_cache_entry *entry;
-	uint64_t oid;
-	uint32_t cap;
+	struct object_cache_entry *entry =
+		container_of(node, struct object_cache_entry, car);
+	struct object_cache *oc = entry->oc;
+	uint64_t oid = idx_to_oid(oc->vid, entry_idx(entry));
+	int h = entry_hash(oc->vid, entry_idx(entry));
+	bool ret = false;
 
-	write_lock_cache(oc);
-	list_for_each_entry(entry, &oc->lru_head, lru_list) {
-		oid = idx_to_oid(oc->vid, entry_idx(entry));
-		if (entry_in_use(entry)) {
-			sd_debug("%"PRIx64" is in use, skip...", oid);
-			continue;
-		}
+	/* The shard lock excludes get_cache_entry_from() */
+	sd_write_lock(entry_shard(h));
+	if (entry_in_use(entry)) {
+		sd_debug("%"PRIx64" is in use, skip...", oid);
+		goto out;
+	}
 
-		/*
-		 * The shared snapshot objects won't be released after being
-		 * pulled and if sheep restarts, the remaining snapshot objects
-		 * will be marked as dirty. So for these kind of objects, we
-		 * can reclaim them safely.
-		 */
-		if (entry_is_dirty(entry) && !oid_is_readonly(oid)) {
-			sd_debug("%"PRIx64" is dirty, skip...", oid);
-			continue;
-		}
-		if (remove_cache_object(oc, entry_idx(entry)) != SD_RES_SUCCESS)
-			continue;
-		free_cache_entry(entry);
-		cap = uatomic_sub_return(&gcache.capacity, CACHE_OBJECT_SIZE);
-		sd_debug("%"PRIx64" reclaimed. capacity:%"PRId32, oid, cap);
-		if (cap <= HIGH_WATERMARK)
-			break;
+	/*
+	 * The shared snapshot objects won't be released after being
+	 * pulled and if sheep restarts, the remaining snapshot objects
+	 * will be marked as dirty. So for these kind of objects, we
+	 * can reclaim them safely.
+	 */
+	if (entry_is_dirty(entry) && !oid_is_readonly(oid)) {
+		sd_debug("%"PRIx64" is dirty, skip...", oid);
+		goto out;
 	}
-	unlock_cache(oc);
+	hlist_del(&entry->hash);
+	ret = true;
+out:
+	sd_rw_unlock(entry_shard(h));
+	return ret;
 }
 
 struct reclaim_work {
@@ -555,33 +1102,52 @@ struct reclaim_work {
 static void do_reclaim(struct work *work)
 {
 	struct reclaim_work *rw = container_of(work, struct reclaim_work, work);
-	struct object_cache *cache;
-	struct hlist_node *node;
-	int i, j;
+	struct object_cache_entry *entry;
+	struct object_cache *oc;
+	struct car_node *node;
+	uint64_t oid;
+	uint32_t cap;
 
 	if (rw->delay)
 		sleep(rw->delay);
-	/* We choose a random victim to avoid reclaim the same one every time */
-	j = random();
-	for (i = 0; i < HASH_SIZE; i++) {
-		int idx = (i + j) % HASH_SIZE;
-		struct hlist_head *head = cache_hashtable + idx;
 
-		sd_read_lock(&hashtable_lock[idx]);
-		hlist_for_each_entry(cache, node, head, hash) {
-			uint32_t cap;
-
-			do_reclaim_object(cache);
-			cap = uatomic_read(&gcache.capacity);
-			if (cap <= HIGH_WATERMARK) {
-				sd_rw_unlock(&hashtable_lock[idx]);
-				sd_debug("complete, capacity %"PRIu32, cap);
-				return;
-			}
+	while ((cap = uatomic_read(&gcache.capacity)) > HIGH_WATERMARK) {
+		/* object_cache_delete() can't free the victim under the lock */
+		sd_mutex_lock(&gcache.car_lock);
+		node = car_evict(&gcache.car, entry_evictable);
+		if (!node) {
+			sd_mutex_unlock(&gcache.car_lock);
+			sd_debug("nothing to reclaim, capacity %"PRIu32, cap);
+			return;
+		}
+		entry = container_of(node, struct object_cache_entry, car);
+		oc = entry->oc;
+		oid = idx_to_oid(oc->vid, entry_idx(entry));
+
+		/*
+		 * object_cache_push() takes its references under the cache
+		 * lock, not the shard lock, so check again under the former.
+		 * No new reference can be taken while we hold it.
+		 */
+		write_lock_cache(oc);
+		if (entry_in_use(entry) ||
+		    remove_cache_object(oc, entry_idx(entry)) !=
+		    SD_RES_SUCCESS) {
+			unlock_cache(oc);
+			/* put it back, or the lookups would find only the file */
+			entry_hash_insert(entry);
+			car_restore(&gcache.car, &entry->car, node->key, false);
+			sd_mutex_unlock(&gcache.car_lock);
+			return;
 		}
-		sd_rw_unlock(&hashtable_lock[idx]);
+		free_cache_entry(entry);
+		unlock_cache(oc);
+		sd_mutex_unlock(&gcache.car_lock);
+
+		cap = uatomic_sub_return(&gcache.capacity, CACHE_OBJECT_SIZE);
+		sd_debug("%"PRIx64" reclaimed. capacity:%"PRId32, oid, cap);
 	}
-	sd_debug("finished");
+	sd_debug("complete, capacity %"PRIu32, cap);
 }
 
 static void reclaim_done(struct work *work)
@@ -604,6 +1170,19 @@ static int create_dir_for(uint32_t vid)
 	return ret;
 }
 
+static int open_cache_meta(uint32_t vid)
+{
+	char p[PATH_MAX];
+	int fd;
+
+	cache_meta_path(p, sizeof(p), vid);
+	fd = open(p, O_WRONLY | O_CREAT | O_APPEND, sd_def_fmode);
+	if (fd < 0)
+		sd_err("failed to open %s, %m", p);
+
+	return fd;
+}
+
 static struct object_cache *find_object_cache(uint32_t vid, bool create)
 {
 	int h = hash(vid);
@@ -627,17 +1206,20 @@ not_found:
 	if (create) {
 		cache = xzalloc(sizeof(*cache));
 		cache->vid = vid;
-		INIT_RB_ROOT(&cache->lru_tree);
 		create_dir_for(vid);
 		cache->push_efd = eventfd(0, 0);
 
 		INIT_LIST_HEAD(&cache->dirty_head);
-		INIT_LIST_HEAD(&cache->lru_head);
+		INIT_LIST_HEAD(&cache->object_head);
 
 		sd_init_rw_lock(&cache->lock);
 		hlist_add_head(&cache->hash, head);
 
 		sd_init_mutex(&cache->push_mutex);
+		sd_init_mutex(&cache->meta_lock);
+		sd_init_mutex(&cache->ra_lock);
+		cache->meta_fd = open_cache_meta(vid);
+		refcount_set(&cache->refcnt, 1);
 	} else {
 		cache = NULL;
 	}
@@ -677,30 +1259,57 @@ alloc_cache_entry(struct object_cache *oc, uint64_t idx)
 	entry->idx = idx;
 	sd_init_rw_lock(&entry->lock);
 	INIT_LIST_NODE(&entry->dirty_list);
-	INIT_LIST_NODE(&entry->lru_list);
+	INIT_LIST_NODE(&entry->object_list);
+	INIT_LIST_NODE(&entry->car.list);
 
 	return entry;
 }
 
-static void add_to_lru_cache(struct object_cache *oc, uint64_t idx, bool create)
+static struct object_cache_entry *
+insert_cache_entry(struct object_cache *oc, uint64_t idx, uint64_t bmap,
+		   uint64_t valid)
 {
 	struct object_cache_entry *entry = alloc_cache_entry(oc, idx);
 
-	sd_debug("oid %"PRIx64" added", idx_to_oid(oc->vid, idx));
+	entry->valid = valid;
+
+	sd_debug("oid %"PRIx64" added", idx_to_oid(oc->vid, entry_idx(entry)));
 
+	entry_hash_insert(entry);
 	write_lock_cache(oc);
-	if (unlikely(lru_tree_insert(&oc->lru_tree, entry)))
-		panic("the object already exist");
 	uatomic_add(&gcache.capacity, CACHE_OBJECT_SIZE);
-	list_add_tail(&entry->lru_list, &oc->lru_head);
+	list_add_tail(&entry->object_list, &oc->object_head);
 	oc->total_count++;
-	if (create) {
+	if (bmap) {
 		/* Cache lock assure it is not raced with pusher */
-		entry->bmap = UINT64_MAX;
-		entry->idx |= CACHE_CREATE_BIT;
+		entry->bmap = bmap;
 		add_to_dirty_list(entry);
 	}
 	unlock_cache(oc);
+
+	return entry;
+}
+
+/* Add the object cached on a miss, or read ahead if 'prefetched' */
+static void add_cache_entry(struct object_cache *oc, uint64_t idx, bool create,
+			    uint64_t valid, bool prefetched)
+{
+	struct object_cache_entry *entry;
+
+	if (create)
+		entry = insert_cache_entry(oc, idx | CACHE_CREATE_BIT,
+					   UINT64_MAX, valid);
+	else
+		entry = insert_cache_entry(oc, idx, 0, valid);
+	if (prefetched)
+		uatomic_set(&entry->prefetched, 1);
+
+	sd_mutex_lock(&gcache.car_lock);
+	car_insert(&gcache.car, &entry->car, idx_to_oid(oc->vid, idx),
+		   clock_get_time());
+	sd_mutex_unlock(&gcache.car_lock);
+
+	update_cache_meta(entry, create);
 }
 
 static inline int lookup_path(char *path)
@@ -741,7 +1350,8 @@ static int object_cache_lookup(struct object_cache *oc, uint64_t idx,
 		ret = SD_RES_EIO;
 		goto out_close;
 	}
-	add_to_lru_cache(oc, idx, writeback);
+	add_cache_entry(oc, idx, writeback,
+			calc_full_bmap(idx_to_oid(oc->vid, idx)), false);
 	object_cache_try_to_reclaim(0);
 out_close:
 	close(fd);
@@ -749,12 +1359,19 @@ out:
 	return ret;
 }
 
+/*
+ * Create the cache file of the object with 'count' bytes of 'buffer' at
+ * 'offset'.  Unless they are the whole object, the file is sparse and only
+ * the 'valid' blocks are recorded.
+ */
 static int create_cache_object(struct object_cache *oc, uint64_t idx,
-			       void *buffer, size_t buf_size)
+			       void *buffer, size_t count, off_t offset,
+			       uint64_t valid)
 {
 	int flags = def_open_flags | O_CREAT | O_EXCL, fd;
 	int ret = SD_RES_OID_EXIST;
 	char path[PATH_MAX], tmp_path[PATH_MAX];
+	uint64_t oid = idx_to_oid(oc->vid, idx);
 
 	snprintf(tmp_path, sizeof(tmp_path), "%s/%06"PRIx32"/%016"PRIx64".tmp",
 		object_cache_dir, oc->vid, idx);
@@ -769,10 +1386,17 @@ static int create_cache_object(struct object_cache *oc, uint64_t idx,
 		goto out;
 	}
 
-	ret = xwrite(fd, buffer, buf_size);
-	if (unlikely(ret != buf_size)) {
+	if (valid != calc_full_bmap(oid))
+		ret = fsetxattr(fd, VALID_XATTR, &valid, sizeof(valid), 0) ?:
+			xftruncate(fd, get_objsize(oid));
+	else
+		ret = 0;
+	if (!ret && xpwrite(fd, buffer, count, offset) != count)
+		ret = -1;
+	if (unlikely(ret < 0)) {
 		ret = SD_RES_EIO;
-		sd_err("failed, vid %"PRIx32", idx %"PRIx64, oc->vid, idx);
+		sd_err("failed, vid %"PRIx32", idx %"PRIx64", %m", oc->vid,
+		       idx);
 		goto out_close;
 	}
 	/* This is intended to take care of partial write due to crash */
@@ -790,7 +1414,7 @@ static int create_cache_object(struct object_cache *oc, uint64_t idx,
 		goto out_close;
 	}
 	ret = SD_RES_SUCCESS;
-	sd_debug("%016"PRIx64" size %zu", idx, buf_size);
+	sd_debug("%016"PRIx64" valid 0x%"PRIx64, idx, valid);
 out_close:
 	close(fd);
 	unlink(tmp_path);
@@ -798,26 +1422,46 @@ out:
 	return ret;
 }
 
-/* Fetch the object, cache it in the clean state */
-static int object_cache_pull(struct object_cache *oc, uint64_t idx)
+/*
+ * Fetch the object, cache it in the clean state
+ *
+ * With partial fill, only fetch the span of the blocks in 'need' into a
+ * sparse cache file, whose other blocks are fetched when they are accessed,
+ * unless the object is read ahead for a sequential reader, which will read
+ * all of it.  Fetching them before the entry is added means a missing
+ * object leaves no entry behind.
+ */
+static int object_cache_pull(struct object_cache *oc, uint64_t idx,
+			     uint64_t need, bool prefetch)
 {
 	struct sd_req hdr;
-	int ret = SD_RES_NO_MEM;
+	int ret, first_bit;
 	uint64_t oid = idx_to_oid(oc->vid, idx);
-	uint32_t data_length = get_objsize(oid);
+	uint64_t valid = calc_full_bmap(oid);
+	size_t bsize = get_cache_block_size(oid), objsize = get_objsize(oid);
+	off_t offset = 0;
 	void *buf;
 
-	buf = xvalloc(data_length);
 	sd_init_req(&hdr, SD_OP_READ_OBJ);
-	hdr.data_length = data_length;
+	hdr.data_length = objsize;
+	if (partial_fill && need && !prefetch) {
+		first_bit = ffsll(need) - 1;
+		offset = first_bit * bsize;
+		hdr.data_length = min((fls64(need) - first_bit) * bsize,
+				      objsize - (size_t)offset);
+		valid = calc_object_bmap(oid, hdr.data_length, offset);
+	}
+
+	buf = xvalloc(hdr.data_length);
 	hdr.obj.oid = oid;
-	hdr.obj.offset = 0;
+	hdr.obj.offset = offset;
 	ret = exec_local_req(&hdr, buf);
 	if (ret != SD_RES_SUCCESS)
 		goto err;
 
-	sd_debug("oid %"PRIx64" pulled successfully", oid);
-	ret = create_cache_object(oc, idx, buf, data_length);
+	sd_debug("oid %"PRIx64" pulled successfully, valid 0x%"PRIx64, oid,
+		 valid);
+	ret = create_cache_object(oc, idx, buf, hdr.data_length, offset, valid);
 	/*
 	 * We try to delay reclaim objects to avoid object ping-pong
 	 * because the pulled object is clean and likely to be reclaimed
@@ -827,7 +1471,7 @@ static int object_cache_pull(struct object_cache *oc, uint64_t idx)
 	 */
 	switch (ret) {
 	case SD_RES_SUCCESS:
-		add_to_lru_cache(oc, idx, false);
+		add_cache_entry(oc, idx, false, valid, prefetch);
 		object_cache_try_to_reclaim(1);
 		break;
 	case SD_RES_OID_EXIST:
@@ -841,38 +1485,206 @@ err:
 	return ret;
 }
 
-static void do_push_object(struct work *work)
+struct prefetch_work {
+	struct work work;
+	uint32_t vid;
+	uint64_t idx; /* The first object to read ahead */
+	uint32_t nr;
+};
+
+static void prefetch_done(struct work *work)
 {
-	struct push_work *pw = container_of(work, struct push_work, work);
-	struct object_cache_entry *entry = pw->entry;
-	struct object_cache *oc = entry->oc;
-	uint64_t oid = idx_to_oid(oc->vid, entry_idx(entry));
+	struct prefetch_work *pw = container_of(work, struct prefetch_work,
+						work);
+	free(pw);
+}
+
+static void queue_prefetch(uint32_t vid, uint64_t idx, uint32_t nr,
+			   work_func_t fn)
+{
+	struct prefetch_work *pw = xzalloc(sizeof(*pw));
 
-	sd_debug("%"PRIx64, oid);
+	pw->vid = vid;
+	pw->idx = idx;
+	pw->nr = nr;
+	pw->work.fn = fn;
+	pw->work.done = prefetch_done;
+	queue_work(sys->oc_push_wqueue, &pw->work);
+}
+
+static void do_prefetch_object(struct work *work)
+{
+	struct prefetch_work *pw = container_of(work, struct prefetch_work,
+						work);
+	struct object_cache *oc = find_object_cache(pw->vid, false);
+	int ret;
 
-	read_lock_entry(entry);
 	/*
-	 * We might happen to push readonly object in following scenario
-	 * 1. sheep pulled some read-only objects
-	 * 2. sheep crashed
-	 * 3. sheep restarted and marked all the objects in cache dirty blindly
+	 * Only the request path creates a cache, else we could recreate
+	 * the one of a VDI being deleted
 	 */
-	if (oid_is_readonly(idx_to_oid(oc->vid, entry_idx(entry))))
-		goto clean;
+	if (!oc)
+		return;
+	if (object_cache_lookup(oc, pw->idx, false, false) != SD_RES_NO_CACHE)
+		return;
+
+	ret = object_cache_pull(oc, pw->idx, 0, true);
+	if (ret != SD_RES_SUCCESS) {
+		sd_debug("failed to read ahead %"PRIx64", %s",
+			 idx_to_oid(pw->vid, pw->idx), sd_strerror(ret));
+		return;
+	}
+	uatomic_inc(&oc->prefetch_count);
+}
+
+/*
+ * Read ahead the allocated objects of the range, each by a worker of its own
+ *
+ * The objects are looked up in the inode, so that we don't ask for the ones
+ * which don't exist, and those of a clone which are still shared are read
+ * into the cache of the VDI they belong to, if it is cached already.
+ */
+static void do_prefetch(struct work *work)
+{
+	struct prefetch_work *pw = container_of(work, struct prefetch_work,
+						work);
+	uint64_t vdi_oid = vid_to_vdi_oid(pw->vid), end;
+	struct sd_inode *inode = xmalloc(SD_INODE_HEADER_SIZE);
+	uint32_t *vids = NULL;
+	int ret;
+
+	if (!find_object_cache(pw->vid, false))
+		goto out;
+
+	ret = sd_read_object(vdi_oid, (char *)inode, SD_INODE_HEADER_SIZE, 0);
+	if (ret != SD_RES_SUCCESS)
+		goto out;
+	/* The objects of a hyper volume are indexed by a btree */
+	if (inode->store_policy)
+		goto out;
+
+	end = min(pw->idx + pw->nr, (uint64_t)count_data_objs(inode));
+	if (end <= pw->idx)
+		goto out;
+	vids = xmalloc(sizeof(*vids) * (end - pw->idx));
+	ret = sd_read_object(vdi_oid, (char *)vids,
+			     sizeof(*vids) * (end - pw->idx),
+			     SD_INODE_HEADER_SIZE + sizeof(*vids) * pw->idx);
+	if (ret != SD_RES_SUCCESS)
+		goto out;
 
-	if (unlikely(push_cache_object(oc->vid, entry_idx(entry), entry->bmap,
-				       !!(entry->idx & CACHE_CREATE_BIT))
-		     != SD_RES_SUCCESS))
+	for (uint64_t idx = pw->idx; idx < end; idx++)
+		if (vids[idx - pw->idx])
+			queue_prefetch(vids[idx - pw->idx], idx, 1,
+				       do_prefetch_object);
+out:
+	free(vids);
+	free(inode);
+}
+
+/*
+ * Detect a sequential reader of the VDI and read ahead of it
+ *
+ * A read is sequential if it starts within CACHE_READAHEAD_SLACK of where the
+ * last one ended, which allows for the reordering of the concurrent requests
+ * of a VM.  Whenever a sequential reader enters a new object, the read-ahead
+ * depth doubles up to sys->object_cache_readahead objects, or a quarter of
+ * the cache, and the objects within the depth which aren't read ahead yet
+ * are prefetched.  A random read resets the depth.
+ */
+static void object_cache_readahead(struct object_cache *oc, uint64_t idx,
+				   uint64_t offset, uint32_t len)
+{
+	uint64_t pos = idx * SD_DATA_OBJ_SIZE + offset, start, end;
+	uint32_t max_depth = HIGH_WATERMARK / CACHE_OBJECT_SIZE / 4;
+
+	max_depth = min(max_depth, sys->object_cache_readahead);
+	if (!max_depth || idx_has_vdi_bit(idx))
+		return;
+
+	sd_mutex_lock(&oc->ra_lock);
+	if (pos + CACHE_READAHEAD_SLACK < oc->ra_next ||
+	    pos > oc->ra_next + CACHE_READAHEAD_SLACK) {
+		oc->ra_next = pos + len;
+		oc->ra_idx = idx;
+		oc->ra_end = 0;
+		oc->ra_depth = 0;
+		goto out;
+	}
+
+	oc->ra_next = max(oc->ra_next, pos + len);
+	if (idx <= oc->ra_idx)
+		goto out;
+	oc->ra_idx = idx;
+	oc->ra_depth = oc->ra_depth ? min(oc->ra_depth * 2, max_depth) : 1;
+
+	start = max(oc->ra_end, idx + 1);
+	end = idx + 1 + oc->ra_depth;
+	if (start < end) {
+		sd_debug("%"PRIx32", objects %"PRIu64" to %"PRIu64, oc->vid,
+			 start, end - 1);
+		oc->ra_end = end;
+		queue_prefetch(oc->vid, start, end - start, do_prefetch);
+	}
+out:
+	sd_mutex_unlock(&oc->ra_lock);
+}
+
+/* Push a run of the adjacent dirty objects of a VDI in one batch */
+static void do_push_object(struct work *work)
+{
+	struct push_work *pw = container_of(work, struct push_work, work);
+	struct object_cache *oc = pw->oc;
+	struct push_batch batch;
+	bool failed = false;
+
+	sd_debug("%"PRIx32", %d objects from %"PRIx64, oc->vid,
+		 pw->nr_entries, entry_idx(pw->entries[0]));
+
+	if (unlikely(push_batch_init(&batch) != SD_RES_SUCCESS))
 		panic("push failed but should never fail");
-clean:
-	if (uatomic_sub_return(&oc->push_count, 1) == 0)
-		eventfd_xwrite(oc->push_efd, 1);
-	entry->idx &= ~CACHE_CREATE_BIT;
-	entry->bmap = 0;
-	unlock_entry(entry);
+	for (int i = 0; i < pw->nr_entries; i++) {
+		struct object_cache_entry *entry = pw->entries[i];
 
-	sd_debug("%"PRIx64" done", oid);
-	put_cache_entry(entry);
+		read_lock_entry(entry);
+		/*
+		 * We might happen to push readonly object in following scenario
+		 * 1. sheep pulled some read-only objects
+		 * 2. sheep crashed
+		 * 3. sheep restarted and marked all the objects in cache dirty
+		 *    blindly
+		 */
+		if (oid_is_readonly(idx_to_oid(oc->vid, entry_idx(entry))))
+			continue;
+
+		if (push_cache_object(&batch, oc->vid, entry_idx(entry),
+				      entry->bmap, entry->valid,
+				      !!(entry->idx & CACHE_CREATE_BIT))
+		    != SD_RES_SUCCESS)
+			failed = true;
+	}
+	if (unlikely(push_batch_wait(&batch) != SD_RES_SUCCESS || failed))
+		panic("push failed but should never fail");
+
+	for (int i = 0; i < pw->nr_entries; i++) {
+		struct object_cache_entry *entry = pw->entries[i];
+
+		if (uatomic_sub_return(&oc->push_count, 1) == 0)
+			eventfd_xwrite(oc->push_efd, 1);
+		entry->idx &= ~CACHE_CREATE_BIT;
+		entry->bmap = 0;
+		unlock_entry(entry);
+		put_cache_entry(entry);
+	}
+	uatomic_set_true(&oc->meta_stale);
+
+	sd_debug("%"PRIx32" done", oc->vid);
+}
+
+static int entry_cmp(struct object_cache_entry * const *a,
+		     struct object_cache_entry * const *b)
+{
+	return intcmp(entry_idx(*a), entry_idx(*b));
 }
 
 static void push_object_done(struct work *work)
@@ -892,7 +1704,9 @@ static void push_object_done(struct work *work)
  */
 static int object_cache_push(struct object_cache *oc)
 {
-	struct object_cache_entry *entry;
+	struct object_cache_entry *entry, **entries;
+	struct push_work *pw = NULL;
+	int nr = 0;
 
 	write_lock_cache(oc);
 	if (list_empty(&oc->dirty_head)) {
@@ -900,19 +1714,31 @@ static int object_cache_push(struct object_cache *oc)
 		return SD_RES_SUCCESS;
 	}
 
-	uatomic_set(&oc->push_count, uatomic_read(&oc->dirty_count));
+	entries = xmalloc(sizeof(*entries) * uatomic_read(&oc->dirty_count));
 	list_for_each_entry(entry, &oc->dirty_head, dirty_list) {
-		struct push_work *pw;
-
 		get_cache_entry(entry);
-		pw = xzalloc(sizeof(struct push_work));
-		pw->work.fn = do_push_object;
-		pw->work.done = push_object_done;
-		pw->entry = entry;
-		queue_work(sys->oc_push_wqueue, &pw->work);
+		entries[nr++] = entry;
 		del_from_dirty_list(entry);
 	}
+	uatomic_set(&oc->push_count, nr);
+
+	/* The adjacent objects go to the same worker */
+	xqsort(entries, nr, entry_cmp);
+	for (int i = 0; i < nr; i++) {
+		if (!pw || pw->nr_entries == CACHE_PUSH_BATCH ||
+		    entry_idx(entries[i]) != entry_idx(entries[i - 1]) + 1) {
+			if (pw)
+				queue_work(sys->oc_push_wqueue, &pw->work);
+			pw = xzalloc(sizeof(struct push_work));
+			pw->work.fn = do_push_object;
+			pw->work.done = push_object_done;
+			pw->oc = oc;
+		}
+		pw->entries[pw->nr_entries++] = entries[i];
+	}
+	queue_work(sys->oc_push_wqueue, &pw->work);
 	unlock_cache(oc);
+	free(entries);
 
 	eventfd_xread(oc->push_efd);
 
@@ -949,15 +1775,26 @@ void object_cache_delete(uint32_t vid)
 	hlist_del(&cache->hash);
 	sd_rw_unlock(&hashtable_lock[h]);
 
+	sd_mutex_lock(&gcache.car_lock);
 	write_lock_cache(cache);
-	list_for_each_entry(entry, &cache->lru_head, lru_list) {
-		free_cache_entry(entry);
+	list_for_each_entry(entry, &cache->object_head, object_list) {
+		if (list_linked(&entry->car.list))
+			car_remove(&gcache.car, &entry->car);
+		entry_hash_del(entry);
 		uatomic_sub(&gcache.capacity, CACHE_OBJECT_SIZE);
 	}
 	unlock_cache(cache);
-	sd_destroy_rw_lock(&cache->lock);
-	close(cache->push_efd);
-	free(cache);
+	sd_mutex_unlock(&gcache.car_lock);
+
+	sd_mutex_lock(&cache->meta_lock);
+	cache->deleted = true;
+	if (cache->meta_fd >= 0)
+		close(cache->meta_fd);
+	cache->meta_fd = -1;
+	sd_mutex_unlock(&cache->meta_lock);
+
+	/* Drop the reference of the hash table */
+	put_object_cache(cache);
 
 	/* Then we free disk */
 	snprintf(path, sizeof(path), "%s/%06"PRIx32, object_cache_dir, vid);
@@ -968,16 +1805,17 @@ static struct object_cache_entry *
 get_cache_entry_from(struct object_cache *cache, uint64_t idx)
 {
 	struct object_cache_entry *entry;
+	int h = entry_hash(cache->vid, idx);
 
-	read_lock_cache(cache);
-	entry = lru_tree_search(&cache->lru_tree, idx);
+	sd_read_lock(entry_shard(h));
+	entry = entry_hash_search(h, cache, idx);
 	if (!entry) {
 		/* The cache entry may be reclaimed, so try again. */
-		unlock_cache(cache);
+		sd_rw_unlock(entry_shard(h));
 		return NULL;
 	}
 	get_cache_entry(entry);
-	unlock_cache(cache);
+	sd_rw_unlock(entry_shard(h));
 	return entry;
 }
 
@@ -990,6 +1828,8 @@ static struct object_cache_entry *oid_to_entry(uint64_t oid)
 	struct object_cache_entry *entry;
 
 	cache = find_object_cache(vid, false);
+	if (!cache)
+		return NULL;
 	entry = get_cache_entry_from(cache, idx);
 	if (!entry) {
 		sd_debug("%" PRIx64 " doesn't exist", oid);
@@ -998,10 +1838,26 @@ static struct object_cache_entry *oid_to_entry(uint64_t oid)
 	return entry;
 }
 
+static uint64_t get_cache_valid(struct object_cache *oc, uint64_t idx)
+{
+	struct object_cache_entry *entry;
+	uint64_t valid = calc_full_bmap(idx_to_oid(oc->vid, idx));
+	int h = entry_hash(oc->vid, idx);
+
+	sd_read_lock(entry_shard(h));
+	entry = entry_hash_search(h, oc, idx);
+	if (entry)
+		valid = uatomic_read(&entry->valid);
+	sd_rw_unlock(entry_shard(h));
+
+	return valid;
+}
+
 static int object_cache_flush_and_delete(struct object_cache *oc)
 {
 	DIR *dir;
 	struct dirent *d;
+	struct push_batch batch;
 	uint32_t vid = oc->vid;
 	uint64_t idx;
 	uint64_t all = UINT64_MAX;
@@ -1030,8 +1886,14 @@ static int object_cache_flush_and_delete(struct object_cache *oc)
 		idx = strtoull(d->d_name, NULL, 16);
 		if (idx == ULLONG_MAX)
 			continue;
-		if (push_cache_object(vid, idx, all, true) !=
-		    SD_RES_SUCCESS) {
+		if (push_batch_init(&batch) != SD_RES_SUCCESS) {
+			ret = -1;
+			goto out_close_dir;
+		}
+		ret = push_cache_object(&batch, vid, idx, all,
+					get_cache_valid(oc, idx), true);
+		if (push_batch_wait(&batch) != SD_RES_SUCCESS ||
+		    ret != SD_RES_SUCCESS) {
 			ret = -1;
 			goto out_close_dir;
 		}
@@ -1103,7 +1965,10 @@ retry:
 				  hdr->flags & SD_FLAG_CMD_CACHE);
 	switch (ret) {
 	case SD_RES_NO_CACHE:
-		ret = object_cache_pull(cache, idx);
+		ret = object_cache_pull(cache, idx,
+					calc_object_bmap(oid, hdr->data_length,
+							 hdr->obj.offset),
+					false);
 		if (ret != SD_RES_SUCCESS)
 			return ret;
 		break;
@@ -1130,11 +1995,16 @@ retry:
 		if (ret != SD_RES_SUCCESS)
 			goto err;
 	} else {
+		if (uatomic_read(&entry->prefetched) &&
+		    uatomic_xchg(&entry->prefetched, 0))
+			uatomic_inc(&cache->prefetch_hits);
 		ret = read_cache_object(entry, req->data, hdr->data_length,
 					hdr->obj.offset);
 		if (ret != SD_RES_SUCCESS)
 			goto err;
 		req->rp.data_length = hdr->data_length;
+		object_cache_readahead(cache, idx, hdr->obj.offset,
+				       hdr->data_length);
 	}
 err:
 	put_cache_entry(entry);
@@ -1211,13 +2081,81 @@ int object_cache_flush_and_del(const struct request *req)
 	return SD_RES_SUCCESS;
 }
 
+static void restore_cache_entry(struct object_cache_entry *entry, bool hot)
+{
+	struct object_cache *oc = entry->oc;
+
+	sd_mutex_lock(&gcache.car_lock);
+	car_restore(&gcache.car, &entry->car,
+		    idx_to_oid(oc->vid, entry_idx(entry)), hot);
+	sd_mutex_unlock(&gcache.car_lock);
+}
+
+/* Read the records of the metadata file, up to the first torn one */
+static struct cache_meta *read_cache_meta(uint32_t vid, int *nr)
+{
+	struct cache_meta *metas = NULL;
+	char p[PATH_MAX];
+	struct stat st;
+	ssize_t len;
+	int fd, i;
+
+	*nr = 0;
+	cache_meta_path(p, sizeof(p), vid);
+	fd = open(p, O_RDONLY);
+	if (fd < 0) {
+		if (errno != ENOENT)
+			sd_err("failed to open %s, %m", p);
+		return NULL;
+	}
+	if (fstat(fd, &st) < 0) {
+		sd_err("failed to stat %s, %m", p);
+		goto out;
+	}
+	if (!st.st_size)
+		goto out;
+
+	metas = xmalloc(st.st_size);
+	len = xread(fd, metas, st.st_size);
+	if (len < 0) {
+		sd_err("failed to read %s, %m", p);
+		free(metas);
+		metas = NULL;
+		goto out;
+	}
+	for (i = 0; i < len / sizeof(*metas); i++) {
+		if (metas[i].checksum != cache_meta_checksum(metas + i)) {
+			sd_warn("%s is torn at record %d", p, i);
+			break;
+		}
+	}
+	*nr = i;
+out:
+	close(fd);
+	return metas;
+}
+
+static int idx_cmp(const uint64_t *a, const uint64_t *b)
+{
+	return intcmp(*a, *b);
+}
+
+enum load_state {
+	LOAD_UNKNOWN, /* No record is found yet */
+	LOAD_REMOVED, /* The last record is a removal */
+	LOAD_DONE, /* Loaded with the last record */
+};
+
 static int load_cache_object(struct object_cache *cache)
 {
 	DIR *dir;
 	struct dirent *d;
-	uint64_t idx;
-	char path[PATH_MAX];
-	int ret = 0;
+	uint64_t idx, valid, *idxs = NULL, *found;
+	struct cache_meta *metas, **order;
+	char path[PATH_MAX], p[PATH_MAX];
+	int i, nr = 0, nr_metas, nr_order = 0, ret = 0;
+	struct object_cache_entry *entry;
+	enum load_state *states;
 
 	snprintf(path, sizeof(path), "%s/%06"PRIx32, object_cache_dir,
 		 cache->vid);
@@ -1243,17 +2181,75 @@ static int load_cache_object(struct object_cache *cache)
 		if (idx == ULLONG_MAX)
 			continue;
 
+		idxs = xrealloc(idxs, sizeof(*idxs) * (nr + 1));
+		idxs[nr++] = idx;
+	}
+	closedir(dir);
+	xqsort(idxs, nr, idx_cmp);
+
+	/*
+	 * The objects which are still there get their last record, added in
+	 * the order of the records, which is the order they were cached
+	 */
+	metas = read_cache_meta(cache->vid, &nr_metas);
+	order = xmalloc(sizeof(*order) * (nr_metas + 1));
+	states = xzalloc(sizeof(*states) * (nr + 1));
+	for (i = nr_metas - 1; i >= 0; i--) {
+		idx = metas[i].idx & ~CACHE_INDEX_MASK;
+		found = xbsearch(&idx, idxs, nr, idx_cmp);
+		if (!found || states[found - idxs] != LOAD_UNKNOWN)
+			continue;
+		if (metas[i].idx & CACHE_REMOVED_BIT) {
+			states[found - idxs] = LOAD_REMOVED;
+			continue;
+		}
+		states[found - idxs] = LOAD_DONE;
+		order[nr_order++] = metas + i;
+	}
+	for (i = nr_order - 1; i >= 0; i--) {
+		entry = insert_cache_entry(cache,
+					   order[i]->idx & ~CACHE_HOT_BIT,
+					   order[i]->bmap, order[i]->valid);
+		restore_cache_entry(entry, order[i]->idx & CACHE_HOT_BIT);
+		sd_debug("%"PRIx64" bmap:0x%"PRIx64,
+			 idx_to_oid(cache->vid, order[i]->idx & ~CACHE_INDEX_MASK),
+			 order[i]->bmap);
+	}
+
+	for (i = 0; i < nr; i++) {
+		if (states[i] == LOAD_DONE)
+			continue;
+
+		/* the ones without the xattr are cached as a whole */
+		idx = idxs[i];
+		valid = calc_full_bmap(idx_to_oid(cache->vid, idx));
+		if (snprintf(p, sizeof(p), "%s/%016"PRIx64, path, idx) >=
+		    sizeof(p))
+			sd_err("too long path %s", path);
+		else if (getxattr(p, VALID_XATTR, &valid, sizeof(valid)) < 0 &&
+			 errno != ENODATA && errno != ENOTSUP)
+			sd_err("failed to get the valid blocks of %s, %m", p);
+
 		/*
 		 * We don't know VM's cache type after restarting, so we assume
 		 * that it is writeback and mark all the objects diry to avoid
 		 * false reclaim. Donot try to reclaim at loading phase becaue
 		 * cluster isn't fully working.
 		 */
-		add_to_lru_cache(cache, idx, true);
+		entry = insert_cache_entry(cache, idx | CACHE_CREATE_BIT,
+					   UINT64_MAX, valid);
+		restore_cache_entry(entry, false);
 		sd_debug("%"PRIx64, idx_to_oid(cache->vid, idx));
 	}
+	sd_info("vdi %"PRIx32": %d objects loaded, %d of them without metadata",
+		cache->vid, nr, nr - nr_order);
 
-	closedir(dir);
+	rewrite_cache_meta(cache);
+
+	free(states);
+	free(order);
+	free(metas);
+	free(idxs);
 out:
 	return ret;
 }
@@ -1293,27 +2289,33 @@ int object_cache_remove(uint64_t oid)
 {
 	/* Inc the entry refcount to exclude the reclaimer */
 	struct object_cache_entry *entry = oid_to_entry(oid);
-	struct object_cache *oc = entry->oc;
+	struct object_cache *oc;
 	int ret;
 
 	if (!entry)
 		return SD_RES_NO_OBJ;
 
 	sd_debug("%" PRIx64, oid);
+	oc = entry->oc;
 	while (refcount_read(&entry->refcnt) > 1)
 		usleep(100000); /* Object might be in push */
 
-	write_lock_cache(oc);
+	entry_car_del(entry);
+	entry_hash_del(entry);
 	/*
 	 * We assume no other thread will inc the refcount of this entry
-	 * before we call write_lock_cache(). object_cache_remove() is called
+	 * before we call entry_hash_del(). object_cache_remove() is called
 	 * in the DISCARD context, which means nornamly no other read/write
 	 * requests.
 	 */
 	assert(refcount_read(&entry->refcnt) == 1);
+	write_lock_cache(oc);
 	ret = remove_cache_object(oc, entry_idx(entry));
 	if (ret != SD_RES_SUCCESS) {
 		unlock_cache(oc);
+		entry_hash_insert(entry);
+		restore_cache_entry(entry, false);
+		put_cache_entry(entry);
 		return ret;
 	}
 	free_cache_entry(entry);
@@ -1324,6 +2326,84 @@ int object_cache_remove(uint64_t oid)
 	return SD_RES_SUCCESS;
 }
 
+/*
+ * The rewrites sync the files, so they are done after the hash table locks,
+ * which find_object_cache() takes for every request, are released
+ */
+static void do_rewrite_meta(struct work *work)
+{
+	struct object_cache **caches = NULL;
+	int nr = 0;
+
+	for (int i = 0; i < HASH_SIZE; i++) {
+		struct hlist_head *head = cache_hashtable + i;
+		struct object_cache *cache;
+		struct hlist_node *node;
+
+		sd_read_lock(&hashtable_lock[i]);
+		hlist_for_each_entry(cache, node, head, hash) {
+			if (!uatomic_is_true(&cache->meta_stale))
+				continue;
+			refcount_inc(&cache->refcnt);
+			caches = xrealloc(caches, sizeof(*caches) * (nr + 1));
+			caches[nr++] = cache;
+		}
+		sd_rw_unlock(&hashtable_lock[i]);
+	}
+
+	for (int i = 0; i < nr; i++) {
+		uatomic_set_false(&caches[i]->meta_stale);
+		rewrite_cache_meta(caches[i]);
+		put_object_cache(caches[i]);
+	}
+	free(caches);
+}
+
+static struct timer meta_timer;
+
+static void rewrite_meta_done(struct work *work)
+{
+	free(work);
+	add_timer(&meta_timer, CACHE_META_INTERVAL);
+}
+
+static void meta_timer_handler(void *data)
+{
+	struct work *work = xzalloc(sizeof(*work));
+
+	work->fn = do_rewrite_meta;
+	work->done = rewrite_meta_done;
+	queue_work(sys->oc_push_wqueue, work);
+}
+
+static struct timer meta_timer = {
+	.callback = meta_timer_handler,
+};
+
+static bool check_xattr_support(const char *dir)
+{
+	uint64_t valid = 0;
+	char p[PATH_MAX];
+	bool ret = false;
+	int fd;
+
+	if (snprintf(p, sizeof(p), "%s/.xattr_check", dir) >= sizeof(p)) {
+		sd_err("too long path %s", dir);
+		return false;
+	}
+	fd = open(p, O_CREAT | O_RDWR, sd_def_fmode);
+	if (fd < 0) {
+		sd_err("failed to create %s, %m", p);
+		return false;
+	}
+	if (fsetxattr(fd, VALID_XATTR, &valid, sizeof(valid), 0) == 0)
+		ret = true;
+	close(fd);
+	unlink(p);
+
+	return ret;
+}
+
 int object_cache_init(const char *p)
 {
 	int ret = 0;
@@ -1343,10 +2423,21 @@ int object_cache_init(const char *p)
 	}
 	strbuf_copyout(&buf, object_cache_dir, sizeof(object_cache_dir));
 
+	car_init(&gcache.car, HIGH_WATERMARK / CACHE_OBJECT_SIZE,
+		 CACHE_REF_PERIOD);
+	sd_init_mutex(&gcache.car_lock);
+
+	partial_fill = check_xattr_support(object_cache_dir);
+	if (!partial_fill)
+		sd_warn("%s doesn't support xattr, cache the objects as a "
+			"whole", object_cache_dir);
+
 	uatomic_set(&gcache.capacity, 0);
 	uatomic_set_false(&gcache.in_reclaim);
 
 	ret = load_cache();
+	if (!ret)
+		add_timer(&meta_timer, CACHE_META_INTERVAL);
 err:
 	strbuf_release(&buf);
 	return ret;
@@ -1386,6 +2477,10 @@ int object_cache_get_info(struct object_cache_info *info)
 			info->caches[j].vid = cache->vid;
 			info->caches[j].dirty = cache->dirty_count;
 			info->caches[j].total = cache->total_count;
+			info->caches[j].prefetched =
+				uatomic_read(&cache->prefetch_count);
+			info->caches[j].prefetch_hits =
+				uatomic_read(&cache->prefetch_hits);
 			j++;
 			unlock_cache(cache);
 		}
@@ -1393,6 +2488,11 @@ int object_cache_get_info(struct object_cache_info *info)
 	}
 	info->count = j;
 	info->directio = sys->object_cache_directio;
+	info->hit_bytes = uatomic_read(&gcache.hit_bytes);
+	info->partial_bytes = uatomic_read(&gcache.partial_bytes);
+	info->miss_bytes = uatomic_read(&gcache.miss_bytes);
+	info->dirty_bytes = uatomic_read(&gcache.dirty_bytes);
+	info->push_bytes = uatomic_read(&gcache.push_bytes);
 
 	return sizeof(*info);
 }
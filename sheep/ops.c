@@ -333,6 +333,16 @@ static int cluster_disable_recover(const struct sd_req *req,
 	return SD_RES_SUCCESS;
 }
 
+static int cluster_set_recovery_throttle(const struct sd_req *req,
+					 struct sd_rsp *rsp, void *data)
+{
+	if (req->data_length < sizeof(struct recovery_throttle))
+		return SD_RES_INVALID_PARMS;
+
+	set_recovery_throttle(data);
+	return set_recovery_throttle_config(data);
+}
+
 static int cluster_get_vdi_attr(struct request *req)
 {
 	const struct sd_req *hdr = &req->rq;
@@ -434,6 +444,15 @@ static int local_stat_recovery(const struct sd_req *req, struct sd_rsp *rsp,
 	return SD_RES_SUCCESS;
 }
 
+static int local_get_recovery_throttle(const struct sd_req *req,
+				       struct sd_rsp *rsp, void *data)
+{
+	get_recovery_throttle(data);
+	rsp->data_length = sizeof(struct recovery_throttle);
+
+	return SD_RES_SUCCESS;
+}
+
 static int local_stat_cluster(struct request *req)
 {
 	struct sd_rsp *rsp = &req->rp;
@@ -818,11 +837,29 @@ out:
 static int local_sd_stat(const struct sd_req *req, struct sd_rsp *rsp,
 			 void *data)
 {
+	struct wq_stat wq_stat;
+
+	get_event_loop_time(&sys->stat.m.busy_time, &sys->stat.m.up_time);
+	get_wq_stat(&wq_stat);
+	sys->stat.m.done_nr = wq_stat.main_done_nr;
+	sys->stat.m.wakeup_nr = wq_stat.main_wakeup_nr;
+	sys->stat.m.worker_done_nr = wq_stat.worker_done_nr;
+
 	memcpy(data, &sys->stat, sizeof(struct sd_stat));
 	rsp->data_length = sizeof(struct sd_stat);
 	return SD_RES_SUCCESS;
 }
 
+static int local_stat_peer(const struct sd_req *req, struct sd_rsp *rsp,
+			   void *data)
+{
+	int nr = get_peer_stats(data, req->data_length /
+				sizeof(struct sd_peer_stat));
+
+	rsp->data_length = nr * sizeof(struct sd_peer_stat);
+	return SD_RES_SUCCESS;
+}
+
 /* Return SD_RES_INVALID_PARMS to ask client not to send flush req again */
 static int local_flush_vdi(struct request *req)
 {
@@ -1171,6 +1208,13 @@ static struct sd_op_template sd_ops[] = {
 		.process_main = cluster_disable_recover,
 	},
 
+	[SD_OP_SET_RECOVERY_THROTTLE] = {
+		.name = "SET_RECOVERY_THROTTLE",
+		.type = SD_OP_TYPE_CLUSTER,
+		.is_admin_op = true,
+		.process_main = cluster_set_recovery_throttle,
+	},
+
 	/* local operations */
 	[SD_OP_RELEASE_VDI] = {
 		.name = "RELEASE_VDI",
@@ -1218,6 +1262,12 @@ static struct sd_op_template sd_ops[] = {
 		.process_main = local_stat_recovery,
 	},
 
+	[SD_OP_GET_RECOVERY_THROTTLE] = {
+		.name = "GET_RECOVERY_THROTTLE",
+		.type = SD_OP_TYPE_LOCAL,
+		.process_main = local_get_recovery_throttle,
+	},
+
 	[SD_OP_STAT_CLUSTER] = {
 		.name = "STAT_CLUSTER",
 		.type = SD_OP_TYPE_LOCAL,
@@ -1335,6 +1385,12 @@ static struct sd_op_template sd_ops[] = {
 		.process_main = local_sd_stat,
 	},
 
+	[SD_OP_STAT_PEER] = {
+		.name = "STAT_PEER",
+		.type = SD_OP_TYPE_LOCAL,
+		.process_main = local_stat_peer,
+	},
+
 	[SD_OP_GET_LOGLEVEL] = {
 		.name = "GET_LOGLEVEL",
 		.type = SD_OP_TYPE_LOCAL,
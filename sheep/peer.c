@@ -0,0 +1,283 @@
+/*
+ * Copyright (C) 2013 Nippon Telegraph and Telephone Corporation.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License version
+ * 2 as published by the Free Software Foundation.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Per peer latency statistics
+ *
+ * Every request sent by sheep_exec_req() is accounted to the peer it is sent
+ * to: the number of requests in flight and an exponentially weighted moving
+ * average of the latency.  Reads of replicated objects use them to pick the
+ * replica with the shortest expected service time instead of a random one,
+ * so that a slow or recovering node doesn't drag the read tail.
+ *
+ * The entries are never freed, there is at most one per node ever seen.
+ *
+ * The latency of the remote reads is also kept in a histogram, whose
+ * percentile is how long a hedged read waits for the first replica before it
+ * asks another one.
+ */
+
+#include "sheep_priv.h"
+
+/* weight of a new sample is 1 / 2^PEER_EWMA_SHIFT */
+#define PEER_EWMA_SHIFT		3
+/* latency accounted to a failed request, at least */
+#define PEER_ERROR_PENALTY	(1000ULL * 1000 * 1000)
+/* forget a latency not updated for so long, so the peer is tried again */
+#define PEER_STALE_TIME		(10ULL * 1000 * 1000 * 1000)
+
+/* the buckets are log2 of the latency in ns, split in 8 linear sub-buckets */
+#define LAT_SUB_SHIFT		3
+#define NR_LAT_BUCKETS		(64 << LAT_SUB_SHIFT)
+/* recompute the hedge delay after so many samples */
+#define HEDGE_UPDATE_NR		64
+/* halve the histogram after so many samples, so it follows the changes */
+#define LAT_DECAY_NR		4096
+
+struct peer_stat {
+	struct rb_node rb;
+	struct node_id nid;
+	uint64_t latency; /* EWMA of the latency in ns */
+	uint64_t last; /* when the latency was last updated */
+	uint64_t nr;
+	uint64_t nr_error;
+	uint32_t inflight;
+};
+
+static struct rb_root peer_root = RB_ROOT;
+static struct sd_rw_lock peer_lock = SD_RW_LOCK_INITIALIZER;
+
+static uint32_t lat_hist[NR_LAT_BUCKETS];
+static uint32_t lat_nr;
+static struct sd_mutex lat_lock = SD_MUTEX_INITIALIZER;
+static uint64_t hedge_delay;
+
+static int peer_stat_cmp(const struct peer_stat *a, const struct peer_stat *b)
+{
+	return node_id_cmp(&a->nid, &b->nid);
+}
+
+static struct peer_stat *find_peer_stat(const struct node_id *nid)
+{
+	struct peer_stat key = { .nid = *nid };
+	struct peer_stat *ps;
+
+	sd_read_lock(&peer_lock);
+	ps = rb_search(&peer_root, &key, rb, peer_stat_cmp);
+	sd_rw_unlock(&peer_lock);
+
+	return ps;
+}
+
+static struct peer_stat *get_peer_stat(const struct node_id *nid)
+{
+	struct peer_stat *ps = find_peer_stat(nid), *old;
+
+	if (likely(ps))
+		return ps;
+
+	ps = xzalloc(sizeof(*ps));
+	ps->nid = *nid;
+	sd_write_lock(&peer_lock);
+	old = rb_insert(&peer_root, ps, rb, peer_stat_cmp);
+	sd_rw_unlock(&peer_lock);
+
+	if (old) {
+		/* somebody else inserted it first */
+		free(ps);
+		ps = old;
+	}
+
+	return ps;
+}
+
+/* Account the start of a request to the peer, return its handle */
+struct peer_stat *peer_io_start(const struct node_id *nid)
+{
+	struct peer_stat *ps = get_peer_stat(nid);
+
+	uatomic_inc(&ps->inflight);
+	return ps;
+}
+
+/* Account the completion of a request started at 'start' (in ns) */
+void peer_io_end(struct peer_stat *ps, uint64_t start, int ret)
+{
+	uint64_t now = clock_get_time(), lat = now - start, old, new;
+
+	uatomic_dec(&ps->inflight);
+	uatomic_inc(&ps->nr);
+	if (ret == SD_RES_NETWORK_ERROR) {
+		uatomic_inc(&ps->nr_error);
+		lat = max(lat, (uint64_t)PEER_ERROR_PENALTY);
+	}
+
+	do {
+		old = uatomic_read(&ps->latency);
+		if (old == 0)
+			new = lat;
+		else
+			new = old - (old >> PEER_EWMA_SHIFT) +
+				(lat >> PEER_EWMA_SHIFT);
+	} while (uatomic_cmpxchg(&ps->latency, old, new) != old);
+	uatomic_set(&ps->last, now);
+}
+
+/*
+ * Expected time for the peer to serve one more request.  Unknown and stale
+ * peers are 0 so that they get a request and a fresh sample.
+ */
+static uint64_t peer_expected_time(const struct node_id *nid, uint64_t now)
+{
+	struct peer_stat *ps = find_peer_stat(nid);
+
+	if (!ps || now - uatomic_read(&ps->last) > PEER_STALE_TIME)
+		return 0;
+
+	return uatomic_read(&ps->latency) * (uatomic_read(&ps->inflight) + 1);
+}
+
+/*
+ * Order the nodes from the best to the worst one to read from
+ *
+ * The order starts at a random node, so the nodes which look the same share
+ * the load.  With '-S random' that is the only thing done.
+ */
+void sort_peers_for_read(const struct sd_node **nodes, int nr)
+{
+	const struct sd_node *tmp[SD_MAX_COPIES];
+	uint64_t cost[SD_MAX_COPIES], now = clock_get_time();
+	int i, j, r = random();
+
+	for (i = 0; i < nr; i++)
+		tmp[i] = nodes[(i + r) % nr];
+	memcpy(nodes, tmp, sizeof(*nodes) * nr);
+
+	if (sys->random_read)
+		return;
+
+	/* stable insertion sort, nr is tiny */
+	for (i = 0; i < nr; i++) {
+		const struct sd_node *n = nodes[i];
+		uint64_t c = peer_expected_time(&n->nid, now);
+
+		for (j = i; j > 0 && cost[j - 1] > c; j--) {
+			cost[j] = cost[j - 1];
+			nodes[j] = nodes[j - 1];
+		}
+		cost[j] = c;
+		nodes[j] = n;
+	}
+}
+
+/*
+ * Copy the statistics of at most 'nr_max' peers to 'buf', return the number
+ * of copied ones
+ */
+int get_peer_stats(struct sd_peer_stat *buf, int nr_max)
+{
+	struct peer_stat *ps;
+	int nr = 0;
+
+	sd_read_lock(&peer_lock);
+	rb_for_each_entry(ps, &peer_root, rb) {
+		if (nr == nr_max)
+			break;
+		buf[nr].nid = ps->nid;
+		buf[nr].latency = uatomic_read(&ps->latency);
+		buf[nr].nr = uatomic_read(&ps->nr);
+		buf[nr].nr_error = uatomic_read(&ps->nr_error);
+		buf[nr].inflight = uatomic_read(&ps->inflight);
+		nr++;
+	}
+	sd_rw_unlock(&peer_lock);
+
+	return nr;
+}
+
+static int lat_bucket(uint64_t ns)
+{
+	int msb;
+
+	if (ns < (1 << LAT_SUB_SHIFT))
+		return ns;
+
+	msb = 63 - __builtin_clzll(ns);
+	return ((msb - LAT_SUB_SHIFT + 1) << LAT_SUB_SHIFT) +
+		((ns >> (msb - LAT_SUB_SHIFT)) & ((1 << LAT_SUB_SHIFT) - 1));
+}
+
+/* The upper bound of the latencies in the bucket */
+static uint64_t lat_bucket_max(int b)
+{
+	int shift;
+
+	if (b < (1 << LAT_SUB_SHIFT))
+		return b + 1;
+
+	shift = (b >> LAT_SUB_SHIFT) - 1;
+	return ((uint64_t)(b & ((1 << LAT_SUB_SHIFT) - 1)) +
+		(1 << LAT_SUB_SHIFT) + 1) << shift;
+}
+
+/* Called with lat_lock held, racing with the updates is harmless */
+static void update_hedge_delay(bool decay)
+{
+	uint64_t total = 0, sum = 0, target;
+	int b;
+
+	for (b = 0; b < NR_LAT_BUCKETS; b++)
+		total += uatomic_read(&lat_hist[b]);
+	target = total * sys->hedge_percentile / 100;
+	for (b = 0; b < NR_LAT_BUCKETS - 1; b++) {
+		sum += uatomic_read(&lat_hist[b]);
+		if (sum > target)
+			break;
+	}
+	uatomic_set(&hedge_delay, lat_bucket_max(b));
+
+	if (!decay)
+		return;
+	for (b = 0; b < NR_LAT_BUCKETS; b++)
+		uatomic_set(&lat_hist[b], uatomic_read(&lat_hist[b]) / 2);
+	uatomic_set(&lat_nr, 0);
+}
+
+/* Account the latency of a successful remote read */
+void account_read_latency(uint64_t ns)
+{
+	uint32_t nr;
+
+	if (!sys->hedge_percentile)
+		return;
+
+	uatomic_inc(&lat_hist[lat_bucket(ns)]);
+	nr = uatomic_add_return(&lat_nr, 1);
+	if (nr % HEDGE_UPDATE_NR)
+		return;
+
+	if (sd_mutex_trylock(&lat_lock) == EBUSY)
+		return;
+	update_hedge_delay(nr >= LAT_DECAY_NR);
+	sd_mutex_unlock(&lat_lock);
+}
+
+/*
+ * How long a read waits for the first replica before asking another one, 0
+ * if reads are not hedged or there are not enough samples yet
+ */
+uint64_t read_hedge_delay(void)
+{
+	if (!sys->hedge_percentile)
+		return 0;
+
+	return uatomic_read(&hedge_delay);
+}
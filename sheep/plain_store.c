@@ -12,9 +12,21 @@
 #include <libgen.h>
 
 #include "sheep_priv.h"
+#include "uring.h"
 
 #define sector_algined(x) ({ ((x) & (SECTOR_SIZE - 1)) == 0; })
 
+/*
+ * The uring store runs the object I/O through the io_uring of the worker.  A
+ * large read or write is split into segments of at least URING_SEG_SIZE which
+ * run in parallel, and a synchronous write is followed by one fdatasync()
+ * rather than written with O_DSYNC.
+ */
+#define URING_SEG_SIZE	(1024 * 1024)
+#define URING_MAX_SEGS	8
+
+static bool use_uring;
+
 static inline bool iocb_is_aligned(const struct siocb *iocb)
 {
 	return  sector_algined(iocb->offset) && sector_algined(iocb->length);
@@ -39,6 +51,88 @@ static int prepare_iocb(uint64_t oid, const struct siocb *iocb, bool create)
 	return flags;
 }
 
+/*
+ * With io_uring, clear O_DSYNC from 'flags' and return true if the write has
+ * to be synced with fdatasync() instead
+ */
+static bool uring_sync(int *flags)
+{
+	if (!use_uring || !(*flags & O_DSYNC))
+		return false;
+
+	*flags &= ~O_DSYNC;
+	return true;
+}
+
+static ssize_t uring_rw(int fd, void *buf, size_t count, off_t offset,
+			bool write, bool sync)
+{
+	struct uring_io ios[URING_MAX_SEGS + 1];
+	size_t seg = URING_SEG_SIZE, done;
+	ssize_t total = 0;
+	int nr = 0;
+
+	while (count > seg * URING_MAX_SEGS)
+		seg *= 2;
+	for (done = 0; done < count; done += seg, nr++) {
+		ios[nr] = (struct uring_io) {
+			.op = write ? URING_WRITE : URING_READ,
+			.fd = fd,
+			.buf = (char *)buf + done,
+			.len = min(count - done, seg),
+			.offset = offset + done,
+		};
+	}
+	if (sync)
+		ios[nr] = (struct uring_io) {
+			.op = URING_FDATASYNC,
+			.flags = URING_BARRIER,
+			.fd = fd,
+		};
+
+	if (uring_exec(ios, nr + sync) < 0)
+		return -1;
+
+	/* up to the first short segment, at the end of the file */
+	for (int i = 0; i < nr; i++) {
+		total += ios[i].ret;
+		if (ios[i].ret < ios[i].len)
+			break;
+	}
+	return total;
+}
+
+static ssize_t store_pread(int fd, void *buf, size_t count, off_t offset)
+{
+	ssize_t ret;
+
+	if (use_uring) {
+		ret = uring_rw(fd, buf, count, offset, false, false);
+		/* ENOSYS if this thread couldn't set up or lost its ring */
+		if (ret >= 0 || errno != ENOSYS)
+			return ret;
+	}
+
+	return xpread(fd, buf, count, offset);
+}
+
+static ssize_t store_pwrite(int fd, void *buf, size_t count, off_t offset,
+			    bool sync)
+{
+	ssize_t ret;
+
+	if (use_uring) {
+		ret = uring_rw(fd, buf, count, offset, true, sync);
+		if (ret >= 0 || errno != ENOSYS)
+			return ret;
+	}
+
+	ret = xpwrite(fd, buf, count, offset);
+	if (ret >= 0 && sync && fdatasync(fd) < 0)
+		return -1;
+	return ret;
+}
+
 int get_store_path(uint64_t oid, uint8_t ec_index, char *path)
 {
 	if (is_erasure_oid(oid)) {
@@ -116,12 +210,46 @@ static int err_to_sderr(const char *path, uint64_t oid, int err)
 	}
 }
 
+/*
+ * Get the descriptor of the object in the working directory.  On a cache miss
+ * we open the file the slow way and hand it over to the fd cache.
+ */
+static int get_object_fd(uint64_t oid, uint8_t ec_index, int flags,
+			 struct fd_cache_entry **entry)
+{
+	char path[PATH_MAX];
+	uint64_t gen;
+	int fd;
+
+	*entry = fd_cache_get(oid, ec_index, flags, &gen);
+	if (*entry)
+		return SD_RES_SUCCESS;
+
+	get_store_path(oid, ec_index, path);
+
+	/*
+	 * Make sure oid is in the right place because oid might be misplaced
+	 * in a wrong place, due to 'shutdown/restart with less/more disks' or
+	 * any bugs. We need call err_to_sderr() to return EIO if disk is broken
+	 */
+	if (!default_exist(oid, ec_index))
+		return err_to_sderr(path, oid, ENOENT);
+
+	fd = open(path, flags, sd_def_fmode);
+	if (unlikely(fd < 0))
+		return err_to_sderr(path, oid, errno);
+
+	*entry = fd_cache_add(oid, ec_index, flags, fd, gen);
+	return SD_RES_SUCCESS;
+}
+
 int default_write(uint64_t oid, const struct siocb *iocb)
 {
-	int flags = prepare_iocb(oid, iocb, false), fd,
-	    ret = SD_RES_SUCCESS;
+	int flags = prepare_iocb(oid, iocb, false), ret;
+	struct fd_cache_entry *entry;
 	char path[PATH_MAX];
 	ssize_t size;
+	bool dsync;
 
 	if (iocb->epoch < sys_epoch()) {
 		sd_debug("%"PRIu32" sys %"PRIu32, iocb->epoch, sys_epoch());
@@ -135,33 +263,28 @@ int default_write(uint64_t oid, const struct siocb *iocb)
 		sd_err("turn off journaling");
 		uatomic_set_false(&sys->use_journal);
 		flags |= O_DSYNC;
-		sync();
+		if (md_sync_disks() != SD_RES_SUCCESS)
+			sync();
 	}
+	dsync = uring_sync(&flags);
 
-	get_store_path(oid, iocb->ec_index, path);
-
-	/*
-	 * Make sure oid is in the right place because oid might be misplaced
-	 * in a wrong place, due to 'shutdown/restart with less/more disks' or
-	 * any bugs. We need call err_to_sderr() to return EIO if disk is broken
-	 */
-	if (!default_exist(oid, iocb->ec_index))
-		return err_to_sderr(path, oid, ENOENT);
-
-	fd = open(path, flags, sd_def_fmode);
-	if (unlikely(fd < 0))
-		return err_to_sderr(path, oid, errno);
+	ret = get_object_fd(oid, iocb->ec_index, flags, &entry);
+	if (ret != SD_RES_SUCCESS)
+		return ret;
 
-	size = xpwrite(fd, iocb->buf, iocb->length, iocb->offset);
+	size = store_pwrite(fd_cache_fd(entry), iocb->buf, iocb->length,
+			    iocb->offset, dsync);
 	if (unlikely(size != iocb->length)) {
+		int err = errno;
+
+		get_store_path(oid, iocb->ec_index, path);
 		sd_err("failed to write object %"PRIx64", path=%s, offset=%"
 		       PRId32", size=%"PRId32", result=%zd, %m", oid, path,
 		       iocb->offset, iocb->length, size);
-		ret = err_to_sderr(path, oid, errno);
-		goto out;
+		fd_cache_del(oid, iocb->ec_index);
+		ret = err_to_sderr(path, oid, err);
 	}
-out:
-	close(fd);
+	fd_cache_put(entry);
 	return ret;
 }
 
@@ -253,6 +376,7 @@ int default_init(void)
 	int ret;
 
 	sd_debug("use plain store driver");
+	fd_cache_init();
 	ret = for_each_obj_path(make_stale_dir);
 	if (ret != SD_RES_SUCCESS)
 		return ret;
@@ -279,11 +403,12 @@ static int default_read_from_path(uint64_t oid, const char *path,
 	if (!is_stale_path(path) && !default_exist(oid, iocb->ec_index))
 		return err_to_sderr(path, oid, ENOENT);
 
+	uring_sync(&flags);
 	fd = open(path, flags);
 	if (fd < 0)
 		return err_to_sderr(path, oid, errno);
 
-	size = xpread(fd, iocb->buf, iocb->length, iocb->offset);
+	size = store_pread(fd, iocb->buf, iocb->length, iocb->offset);
 	if (unlikely(size != iocb->length)) {
 		sd_err("failed to read object %"PRIx64", path=%s, offset=%"
 		       PRId32", size=%"PRId32", result=%zd, %m", oid, path,
@@ -294,13 +419,41 @@ static int default_read_from_path(uint64_t oid, const char *path,
 	return ret;
 }
 
+static int default_read_from_wd(uint64_t oid, const struct siocb *iocb)
+{
+	int flags = prepare_iocb(oid, iocb, false), ret;
+	struct fd_cache_entry *entry;
+	char path[PATH_MAX];
+	ssize_t size;
+
+	/* share the descriptors with the writes */
+	uring_sync(&flags);
+	ret = get_object_fd(oid, iocb->ec_index, flags, &entry);
+	if (ret != SD_RES_SUCCESS)
+		return ret;
+
+	size = store_pread(fd_cache_fd(entry), iocb->buf, iocb->length,
+			   iocb->offset);
+	if (unlikely(size != iocb->length)) {
+		int err = errno;
+
+		get_store_path(oid, iocb->ec_index, path);
+		sd_err("failed to read object %"PRIx64", path=%s, offset=%"
+		       PRId32", size=%"PRId32", result=%zd, %m", oid, path,
+		       iocb->offset, iocb->length, size);
+		fd_cache_del(oid, iocb->ec_index);
+		ret = err_to_sderr(path, oid, err);
+	}
+	fd_cache_put(entry);
+	return ret;
+}
+
 int default_read(uint64_t oid, const struct siocb *iocb)
 {
 	int ret;
 	char path[PATH_MAX];
 
-	get_store_path(oid, iocb->ec_index, path);
-	ret = default_read_from_path(oid, path, iocb);
+	ret = default_read_from_wd(oid, iocb);
 
 	/*
 	 * If the request is againt the older epoch, try to read from
@@ -349,6 +502,7 @@ int default_create_and_write(uint64_t oid, const struct siocb *iocb)
 	int ret, fd;
 	uint32_t len = iocb->length;
 	size_t obj_size;
+	bool dsync;
 
 	sd_debug("%"PRIx64, oid);
 	get_store_path(oid, iocb->ec_index, path);
@@ -361,8 +515,10 @@ int default_create_and_write(uint64_t oid, const struct siocb *iocb)
 		sd_err("turn off journaling");
 		uatomic_set_false(&sys->use_journal);
 		flags |= O_DSYNC;
-		sync();
+		if (md_sync_disks() != SD_RES_SUCCESS)
+			sync();
 	}
+	dsync = uring_sync(&flags);
 
 	fd = open(tmp_path, flags, sd_def_fmode);
 	if (fd < 0) {
@@ -389,7 +545,7 @@ int default_create_and_write(uint64_t oid, const struct siocb *iocb)
 		goto out;
 	}
 
-	ret = xpwrite(fd, iocb->buf, len, iocb->offset);
+	ret = store_pwrite(fd, iocb->buf, len, iocb->offset, dsync);
 	if (ret != len) {
 		sd_err("failed to write object. %m");
 		ret = err_to_sderr(path, oid, errno);
@@ -403,6 +559,8 @@ int default_create_and_write(uint64_t oid, const struct siocb *iocb)
 		goto out;
 	}
 
+	/* Nobody should have the object open, but be careful */
+	fd_cache_del(oid, iocb->ec_index);
 	ret = SD_RES_SUCCESS;
 	objlist_cache_insert(oid);
 out:
@@ -434,6 +592,7 @@ int default_link(uint64_t oid, uint32_t tgt_epoch)
 		return err_to_sderr(path, oid, errno);
 	}
 out:
+	fd_cache_del(oid, 0);
 	return SD_RES_SUCCESS;
 }
 
@@ -455,7 +614,7 @@ static bool oid_stale(uint64_t oid, int ec_index)
 	vinfo = get_vnode_info();
 
 	nr_copies = get_obj_copy_number(oid, vinfo->nr_zones);
-	oid_to_vnodes(oid, &vinfo->vroot, nr_copies, obj_vnodes);
+	ring_oid_to_vnodes(oid, &vinfo->ring, nr_copies, obj_vnodes);
 	for (i = 0; i < nr_copies; i++) {
 		v = obj_vnodes[i];
 		if (vnode_is_local(v)) {
@@ -498,6 +657,7 @@ static int move_object_to_stale_dir(uint64_t oid, const char *wd,
 		       path);
 		return SD_RES_EIO;
 	}
+	fd_cache_del(oid, ec_index);
 
 	sd_debug("moved object %"PRIx64, oid);
 	return SD_RES_SUCCESS;
@@ -524,6 +684,7 @@ int default_format(void)
 
 	sd_debug("try get a clean store");
 	ret = for_each_obj_path(purge_dir);
+	fd_cache_purge();
 	if (ret != SD_RES_SUCCESS)
 		return ret;
 
@@ -549,6 +710,7 @@ int default_remove_object(uint64_t oid, uint8_t ec_index)
 		sd_err("failed, %s, %m", path);
 		return SD_RES_EIO;
 	}
+	fd_cache_del(oid, ec_index);
 
 	return SD_RES_SUCCESS;
 }
@@ -655,9 +817,15 @@ int default_purge_obj(void)
 				     &tgt_epoch);
 }
 
+static int plain_init(void)
+{
+	use_uring = false;
+	return default_init();
+}
+
 static struct store_driver plain_store = {
 	.name = "plain",
-	.init = default_init,
+	.init = plain_init,
 	.exist = default_exist,
 	.create_and_write = default_create_and_write,
 	.write = default_write,
@@ -672,3 +840,29 @@ static struct store_driver plain_store = {
 };
 
 add_store_driver(plain_store);
+
+static int uring_init(void)
+{
+	use_uring = uring_supported();
+	if (!use_uring)
+		sd_warn("io_uring is not available, use the plain I/O");
+	return default_init();
+}
+
+static struct store_driver uring_store = {
+	.name = "uring",
+	.init = uring_init,
+	.exist = default_exist,
+	.create_and_write = default_create_and_write,
+	.write = default_write,
+	.read = default_read,
+	.link = default_link,
+	.update_epoch = default_update_epoch,
+	.cleanup = default_cleanup,
+	.format = default_format,
+	.remove_object = default_remove_object,
+	.get_hash = default_get_hash,
+	.purge_obj = default_purge_obj,
+};
+
+add_store_driver(uring_store);
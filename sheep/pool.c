@@ -0,0 +1,301 @@
+/*
+ * Copyright (C) 2013 Nippon Telegraph and Telephone Corporation.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License version
+ * 2 as published by the Free Software Foundation.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Pooled allocation of requests and their data buffers
+ *
+ * Every client request used to allocate its struct request and a fresh
+ * page aligned data buffer, and free both when the response was sent.  For
+ * 4MB writes that means page faulting fresh memory on every request.
+ *
+ * Requests and data buffers are now recycled through pools.  The data buffers
+ * are grouped by power of two size classes from 4KB up to SD_DATA_OBJ_SIZE;
+ * larger ones are not pooled.  Every data buffer is preceded by a page which
+ * records its pool, so that it goes back to the right one whatever its user
+ * did with the length.  Each thread keeps a small cache of free objects per
+ * pool, so the common case takes no lock.  Requests are allocated by the rx
+ * workers and freed by the main thread, so the caches exchange objects in
+ * batches with shared depots.  The depots together are bounded by a part of
+ * the memory, and the objects which stay unused there for a reap interval
+ * are freed.
+ */
+
+#include "sheep_priv.h"
+
+#define POOL_CACHE_MAX		16
+#define POOL_CACHE_BYTES	(1024 * 1024)		/* per pool per thread */
+#define POOL_DEPOT_BYTES	(128 * 1024 * 1024)	/* all the depots */
+#define POOL_DEPOT_MEM_SHIFT	7	/* nor more than 1/128 of the memory */
+#define POOL_REAP_INTERVAL	5000	/* ms */
+#define POOL_MIN_SHIFT		12
+#define POOL_MAX_SHIFT		22
+#define NR_BUF_POOLS		(POOL_MAX_SHIFT - POOL_MIN_SHIFT + 1)
+#define REQ_POOL		NR_BUF_POOLS
+#define NR_POOLS		(NR_BUF_POOLS + 1)
+
+struct pool {
+	size_t size;
+	int cache_max;
+	int depot_max;
+
+	struct sd_mutex lock;
+	int nr_depot;
+	int depot_low; /* the fewest objects in the depot since the last reap */
+	void **depot;
+
+	uint64_t *hit;
+	uint64_t *miss;
+};
+
+struct pool_cache {
+	int nr;
+	void *objs[POOL_CACHE_MAX];
+};
+
+struct buf_hdr {
+	struct pool *pool; /* NULL if the buffer isn't pooled */
+};
+
+static struct pool pools[NR_POOLS];
+static __thread struct pool_cache *thread_caches;
+static pthread_key_t cache_key;
+static size_t page_size;
+static long depot_bytes, depot_limit;
+
+static void *new_buffer(struct pool *pool, size_t len)
+{
+	struct buf_hdr *hdr = valloc(page_size + len);
+
+	if (!hdr)
+		return NULL;
+	hdr->pool = pool;
+	return (char *)hdr + page_size;
+}
+
+static inline struct buf_hdr *buf_to_hdr(void *buf)
+{
+	return (struct buf_hdr *)((char *)buf - page_size);
+}
+
+static void *pool_new_obj(struct pool *pool)
+{
+	if (pool - pools == REQ_POOL)
+		return malloc(pool->size);
+	return new_buffer(pool, pool->size);
+}
+
+static void pool_free_obj(struct pool *pool, void *obj)
+{
+	if (pool - pools == REQ_POOL)
+		free(obj);
+	else
+		free(buf_to_hdr(obj));
+}
+
+/* Move objects from the cache to the depot, freeing what doesn't fit */
+static void pool_drain(struct pool *pool, struct pool_cache *cache, int nr)
+{
+	sd_mutex_lock(&pool->lock);
+	for (; nr > 0 && pool->nr_depot < pool->depot_max; nr--) {
+		if (uatomic_add_return(&depot_bytes, pool->size) >
+		    depot_limit) {
+			uatomic_sub(&depot_bytes, pool->size);
+			break;
+		}
+		pool->depot[pool->nr_depot++] = cache->objs[--cache->nr];
+	}
+	sd_mutex_unlock(&pool->lock);
+
+	for (; nr > 0; nr--)
+		pool_free_obj(pool, cache->objs[--cache->nr]);
+}
+
+/* Flush the caches of an exiting thread so that the objects aren't lost */
+static void pool_thread_exit(void *arg)
+{
+	struct pool_cache *caches = arg;
+
+	for (int i = 0; i < NR_POOLS; i++)
+		pool_drain(pools + i, caches + i, caches[i].nr);
+	free(caches);
+}
+
+static struct pool_cache *get_cache(struct pool *pool)
+{
+	if (unlikely(!thread_caches)) {
+		thread_caches = xzalloc(sizeof(*thread_caches) * NR_POOLS);
+		pthread_setspecific(cache_key, thread_caches);
+	}
+
+	return thread_caches + (pool - pools);
+}
+
+static void *pool_alloc(struct pool *pool)
+{
+	struct pool_cache *cache = get_cache(pool);
+
+	if (cache->nr == 0) {
+		/* refill half of the cache from the depot */
+		sd_mutex_lock(&pool->lock);
+		while (cache->nr < DIV_ROUND_UP(pool->cache_max, 2) &&
+		       pool->nr_depot > 0) {
+			cache->objs[cache->nr++] =
+				pool->depot[--pool->nr_depot];
+			uatomic_sub(&depot_bytes, pool->size);
+		}
+		pool->depot_low = min(pool->depot_low, pool->nr_depot);
+		sd_mutex_unlock(&pool->lock);
+	}
+
+	if (cache->nr == 0) {
+		uatomic_inc(pool->miss);
+		return pool_new_obj(pool);
+	}
+
+	uatomic_inc(pool->hit);
+	return cache->objs[--cache->nr];
+}
+
+static void pool_free(struct pool *pool, void *obj)
+{
+	struct pool_cache *cache = get_cache(pool);
+
+	if (cache->nr == pool->cache_max)
+		pool_drain(pool, cache, DIV_ROUND_UP(pool->cache_max, 2));
+	cache->objs[cache->nr++] = obj;
+}
+
+static struct pool *buf_pool(size_t len)
+{
+	int shift = POOL_MIN_SHIFT;
+
+	if (len > (1UL << POOL_MAX_SHIFT))
+		return NULL;
+	while ((1UL << shift) < len)
+		shift++;
+
+	return pools + shift - POOL_MIN_SHIFT;
+}
+
+/* Return a page aligned buffer of at least 'len' bytes, or NULL */
+void *alloc_data_buffer(size_t len)
+{
+	struct pool *pool = buf_pool(len);
+
+	if (pool)
+		return pool_alloc(pool);
+
+	uatomic_inc(&sys->stat.p.buf_miss);
+	return new_buffer(NULL, len);
+}
+
+void free_data_buffer(void *buf)
+{
+	struct buf_hdr *hdr;
+
+	if (!buf)
+		return;
+
+	hdr = buf_to_hdr(buf);
+	if (hdr->pool)
+		pool_free(hdr->pool, buf);
+	else
+		free(hdr);
+}
+
+struct request *alloc_request_struct(void)
+{
+	struct request *req = pool_alloc(pools + REQ_POOL);
+
+	if (req)
+		memset(req, 0, sizeof(*req));
+	return req;
+}
+
+void free_request_struct(struct request *req)
+{
+	pool_free(pools + REQ_POOL, req);
+}
+
+/*
+ * The objects under depot_low have stayed in the depot since the last reap,
+ * since the depot is used as a stack.  Free them.
+ */
+static void pool_reap(struct pool *pool)
+{
+	int nr;
+
+	sd_mutex_lock(&pool->lock);
+	nr = pool->depot_low;
+	for (int i = 0; i < nr; i++)
+		pool_free_obj(pool, pool->depot[i]);
+	memmove(pool->depot, pool->depot + nr,
+		sizeof(*pool->depot) * (pool->nr_depot - nr));
+	pool->nr_depot -= nr;
+	pool->depot_low = pool->nr_depot;
+	sd_mutex_unlock(&pool->lock);
+
+	uatomic_sub(&depot_bytes, nr * pool->size);
+}
+
+static void reap_timer_handler(void *data);
+
+static struct timer reap_timer = {
+	.callback = reap_timer_handler,
+};
+
+static void reap_timer_handler(void *data)
+{
+	for (int i = 0; i < NR_POOLS; i++)
+		pool_reap(pools + i);
+
+	add_timer(&reap_timer, POOL_REAP_INTERVAL);
+}
+
+void pool_init(void)
+{
+	add_timer(&reap_timer, POOL_REAP_INTERVAL);
+}
+
+static void init_pool(struct pool *pool, size_t size, uint64_t *hit,
+		      uint64_t *miss)
+{
+	pool->size = size;
+	pool->cache_max = POOL_CACHE_BYTES / size;
+	pool->cache_max = max(pool->cache_max, 1);
+	pool->cache_max = min(pool->cache_max, POOL_CACHE_MAX);
+	pool->depot_max = depot_limit / size;
+	pool->depot_max = max(pool->depot_max, pool->cache_max);
+	pool->depot_max = min(pool->depot_max, 1024);
+	pool->depot = xzalloc(sizeof(*pool->depot) * pool->depot_max);
+	sd_init_mutex(&pool->lock);
+	pool->hit = hit;
+	pool->miss = miss;
+}
+
+static void __attribute__((constructor)) init_pools(void)
+{
+	long mem = sysconf(_SC_PHYS_PAGES) * sysconf(_SC_PAGESIZE);
+
+	page_size = getpagesize();
+	depot_limit = POOL_DEPOT_BYTES;
+	if (mem > 0)
+		depot_limit = min(depot_limit, mem >> POOL_DEPOT_MEM_SHIFT);
+
+	for (int i = 0; i < NR_BUF_POOLS; i++)
+		init_pool(pools + i, 1UL << (POOL_MIN_SHIFT + i),
+			  &sys->stat.p.buf_hit, &sys->stat.p.buf_miss);
+	init_pool(pools + REQ_POOL, sizeof(struct request),
+		  &sys->stat.p.req_hit, &sys->stat.p.req_miss);
+
+	if (pthread_key_create(&cache_key, pool_thread_exit) != 0)
+		panic("failed to create a pthread key, %m");
+}
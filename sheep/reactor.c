@@ -0,0 +1,609 @@
+/*
+ * Copyright (C) 2013 Nippon Telegraph and Telephone Corporation.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License version
+ * 2 as published by the Free Software Foundation.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Client networking reactors
+ *
+ * The main thread used to watch all the client sockets and bounce every
+ * request header read and every response write to the net work queue and
+ * back, so a request took four thread switches besides its I/O.
+ *
+ * Now the accepted connections are spread over a few reactor threads, each
+ * with its own epoll set.  A reactor reads the requests with non-blocking
+ * calls, hands the complete ones over to the main thread in batches, which
+ * queues them as before, and writes the responses inline, all the ready ones
+ * of a client with a single sendmsg().  The responses come from any thread
+ * through reactor_send_response().
+ *
+ * A client is only touched by its reactor, but for its refcnt, which counts
+ * its requests.  A dead client is closed right away and freed when the last
+ * of its requests comes back.
+ */
+
+#include <sys/eventfd.h>
+
+#include "sheep_priv.h"
+
+#define NR_REACTORS_MAX		8
+#define NR_REACTOR_EVENTS	128
+/* requests read from a client in a row before serving the others */
+#define RX_BATCH		16
+
+struct reactor {
+	int efd;
+	int wake_fd;
+
+	struct sd_mutex lock;
+	struct list_head new_list;	/* the accepted clients */
+	struct list_head tx_list;	/* the responses to send */
+
+	struct iovec iov[IOV_MAX];	/* for client_tx() */
+};
+
+static struct reactor reactors[NR_REACTORS_MAX];
+static int nr_reactors;
+static uint32_t next_reactor;
+
+/* the complete requests, for the main thread */
+static int rx_fd;
+static struct sd_mutex rx_lock = SD_MUTEX_INITIALIZER;
+static LIST_HEAD(rx_list);
+
+static struct request *alloc_request(struct client_info *ci, int data_length)
+{
+	struct request *req;
+
+	req = alloc_request_struct();
+	if (!req)
+		return NULL;
+
+	req->ci = ci;
+	refcount_inc(&ci->refcnt);
+	if (data_length) {
+		req->data_length = data_length;
+		req->data = alloc_data_buffer(data_length);
+		if (!req->data) {
+			refcount_dec(&ci->refcnt);
+			free_request_struct(req);
+			return NULL;
+		}
+	}
+
+	refcount_set(&req->refcnt, 1);
+
+	uatomic_inc(&sys->nr_outstanding_reqs);
+
+	return req;
+}
+
+static void free_request(struct request *req)
+{
+	/* the main thread waits for the last request before it exits */
+	if (uatomic_sub_return(&sys->nr_outstanding_reqs, 1) == 0)
+		eventfd_xwrite(rx_fd, 1);
+
+	refcount_dec(&req->ci->refcnt);
+	put_vnode_info(req->vinfo);
+	free_data_buffer(req->data);
+	free_request_struct(req);
+}
+
+static void client_try_free(struct client_info *ci)
+{
+	if (ci->conn.dead && refcount_read(&ci->refcnt) == 0) {
+		sd_debug("free %s:%d", ci->conn.ipstr, ci->conn.port);
+		free(ci);
+	}
+}
+
+/* Close the connection, 'ci' may be freed */
+static void client_close(struct client_info *ci)
+{
+	struct request *req;
+
+	sd_debug("connection from: %s:%d", ci->conn.ipstr, ci->conn.port);
+
+	ci->conn.dead = true;
+	epoll_ctl(ci->reactor->efd, EPOLL_CTL_DEL, ci->conn.fd, NULL);
+	close(ci->conn.fd);
+
+	if (ci->rx_req) {
+		free_request(ci->rx_req);
+		ci->rx_req = NULL;
+	}
+	list_for_each_entry(req, &ci->tx_list, request_list) {
+		list_del(&req->request_list);
+		free_request(req);
+	}
+
+	client_try_free(ci);
+}
+
+static int client_update_events(struct client_info *ci)
+{
+	struct epoll_event ev = {
+		.events = EPOLLIN,
+		.data.ptr = ci,
+	};
+
+	if (!list_empty(&ci->tx_list))
+		ev.events |= EPOLLOUT;
+	if (ev.events == ci->conn.events)
+		return 0;
+
+	if (epoll_ctl(ci->reactor->efd, ci->conn.events ? EPOLL_CTL_MOD :
+		      EPOLL_CTL_ADD, ci->conn.fd, &ev) < 0) {
+		sd_err("failed to update the events of %d, %m", ci->conn.fd);
+		return -1;
+	}
+	ci->conn.events = ev.events;
+
+	return 0;
+}
+
+/*
+ * Transfer as much as the socket takes without blocking
+ *
+ * Return the nr of bytes transferred, 0 if the socket would block, or -1 on
+ * error.
+ */
+static ssize_t client_xfer(struct client_info *ci, struct iovec *iov,
+			   int iovcnt, bool out)
+{
+	struct msghdr msg = {
+		.msg_iov = iov,
+		.msg_iovlen = iovcnt,
+	};
+	ssize_t ret;
+
+again:
+	if (out)
+		ret = sendmsg(ci->conn.fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+	else
+		ret = recvmsg(ci->conn.fd, &msg, MSG_DONTWAIT);
+	if (ret < 0) {
+		if (errno == EINTR)
+			goto again;
+		if (errno == EAGAIN)
+			return 0;
+		sd_debug("failed to %s, %m", out ? "send" : "receive");
+		return -1;
+	}
+	if (ret == 0 && !out) {
+		sd_debug("the client closed the connection");
+		return -1;
+	}
+
+	return ret;
+}
+
+/* Receive into 'buf' until ci->rx_len reaches 'len', return 1 when done */
+static int client_recv(struct client_info *ci, void *buf, size_t len)
+{
+	while (ci->rx_len < len) {
+		struct iovec iov = {
+			.iov_base = (char *)buf + ci->rx_len,
+			.iov_len = len - ci->rx_len,
+		};
+		ssize_t ret = client_xfer(ci, &iov, 1, false);
+
+		if (ret <= 0)
+			return ret;
+		ci->rx_len += ret;
+	}
+
+	return 1;
+}
+
+/*
+ * Receive a request, return 1 with the request in '*reqp' when it is
+ * complete, 0 if the socket would block, or -1 on error
+ */
+static int client_rx(struct client_info *ci, struct request **reqp)
+{
+	struct request *req = ci->rx_req;
+	int ret;
+
+	if (!req) {
+		ret = client_recv(ci, &ci->rx_hdr, sizeof(ci->rx_hdr));
+		if (ret <= 0)
+			return ret;
+
+		req = alloc_request(ci, ci->rx_hdr.data_length);
+		if (!req) {
+			sd_err("failed to allocate request");
+			return -1;
+		}
+		/* use le_to_cpu */
+		memcpy(&req->rq, &ci->rx_hdr, sizeof(req->rq));
+		ci->rx_req = req;
+		ci->rx_len = 0;
+	}
+
+	if (req->rq.data_length && req->rq.flags & SD_FLAG_CMD_WRITE) {
+		ret = client_recv(ci, req->data, req->rq.data_length);
+		if (ret <= 0)
+			return ret;
+	}
+
+	ci->rx_req = NULL;
+	ci->rx_len = 0;
+	*reqp = req;
+
+	return 1;
+}
+
+static void client_tx_done(struct client_info *ci, struct request *req)
+{
+	if (is_logging_op(req->op)) {
+		sd_info("req=%p, fd=%d, client=%s:%d, op=%s, result=%02X",
+			req, ci->conn.fd, ci->conn.ipstr, ci->conn.port,
+			op_name(req->op), req->rp.result);
+	} else {
+		sd_debug("%d, %s:%d", ci->conn.fd, ci->conn.ipstr,
+			 ci->conn.port);
+	}
+
+	list_del(&req->request_list);
+	free_request(req);
+}
+
+static size_t rsp_len(const struct request *req)
+{
+	return sizeof(req->rp) + req->rp.data_length;
+}
+
+/* Add 'buf' to 'iov' past the '*skip' bytes already sent */
+static int add_iov(struct iovec *iov, int nr, void *buf, size_t len,
+		   size_t *skip)
+{
+	if (*skip >= len) {
+		*skip -= len;
+		return nr;
+	}
+
+	iov[nr].iov_base = (char *)buf + *skip;
+	iov[nr].iov_len = len - *skip;
+	*skip = 0;
+
+	return nr + 1;
+}
+
+/*
+ * Send the queued responses, return -1 on error
+ *
+ * As many responses as IOV_MAX allows go out with one sendmsg(), the first
+ * one starting past the ci->tx_off bytes sent already.
+ */
+static int client_tx(struct client_info *ci)
+{
+	struct iovec *iov = ci->reactor->iov;
+
+	while (!list_empty(&ci->tx_list)) {
+		struct request *req;
+		size_t skip = ci->tx_off, len = 0;
+		int nr = 0, nr_done = 0;
+		ssize_t ret;
+
+		list_for_each_entry(req, &ci->tx_list, request_list) {
+			if (nr + 2 > IOV_MAX)
+				break;
+			nr = add_iov(iov, nr, &req->rp, sizeof(req->rp), &skip);
+			if (req->rp.data_length)
+				nr = add_iov(iov, nr, req->data,
+					     req->rp.data_length, &skip);
+			len += rsp_len(req);
+		}
+		len -= ci->tx_off;
+
+		ret = client_xfer(ci, iov, nr, true);
+		if (ret <= 0) {
+			if (ret < 0)
+				sd_err("failed to send a response");
+			return ret;
+		}
+
+		ci->tx_off += ret;
+		list_for_each_entry(req, &ci->tx_list, request_list) {
+			if (ci->tx_off < rsp_len(req))
+				break;
+			ci->tx_off -= rsp_len(req);
+			client_tx_done(ci, req);
+			nr_done++;
+		}
+		if (nr_done) {
+			uatomic_inc(&sys->stat.r.gway_tx_batch_nr);
+			uatomic_add(&sys->stat.r.gway_tx_rsp_nr, nr_done);
+		}
+
+		/* the socket is full, wait for EPOLLOUT */
+		if (ret < len)
+			break;
+	}
+
+	return 0;
+}
+
+static void client_handle(struct client_info *ci, uint32_t events,
+			  struct list_head *ready)
+{
+	struct request *req;
+	int i, ret;
+
+	if (events & EPOLLOUT && client_tx(ci) < 0)
+		goto err;
+
+	if (events & EPOLLIN) {
+		for (i = 0; i < RX_BATCH; i++) {
+			ret = client_rx(ci, &req);
+			if (ret < 0)
+				goto err;
+			if (ret == 0)
+				break;
+			list_add_tail(&req->request_list, ready);
+		}
+	} else if (events & (EPOLLERR | EPOLLHUP))
+		goto err;
+
+	if (client_update_events(ci) < 0)
+		goto err;
+	return;
+err:
+	client_close(ci);
+}
+
+static void reactor_add_clients(struct list_head *new_list)
+{
+	struct client_info *ci;
+
+	list_for_each_entry(ci, new_list, list) {
+		list_del(&ci->list);
+		if (client_update_events(ci) < 0)
+			client_close(ci);
+	}
+}
+
+/*
+ * Queue the responses to their clients, then send them out, coalescing the
+ * ones for the same client
+ */
+static void reactor_send_responses(struct list_head *tx_list)
+{
+	struct request *req;
+	struct client_info *ci;
+	LIST_HEAD(flush_list);
+
+	list_for_each_entry(req, tx_list, request_list) {
+		ci = req->ci;
+		list_del(&req->request_list);
+		if (ci->conn.dead) {
+			free_request(req);
+			client_try_free(ci);
+			continue;
+		}
+
+		/* use cpu_to_le */
+		req->rp.epoch = sys->cinfo.epoch;
+		req->rp.opcode = req->rq.opcode;
+		req->rp.id = req->rq.id;
+
+		/* otherwise it waits for EPOLLOUT or is in 'flush_list' */
+		if (list_empty(&ci->tx_list))
+			list_add_tail(&ci->list, &flush_list);
+		list_add_tail(&req->request_list, &ci->tx_list);
+	}
+
+	/* the sockets are most likely writable, try right away */
+	list_for_each_entry(ci, &flush_list, list) {
+		list_del(&ci->list);
+		if (client_tx(ci) < 0 || client_update_events(ci) < 0)
+			client_close(ci);
+	}
+}
+
+static void reactor_wakeup(struct reactor *r)
+{
+	LIST_HEAD(new_list);
+	LIST_HEAD(tx_list);
+
+	eventfd_xread(r->wake_fd);
+
+	sd_mutex_lock(&r->lock);
+	list_splice_init(&r->new_list, &new_list);
+	list_splice_init(&r->tx_list, &tx_list);
+	sd_mutex_unlock(&r->lock);
+
+	reactor_add_clients(&new_list);
+	reactor_send_responses(&tx_list);
+}
+
+static void *reactor_routine(void *arg)
+{
+	struct reactor *r = arg;
+	struct epoll_event events[NR_REACTOR_EVENTS];
+	LIST_HEAD(ready);
+	bool wakeup, idle;
+	int nr;
+
+	set_thread_name("reactor", true);
+
+	for (;;) {
+		nr = epoll_wait(r->efd, events, ARRAY_SIZE(events), -1);
+		if (nr < 0) {
+			if (errno == EINTR)
+				continue;
+			panic("epoll_wait failed, %m");
+		}
+
+		wakeup = false;
+		for (int i = 0; i < nr; i++) {
+			if (events[i].data.ptr)
+				client_handle(events[i].data.ptr,
+					      events[i].events, &ready);
+			else
+				wakeup = true;
+		}
+		/*
+		 * Last, because it may free the clients whose events are in
+		 * this round
+		 */
+		if (wakeup)
+			reactor_wakeup(r);
+
+		if (list_empty(&ready))
+			continue;
+		sd_mutex_lock(&rx_lock);
+		idle = list_empty(&rx_list);
+		list_splice_tail_init(&ready, &rx_list);
+		sd_mutex_unlock(&rx_lock);
+		if (idle)
+			eventfd_xwrite(rx_fd, 1);
+	}
+
+	return NULL;
+}
+
+static void reactor_queue(struct reactor *r, struct list_node *node,
+			  struct list_head *list)
+{
+	bool idle;
+
+	sd_mutex_lock(&r->lock);
+	idle = list_empty(&r->new_list) && list_empty(&r->tx_list);
+	list_add_tail(node, list);
+	sd_mutex_unlock(&r->lock);
+
+	if (idle)
+		eventfd_xwrite(r->wake_fd, 1);
+}
+
+/* Hand an accepted connection over to a reactor */
+main_fn int reactor_add_client(int fd)
+{
+	struct client_info *ci;
+	struct sockaddr_storage from;
+	socklen_t namesize = sizeof(from);
+	struct reactor *r;
+
+	ci = zalloc(sizeof(*ci));
+	if (!ci)
+		return -1;
+
+	if (getpeername(fd, (struct sockaddr *)&from, &namesize)) {
+		free(ci);
+		return -1;
+	}
+
+	switch (from.ss_family) {
+	case AF_INET:
+		ci->conn.port = ntohs(((struct sockaddr_in *)&from)->sin_port);
+		inet_ntop(AF_INET, &((struct sockaddr_in *)&from)->sin_addr,
+				ci->conn.ipstr, sizeof(ci->conn.ipstr));
+		break;
+	case AF_INET6:
+		ci->conn.port = ntohs(((struct sockaddr_in6 *)&from)->sin6_port);
+		inet_ntop(AF_INET6, &((struct sockaddr_in6 *)&from)->sin6_addr,
+				ci->conn.ipstr, sizeof(ci->conn.ipstr));
+		break;
+	}
+
+	ci->conn.fd = fd;
+	refcount_set(&ci->refcnt, 0);
+	INIT_LIST_HEAD(&ci->tx_list);
+
+	r = reactors + uatomic_add_return(&next_reactor, 1) % nr_reactors;
+	ci->reactor = r;
+	reactor_queue(r, &ci->list, &r->new_list);
+
+	return 0;
+}
+
+/* Send the response of a client request, called from any thread */
+void reactor_send_response(struct request *req)
+{
+	struct reactor *r = req->ci->reactor;
+
+	reactor_queue(r, &req->request_list, &r->tx_list);
+}
+
+static void reactor_rx_done(int fd, int events, void *data)
+{
+	struct request *req;
+	LIST_HEAD(list);
+
+	eventfd_xread(fd);
+
+	sd_mutex_lock(&rx_lock);
+	list_splice_init(&rx_list, &list);
+	sd_mutex_unlock(&rx_lock);
+
+	list_for_each_entry(req, &list, request_list) {
+		struct client_info *ci = req->ci;
+
+		list_del(&req->request_list);
+		if (is_logging_op(get_sd_op(req->rq.opcode))) {
+			sd_info("req=%p, fd=%d, client=%s:%d, op=%s, data=%s",
+				req, ci->conn.fd, ci->conn.ipstr,
+				ci->conn.port,
+				op_name(get_sd_op(req->rq.opcode)),
+				data_to_str(req->data, req->rp.data_length));
+		} else {
+			sd_debug("%d, %s:%d", ci->conn.fd, ci->conn.ipstr,
+				 ci->conn.port);
+		}
+		queue_request(req);
+	}
+}
+
+int reactor_init(void)
+{
+	long nr_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	struct epoll_event ev = { .events = EPOLLIN };
+
+	rx_fd = eventfd(0, EFD_NONBLOCK);
+	if (rx_fd < 0) {
+		sd_err("failed to create an eventfd, %m");
+		return -1;
+	}
+	register_event(rx_fd, reactor_rx_done, NULL);
+
+	nr_reactors = max(nr_cpus, 1L);
+	nr_reactors = min(nr_reactors, NR_REACTORS_MAX);
+	for (int i = 0; i < nr_reactors; i++) {
+		struct reactor *r = reactors + i;
+		pthread_t thread;
+		int ret;
+
+		sd_init_mutex(&r->lock);
+		INIT_LIST_HEAD(&r->new_list);
+		INIT_LIST_HEAD(&r->tx_list);
+
+		r->efd = epoll_create(NR_REACTOR_EVENTS);
+		r->wake_fd = eventfd(0, EFD_NONBLOCK);
+		if (r->efd < 0 || r->wake_fd < 0) {
+			sd_err("failed to create a reactor, %m");
+			return -1;
+		}
+		if (epoll_ctl(r->efd, EPOLL_CTL_ADD, r->wake_fd, &ev) < 0) {
+			sd_err("failed to add the wake fd, %m");
+			return -1;
+		}
+
+		ret = pthread_create(&thread, NULL, reactor_routine, r);
+		if (ret) {
+			sd_err("failed to create a reactor, %s", strerror(ret));
+			return -1;
+		}
+	}
+	sd_info("%d reactors", nr_reactors);
+
+	return 0;
+}
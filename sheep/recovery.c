@@ -37,6 +37,10 @@ struct recovery_obj_work {
 
 	uint64_t oid; /* the object to be recovered */
 	bool stop;
+	bool throttled; /* took its token of the objects/s bucket */
+
+	/* the peer we expect to read the object from, if any */
+	const struct sd_node *src;
 
 	/* local replica in the stale directory */
 	uint32_t local_epoch;
@@ -68,15 +72,55 @@ struct recovery_info {
 	uint64_t *prio_oids;
 	uint64_t nr_prio_oids;
 	uint64_t nr_scheduled_prio_oids;
+	/* oids[next .. prio_end) are scheduled prio oids */
+	uint64_t prio_end;
+
+	/* nr of in-flight objects per source peer */
+	struct rb_root peer_root;
 
 	struct vnode_info *old_vinfo;
 	struct vnode_info *cur_vinfo;
 };
 
+struct recovery_peer {
+	struct rb_node rb;
+	struct node_id nid;
+	uint32_t nr_inflight;
+};
+
+/*
+ * How many candidates after rinfo->next we look at when the next object's
+ * source peer is saturated.
+ */
+#define RECOVERY_PEER_LOOKAHEAD 64
+
+/*
+ * Token bucket shared by all the recovery workers
+ *
+ * The buckets hold at most one second worth of tokens and are allowed to go
+ * into debt, so that an object bigger than the bucket can still pass.  When
+ * there are foreground requests running on this node, the rates are divided
+ * by (1 + nr of active requests), but never below 1/RECOVERY_MAX_BACKOFF of
+ * the configured ones.  Only the reads from the peers take tokens; the
+ * objects found in the local stale directory don't cost the network.
+ */
+#define RECOVERY_MAX_BACKOFF 16
+
+static struct {
+	struct sd_mutex lock;
+	struct recovery_throttle conf;
+	double bytes, ops; /* available tokens */
+	uint64_t last; /* last refill in nanoseconds */
+} throttle = {
+	.lock = SD_MUTEX_INITIALIZER,
+};
+
 static struct recovery_info *next_rinfo;
 static main_thread(struct recovery_info *) current_rinfo;
 
 static void queue_recovery_work(struct recovery_info *rinfo);
+static worker_fn void recovery_throttle(struct recovery_obj_work *row,
+					  uint32_t len);
 
 /* Dynamically grown list buffer default as 4M (2T storage) */
 #define DEFAULT_LIST_BUFFER_SIZE (UINT64_C(1) << 22)
@@ -128,13 +172,14 @@ static bool invalid_node(const struct sd_node *n, struct vnode_info *info)
 
 static int search_erasure_object(uint64_t oid, uint8_t idx,
 				 struct rb_root *nroot,
-				 struct recovery_work *rw,
+				 struct recovery_obj_work *row,
 				 uint32_t tgt_epoch,
 				 void *buf)
 {
 	struct sd_req hdr;
 	unsigned rlen = get_store_objsize(oid);
 	struct sd_node *n;
+	struct recovery_work *rw = &row->base;
 	uint32_t epoch = rw->epoch;
 
 	rb_for_each_entry(n, nroot, rb) {
@@ -150,6 +195,7 @@ static int search_erasure_object(uint64_t oid, uint8_t idx,
 
 		sd_debug("%"PRIx64" epoch %"PRIu32" tgt %"PRIu32" idx %d, %s",
 			 oid, epoch, tgt_epoch, idx, node_to_str(n));
+		recovery_throttle(row, rlen);
 		if (sheep_exec_req(&n->nid, &hdr, buf) == SD_RES_SUCCESS)
 			return SD_RES_SUCCESS;
 	}
@@ -171,14 +217,14 @@ static void *read_erasure_object(uint64_t oid, uint8_t idx,
 	int ret;
 again:
 	if (unlikely(old->nr_zones < edp)) {
-		if (search_erasure_object(oid, idx, &old->nroot, rw,
+		if (search_erasure_object(oid, idx, &old->nroot, row,
 					  tgt_epoch, buf)
 		    == SD_RES_SUCCESS)
 			goto done;
 		else
 			goto rollback;
 	}
-	node = oid_to_node(oid, &old->vroot, idx);
+	node = ring_oid_to_node(oid, &old->ring, idx);
 	sd_debug("%"PRIx64" epoch %"PRIu32" tgt %"PRIu32" idx %d, %s",
 		 oid, epoch, tgt_epoch, idx, node_to_str(node));
 	if (invalid_node(node, rw->cur_vinfo))
@@ -191,6 +237,7 @@ again:
 	hdr.obj.tgt_epoch = tgt_epoch;
 	hdr.obj.ec_index = idx;
 
+	recovery_throttle(row, rlen);
 	ret = sheep_exec_req(&node->nid, &hdr, buf);
 	switch (ret) {
 	case SD_RES_SUCCESS:
@@ -275,6 +322,7 @@ static int recover_object_from(struct recovery_obj_work *row,
 	hdr.obj.oid = oid;
 	hdr.obj.tgt_epoch = tgt_epoch;
 
+	recovery_throttle(row, rlen);
 	ret = sheep_exec_req(&node->nid, &hdr, buf);
 	if (ret == SD_RES_SUCCESS) {
 		iocb.epoch = epoch;
@@ -303,7 +351,7 @@ static int recover_object_from_replica(struct recovery_obj_work *row,
 	for (int i = 0; i < nr_copies; i++) {
 		const struct sd_vnode *vnode;
 
-		vnode = oid_to_vnode(oid, &old->vroot, i);
+		vnode = ring_oid_to_vnode(oid, &old->ring, i);
 
 		if (vnode_is_local(vnode)) {
 			start = i;
@@ -316,7 +364,7 @@ static int recover_object_from_replica(struct recovery_obj_work *row,
 		const struct sd_node *node;
 		int idx = (i + start) % nr_copies;
 
-		node = oid_to_node(oid, &old->vroot, idx);
+		node = ring_oid_to_node(oid, &old->ring, idx);
 
 		if (invalid_node(node, row->base.cur_vinfo))
 			continue;
@@ -448,15 +496,15 @@ out:
 uint8_t local_ec_index(struct vnode_info *vinfo, uint64_t oid)
 {
 	int idx, m = min(get_vdi_copy_number(oid_to_vid(oid)), vinfo->nr_zones);
+	const struct sd_node *nodes[SD_MAX_COPIES];
 
 	if (!is_erasure_oid(oid))
 		return SD_MAX_COPIES;
 
-	for (idx = 0; idx < m; idx++) {
-		const struct sd_node *n = oid_to_node(oid, &vinfo->vroot, idx);
-		if (node_is_local(n))
+	ring_oid_to_nodes(oid, &vinfo->ring, m, nodes);
+	for (idx = 0; idx < m; idx++)
+		if (node_is_local(nodes[idx]))
 			return idx;
-	}
 	sd_debug("can't get valid index for %"PRIx64, oid);
 	return SD_MAX_COPIES;
 }
@@ -520,6 +568,105 @@ static int do_recover_object(struct recovery_obj_work *row)
 		return recover_replication_object(row);
 }
 
+main_fn void set_recovery_throttle(const struct recovery_throttle *conf)
+{
+	sd_mutex_lock(&throttle.lock);
+	throttle.conf = *conf;
+	throttle.bytes = 0;
+	throttle.ops = 0;
+	throttle.last = clock_get_time();
+	sd_mutex_unlock(&throttle.lock);
+
+	sd_info("recovery throttle %"PRIu64" bytes/s, %"PRIu32" objects/s",
+		conf->max_bps, conf->max_ops);
+}
+
+main_fn void get_recovery_throttle(struct recovery_throttle *conf)
+{
+	sd_mutex_lock(&throttle.lock);
+	*conf = throttle.conf;
+	sd_mutex_unlock(&throttle.lock);
+}
+
+static uint64_t foreground_active_nr(void)
+{
+	return uatomic_read(&sys->stat.r.gway_active_nr) +
+		uatomic_read(&sys->stat.r.peer_active_nr);
+}
+
+static double refill_bucket(double tokens, uint64_t rate, uint64_t backoff,
+			    uint64_t elapsed)
+{
+	double r = (double)rate / backoff;
+
+	tokens += r * elapsed / 1000000000;
+	return min(tokens, r);
+}
+
+/* How long we have to wait for the bucket, in microseconds */
+static uint64_t bucket_delay(double tokens, uint64_t rate, uint64_t backoff)
+{
+	if (tokens >= 0)
+		return 0;
+
+	return -tokens * backoff * 1000000 / rate + 1;
+}
+
+/*
+ * Wait until we are allowed to read 'len' bytes of the object of 'row'.  Only
+ * the first read of an object takes an objects/s token, so that reading the
+ * strips of an erasure coded object or retrying another peer costs bytes only
+ */
+static worker_fn void recovery_throttle(struct recovery_obj_work *row,
+					uint32_t len)
+{
+	uint64_t now, backoff, delay;
+
+	for (;;) {
+		sd_mutex_lock(&throttle.lock);
+		if (!throttle.conf.max_bps && !throttle.conf.max_ops) {
+			sd_mutex_unlock(&throttle.lock);
+			return;
+		}
+
+		now = clock_get_time();
+		backoff = min(foreground_active_nr() + 1,
+			      (uint64_t)RECOVERY_MAX_BACKOFF);
+		if (throttle.conf.max_bps)
+			throttle.bytes = refill_bucket(throttle.bytes,
+						       throttle.conf.max_bps,
+						       backoff,
+						       now - throttle.last);
+		if (throttle.conf.max_ops)
+			throttle.ops = refill_bucket(throttle.ops,
+						     throttle.conf.max_ops,
+						     backoff,
+						     now - throttle.last);
+		throttle.last = now;
+
+		delay = 0;
+		if (throttle.conf.max_bps)
+			delay = max(delay, bucket_delay(throttle.bytes,
+							throttle.conf.max_bps,
+							backoff));
+		if (throttle.conf.max_ops && !row->throttled)
+			delay = max(delay, bucket_delay(throttle.ops,
+							throttle.conf.max_ops,
+							backoff));
+		if (!delay) {
+			throttle.bytes -= len;
+			if (!row->throttled)
+				throttle.ops -= 1;
+			row->throttled = true;
+			sd_mutex_unlock(&throttle.lock);
+			return;
+		}
+		sd_mutex_unlock(&throttle.lock);
+
+		usleep(delay);
+	}
+}
+
 static void recover_object_work(struct work *work)
 {
 	struct recovery_work *rw = container_of(work, struct recovery_work,
@@ -673,6 +820,7 @@ static void free_recovery_info(struct recovery_info *rinfo)
 	put_vnode_info(rinfo->old_vinfo);
 	free(rinfo->oids);
 	free(rinfo->prio_oids);
+	rb_destroy(&rinfo->peer_root, struct recovery_peer, rb);
 	free(rinfo);
 }
 
@@ -797,6 +945,13 @@ static inline void finish_schedule_oids(struct recovery_info *rinfo)
 	free(rinfo->oids);
 	rinfo->oids = new_oids;
 done:
+	/*
+	 * The prio oids scheduled earlier but not queued yet are now right
+	 * after the new ones, so keep them within the prio range.
+	 */
+	rinfo->prio_end = max(rinfo->prio_end, nr_recovered) +
+		rinfo->nr_prio_oids;
+	rinfo->prio_end = min(rinfo->prio_end, rinfo->count);
 	free(rinfo->prio_oids);
 	rinfo->prio_oids = NULL;
 	rinfo->nr_scheduled_prio_oids += rinfo->nr_prio_oids;
@@ -815,6 +970,149 @@ static bool has_scheduled_objects(struct recovery_info *rinfo)
 	return rinfo->done < rinfo->nr_scheduled_prio_oids;
 }
 
+/*
+ * Rationale for multi-threaded recovery:
+ * 1. If one node is added, we find that all the VMs on other nodes will
+ *    get noticeably affected until 50% data is transferred to the new
+ *    node.
+ * 2. For node failure, we might not have problems of running VM but the
+ *    recovery process boost will benefit IO operation of VM with less
+ *    chances to be blocked for write and also improve reliability.
+ * 3. For disk failure in node, this is similar to adding a node. All
+ *    the data on the broken disk will be recovered on other disks in
+ *    this node. Speedy recoery not only improve data reliability but
+ *    also cause less writing blocking on the lost data.
+ *
+ * Unless specified by '-R max=', we recover md_nr_disks() * 2 objects at the
+ * same time, no rationale.
+ */
+static uint64_t recovery_window(void)
+{
+	if (sys->recovery_window)
+		return sys->recovery_window;
+
+	return max(md_nr_disks() * 2, 1U);
+}
+
+static int recovery_peer_cmp(const struct recovery_peer *a,
+			     const struct recovery_peer *b)
+{
+	return node_id_cmp(&a->nid, &b->nid);
+}
+
+static struct recovery_peer *find_recovery_peer(struct recovery_info *rinfo,
+						const struct sd_node *n)
+{
+	struct recovery_peer key = { .nid = n->nid };
+
+	return rb_search(&rinfo->peer_root, &key, rb, recovery_peer_cmp);
+}
+
+static void get_recovery_peer(struct recovery_info *rinfo,
+			      const struct sd_node *n)
+{
+	struct recovery_peer *peer = find_recovery_peer(rinfo, n);
+
+	if (!peer) {
+		peer = xzalloc(sizeof(*peer));
+		peer->nid = n->nid;
+		rb_insert(&rinfo->peer_root, peer, rb, recovery_peer_cmp);
+	}
+	peer->nr_inflight++;
+}
+
+static void put_recovery_peer(struct recovery_info *rinfo,
+			      const struct sd_node *n)
+{
+	struct recovery_peer *peer = find_recovery_peer(rinfo, n);
+
+	if (unlikely(!peer || !peer->nr_inflight))
+		panic("unbalanced recovery peer %s", node_to_str(n));
+	peer->nr_inflight--;
+}
+
+/*
+ * Guess which peer the object will be read from.  This follows the order
+ * recover_object_from_replica() and read_erasure_object() try the copies in,
+ * and is only used to spread the in-flight objects over the peers.  NULL
+ * means the object is likely to be found locally.
+ */
+static const struct sd_node *recovery_source(struct recovery_info *rinfo,
+					     uint64_t oid)
+{
+	struct vnode_info *old = rinfo->old_vinfo;
+	const struct sd_vnode *vnodes[SD_MAX_COPIES];
+	int nr_copies = get_obj_copy_number(oid, old->nr_zones), i;
+	uint8_t idx;
+
+	if (!nr_copies)
+		return NULL;
+
+	ring_oid_to_vnodes(oid, &old->ring, nr_copies, vnodes);
+	if (is_erasure_oid(oid)) {
+		idx = local_ec_index(rinfo->cur_vinfo, oid);
+		if (idx >= nr_copies || vnode_is_local(vnodes[idx]))
+			return NULL;
+		return vnodes[idx]->node;
+	}
+
+	for (i = 0; i < nr_copies; i++)
+		if (vnode_is_local(vnodes[i]))
+			return NULL;
+	for (i = 0; i < nr_copies; i++)
+		if (!invalid_node(vnodes[i]->node, rinfo->cur_vinfo))
+			return vnodes[i]->node;
+
+	return NULL;
+}
+
+static bool recovery_peer_is_busy(struct recovery_info *rinfo,
+				  const struct sd_node *n)
+{
+	struct recovery_peer *peer;
+
+	if (!n)
+		return false;
+
+	peer = find_recovery_peer(rinfo, n);
+	return peer && peer->nr_inflight >= sys->recovery_peer_window;
+}
+
+/*
+ * Make sure the object at rinfo->oids[rinfo->next] can be recovered without
+ * exceeding the per-peer window.  If its source peer is busy, swap in one of
+ * the following objects whose source is not.  Scheduled prio oids are never
+ * delayed.
+ *
+ * Return false if there is no such object, then we wait for the in-flight
+ * objects to be finished.  This never stalls, because a busy peer implies
+ * in-flight objects.
+ */
+static bool pick_next_object(struct recovery_info *rinfo)
+{
+	uint64_t i, end, oid;
+
+	if (!sys->recovery_peer_window || rinfo->next < rinfo->prio_end)
+		return true;
+
+	end = min(rinfo->count, rinfo->next + RECOVERY_PEER_LOOKAHEAD);
+	for (i = rinfo->next; i < end; i++) {
+		oid = rinfo->oids[i];
+		if (recovery_peer_is_busy(rinfo, recovery_source(rinfo, oid)))
+			continue;
+
+		rinfo->oids[i] = rinfo->oids[rinfo->next];
+		rinfo->oids[rinfo->next] = oid;
+		return true;
+	}
+
+	return false;
+}
+
+/*
+ * Fill the recovery window.  rinfo->oids[done .. next) are in flight and we
+ * keep at most recovery_window() of them.
+ */
 static void recover_next_object(struct recovery_info *rinfo)
 {
 	if (run_next_rw())
@@ -830,13 +1128,20 @@ static void recover_next_object(struct recovery_info *rinfo)
 		return;
 	}
 
-	/* no more objects to be recovered */
-	if (rinfo->next >= rinfo->count)
-		return;
+	while (rinfo->next < rinfo->count &&
+	       rinfo->next - rinfo->done < recovery_window()) {
+		/* Only the objects accessed by clients if recovery is off */
+		if (sys->cinfo.disable_recovery &&
+		    rinfo->next >= rinfo->prio_end)
+			break;
 
-	/* Try recover next object */
-	queue_recovery_work(rinfo);
-	rinfo->next++;
+		if (!pick_next_object(rinfo))
+			break;
+
+		/* Try recover next object */
+		queue_recovery_work(rinfo);
+		rinfo->next++;
+	}
 }
 
 void resume_suspended_recovery(void)
@@ -858,6 +1163,9 @@ static void recover_object_main(struct work *work)
 						     base);
 	struct recovery_info *rinfo = main_thread_get(current_rinfo);
 
+	if (row->src)
+		put_recovery_peer(rinfo, row->src);
+
 	/* ->oids[done, next] is out of order since finish order is random */
 	if (rinfo->oids[rinfo->done] != row->oid) {
 		uint64_t *p = xlfind(&row->oid, rinfo->oids + rinfo->done,
@@ -897,22 +1205,6 @@ static void finish_object_list(struct work *work)
 						      struct recovery_list_work,
 						      base);
 	struct recovery_info *rinfo = main_thread_get(current_rinfo);
-	/*
-	 * Rationale for multi-threaded recovery:
-	 * 1. If one node is added, we find that all the VMs on other nodes will
-	 *    get noticeably affected until 50% data is transferred to the new
-	 *    node.
-	 * 2. For node failure, we might not have problems of running VM but the
-	 *    recovery process boost will benefit IO operation of VM with less
-	 *    chances to be blocked for write and also improve reliability.
-	 * 3. For disk failure in node, this is similar to adding a node. All
-	 *    the data on the broken disk will be recovered on other disks in
-	 *    this node. Speedy recoery not only improve data reliability but
-	 *    also cause less writing blocking on the lost data.
-	 *
-	 * We choose md_nr_disks() * 2 threads for recovery, no rationale.
-	 */
-	uint32_t nr_threads = md_nr_disks() * 2;
 
 	rinfo->state = RW_RECOVER_OBJ;
 	rinfo->count = rlw->count;
@@ -928,9 +1220,7 @@ static void finish_object_list(struct work *work)
 		return;
 	}
 
-	for (uint32_t i = 0; i < nr_threads; i++)
-		recover_next_object(rinfo);
-	return;
+	recover_next_object(rinfo);
 }
 
 /* Fetch the object list from all the nodes in the cluster */
@@ -989,7 +1279,8 @@ static void screen_object_list(struct recovery_list_work *rlw,
 
 		nr_objs = get_obj_copy_number(oids[i], rw->cur_vinfo->nr_zones);
 
-		oid_to_vnodes(oids[i], &rw->cur_vinfo->vroot, nr_objs, vnodes);
+		ring_oid_to_vnodes(oids[i], &rw->cur_vinfo->ring, nr_objs,
+				   vnodes);
 		for (j = 0; j < nr_objs; j++) {
 			if (!vnode_is_local(vnodes[j]))
 				continue;
@@ -1119,6 +1410,11 @@ static void queue_recovery_work(struct recovery_info *rinfo)
 	case RW_RECOVER_OBJ:
 		row = xzalloc(sizeof(*row));
 		row->oid = rinfo->oids[rinfo->next];
+		if (sys->recovery_peer_window) {
+			row->src = recovery_source(rinfo, row->oid);
+			if (row->src)
+				get_recovery_peer(rinfo, row->src);
+		}
 
 		rw = &row->base;
 		rw->work.fn = recover_object_work;
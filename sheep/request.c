@@ -28,7 +28,7 @@ static bool is_access_local(struct request *req, uint64_t oid)
 	int i;
 
 	nr_copies = get_req_copy_number(req);
-	oid_to_vnodes(oid, &req->vinfo->vroot, nr_copies, obj_vnodes);
+	ring_oid_to_vnodes(oid, &req->vinfo->ring, nr_copies, obj_vnodes);
 	for (i = 0; i < nr_copies; i++) {
 		if (vnode_is_local(obj_vnodes[i]))
 			return true;
@@ -37,6 +37,16 @@ static bool is_access_local(struct request *req, uint64_t oid)
 	return false;
 }
 
+static void try_complete_on_worker(struct request *req);
+
+static void io_op_work(struct work *work)
+{
+	struct request *req = container_of(work, struct request, work);
+
+	do_process_work(work);
+	try_complete_on_worker(req);
+}
+
 static void io_op_done(struct work *work)
 {
 	struct request *req = container_of(work, struct request, work);
@@ -87,11 +97,25 @@ static inline void sleep_on_wait_queue(struct request *req)
 	list_add_tail(&req->request_list, &sys->req_wait_queue);
 }
 
-static void gateway_op_done(struct work *work)
+static void gateway_op_work(struct work *work)
+{
+	struct request *req = container_of(work, struct request, work);
+
+	do_process_work(work);
+	/* the forwarded ones complete when the replicas answer */
+	if (!req->forward)
+		try_complete_on_worker(req);
+}
+
+void gateway_op_done(struct work *work)
 {
 	struct request *req = container_of(work, struct request, work);
 	struct sd_req *hdr = &req->rq;
 
+	/* wait for both the work and the forwarding to the replicas */
+	if (req->forward && !gateway_forward_finish(req))
+		return;
+
 	switch (req->rp.result) {
 	case SD_RES_OLD_NODE_VER:
 		if (req->rp.epoch > sys->cinfo.epoch) {
@@ -279,7 +303,7 @@ static void queue_peer_request(struct request *req)
 	if (req->rq.flags & SD_FLAG_CMD_RECOVERY)
 		req->rq.epoch = req->rq.obj.tgt_epoch;
 
-	req->work.fn = do_process_work;
+	req->work.fn = io_op_work;
 	req->work.done = io_op_done;
 	queue_work(sys->io_wqueue, &req->work);
 }
@@ -336,7 +360,7 @@ queue_work:
 		goto end_request;
 	}
 
-	req->work.fn = do_process_work;
+	req->work.fn = gateway_op_work;
 	req->work.done = gateway_op_done;
 	queue_work(sys->gateway_wqueue, &req->work);
 	return;
@@ -362,7 +386,7 @@ static main_fn inline void stat_request_begin(struct request *req)
 
 	if (is_peer_op(req->op)) {
 		sys->stat.r.peer_total_nr++;
-		sys->stat.r.peer_active_nr++;
+		uatomic_inc(&sys->stat.r.peer_active_nr);
 		if (hdr->flags & SD_FLAG_CMD_WRITE)
 			sys->stat.r.peer_total_rx += hdr->data_length;
 		else
@@ -382,7 +406,7 @@ static main_fn inline void stat_request_begin(struct request *req)
 		}
 	} else if (is_gateway_op(req->op)) {
 		sys->stat.r.gway_total_nr++;
-		sys->stat.r.gway_active_nr++;
+		uatomic_inc(&sys->stat.r.gway_active_nr);
 		if (hdr->flags & SD_FLAG_CMD_WRITE)
 			sys->stat.r.gway_total_rx += hdr->data_length;
 		else
@@ -402,12 +426,13 @@ static main_fn inline void stat_request_begin(struct request *req)
 		}
 	} else if (hdr->opcode == SD_OP_FLUSH_VDI) {
 		sys->stat.r.gway_total_nr++;
-		sys->stat.r.gway_active_nr++;
+		uatomic_inc(&sys->stat.r.gway_active_nr);
 		sys->stat.r.gway_total_flush_nr++;
 	}
 }
 
-static main_fn inline void stat_request_end(struct request *req)
+/* Called on the workers too, for the requests completed there */
+static inline void stat_request_end(struct request *req)
 {
 	struct sd_req *hdr = &req->rq;
 
@@ -415,14 +440,14 @@ static main_fn inline void stat_request_end(struct request *req)
 		return;
 
 	if (is_peer_op(req->op))
-		sys->stat.r.peer_active_nr--;
+		uatomic_dec(&sys->stat.r.peer_active_nr);
 	else if (is_gateway_op(req->op))
-		sys->stat.r.gway_active_nr--;
+		uatomic_dec(&sys->stat.r.gway_active_nr);
 	else if (hdr->opcode == SD_OP_FLUSH_VDI)
-		sys->stat.r.gway_active_nr--;
+		uatomic_dec(&sys->stat.r.gway_active_nr);
 }
 
-static void queue_request(struct request *req)
+main_fn void queue_request(struct request *req)
 {
 	struct sd_req *hdr = &req->rq;
 	struct sd_rsp *rsp = &req->rp;
@@ -507,8 +532,6 @@ static void requeue_request(struct request *req)
 	queue_request(req);
 }
 
-static void clear_client_info(struct client_info *ci);
-
 static struct request *alloc_local_request(void *data, int data_length)
 {
 	struct request *req;
@@ -648,46 +671,9 @@ worker_fn int exec_local_req_async(struct sd_req *rq, void *data,
 	return SD_RES_SUCCESS;
 }
 
-static struct request *alloc_request(struct client_info *ci, int data_length)
-{
-	struct request *req;
-
-	req = zalloc(sizeof(struct request));
-	if (!req)
-		return NULL;
-
-	req->ci = ci;
-	refcount_inc(&ci->refcnt);
-	if (data_length) {
-		req->data_length = data_length;
-		req->data = valloc(data_length);
-		if (!req->data) {
-			free(req);
-			return NULL;
-		}
-	}
-
-	refcount_set(&req->refcnt, 1);
-
-	uatomic_inc(&sys->nr_outstanding_reqs);
-
-	return req;
-}
-
-static void free_request(struct request *req)
-{
-	uatomic_dec(&sys->nr_outstanding_reqs);
-
-	refcount_dec(&req->ci->refcnt);
-	put_vnode_info(req->vinfo);
-	free(req->data);
-	free(req);
-}
-
-main_fn void put_request(struct request *req)
+/* Called on the workers too, for the requests completed there */
+void put_request(struct request *req)
 {
-	struct client_info *ci = req->ci;
-
 	if (refcount_dec(&req->refcnt) > 0)
 		return;
 
@@ -695,261 +681,24 @@ main_fn void put_request(struct request *req)
 
 	if (req->local)
 		eventfd_xwrite(req->local_req_efd, 1);
-	else {
-		if (ci->conn.dead) {
-			clear_client_info(ci);
-			free_request(req);
-		} else {
-			list_add_tail(&req->request_list, &ci->done_reqs);
-
-			if (ci->tx_req == NULL)
-				/* There is no request being sent. */
-				conn_tx_on(&ci->conn);
-		}
-	}
-}
-
-static void rx_work(struct work *work)
-{
-	struct client_info *ci = container_of(work, struct client_info,
-					      rx_work);
-	int ret;
-	struct connection *conn = &ci->conn;
-	struct sd_req hdr;
-	struct request *req;
-
-	ret = do_read(conn->fd, &hdr, sizeof(hdr), NULL, 0, UINT32_MAX);
-	if (ret) {
-		sd_debug("failed to read a header");
-		conn->dead = true;
-		return;
-	}
-
-	req = alloc_request(ci, hdr.data_length);
-	if (!req) {
-		sd_err("failed to allocate request");
-		conn->dead = true;
-		return;
-	}
-	ci->rx_req = req;
-
-	/* use le_to_cpu */
-	memcpy(&req->rq, &hdr, sizeof(req->rq));
-
-	if (hdr.data_length && hdr.flags & SD_FLAG_CMD_WRITE) {
-		ret = do_read(conn->fd, req->data, hdr.data_length, NULL, 0,
-			      UINT32_MAX);
-		if (ret) {
-			sd_err("failed to read data");
-			conn->dead = true;
-		}
-	}
-}
-
-static void rx_main(struct work *work)
-{
-	struct client_info *ci = container_of(work, struct client_info,
-					      rx_work);
-	struct request *req = ci->rx_req;
-
-	ci->rx_req = NULL;
-
-	refcount_dec(&ci->refcnt);
-
-	if (ci->conn.dead) {
-		if (req)
-			free_request(req);
-
-		clear_client_info(ci);
-		return;
-	}
-
-	conn_rx_on(&ci->conn);
-
-	if (is_logging_op(get_sd_op(req->rq.opcode))) {
-		sd_info("req=%p, fd=%d, client=%s:%d, op=%s, data=%s",
-			req,
-			ci->conn.fd,
-			ci->conn.ipstr, ci->conn.port,
-			op_name(get_sd_op(req->rq.opcode)),
-			data_to_str(req->data, req->rp.data_length));
-	} else {
-		sd_debug("%d, %s:%d",
-			 ci->conn.fd,
-			 ci->conn.ipstr,
-			 ci->conn.port);
-	}
-	queue_request(req);
-}
-
-static void tx_work(struct work *work)
-{
-	struct client_info *ci = container_of(work, struct client_info,
-					      tx_work);
-	int ret;
-	struct connection *conn = &ci->conn;
-	struct sd_rsp rsp;
-	struct request *req = ci->tx_req;
-	void *data = NULL;
-
-	/* use cpu_to_le */
-	memcpy(&rsp, &req->rp, sizeof(rsp));
-
-	rsp.epoch = sys->cinfo.epoch;
-	rsp.opcode = req->rq.opcode;
-	rsp.id = req->rq.id;
-
-	if (rsp.data_length)
-		data = req->data;
-
-	ret = send_req(conn->fd, (struct sd_req *)&rsp, data, rsp.data_length,
-		       NULL, 0, UINT32_MAX);
-	if (ret != 0) {
-		sd_err("failed to send a request");
-		conn->dead = true;
-	}
-}
-
-static void tx_main(struct work *work)
-{
-	struct client_info *ci = container_of(work, struct client_info,
-					      tx_work);
-
-	refcount_dec(&ci->refcnt);
-
-	if (is_logging_op(ci->tx_req->op)) {
-		sd_info("req=%p, fd=%d, client=%s:%d, op=%s, result=%02X",
-			ci->tx_req,
-			ci->conn.fd,
-			ci->conn.ipstr,
-			ci->conn.port,
-			op_name(ci->tx_req->op),
-			ci->tx_req->rp.result);
-	} else {
-		sd_debug("%d, %s:%d",
-			 ci->conn.fd,
-			 ci->conn.ipstr,
-			 ci->conn.port);
-	}
-	free_request(ci->tx_req);
-	ci->tx_req = NULL;
-
-	if (ci->conn.dead) {
-		clear_client_info(ci);
-		return;
-	}
-
-	if (!list_empty(&ci->done_reqs))
-		conn_tx_on(&ci->conn);
+	else
+		reactor_send_response(req);
 }
 
-static void destroy_client(struct client_info *ci)
-{
-	sd_debug("connection from: %s:%d", ci->conn.ipstr, ci->conn.port);
-	close(ci->conn.fd);
-	free(ci);
-}
-
-static void clear_client_info(struct client_info *ci)
+/*
+ * Complete a successful I/O request on the worker which processed it, that
+ * is, hand its response to the reactor of the client right away instead of
+ * passing the request through the main thread.  The others, e.g. the failed
+ * ones which may be retried, go to the done function on the main thread.
+ */
+static void try_complete_on_worker(struct request *req)
 {
-	struct request *req;
-
-	sd_debug("connection seems to be dead");
-
-	list_for_each_entry(req, &ci->done_reqs, request_list) {
-		list_del(&req->request_list);
-		free_request(req);
-	}
-
-	unregister_event(ci->conn.fd);
-
-	sd_debug("refcnt:%d, fd:%d, %s:%d", refcount_read(&ci->refcnt),
-		 ci->conn.fd, ci->conn.ipstr, ci->conn.port);
-
-	if (refcount_read(&ci->refcnt))
+	if (req->rp.result != SD_RES_SUCCESS ||
+	    refcount_read(&req->refcnt) > 1)
 		return;
 
-	destroy_client(ci);
-}
-
-static struct client_info *create_client(int fd, struct cluster_info *cluster)
-{
-	struct client_info *ci;
-	struct sockaddr_storage from;
-	socklen_t namesize = sizeof(from);
-
-	ci = zalloc(sizeof(*ci));
-	if (!ci)
-		return NULL;
-
-	if (getpeername(fd, (struct sockaddr *)&from, &namesize)) {
-		free(ci);
-		return NULL;
-	}
-
-	switch (from.ss_family) {
-	case AF_INET:
-		ci->conn.port = ntohs(((struct sockaddr_in *)&from)->sin_port);
-		inet_ntop(AF_INET, &((struct sockaddr_in *)&from)->sin_addr,
-				ci->conn.ipstr, sizeof(ci->conn.ipstr));
-		break;
-	case AF_INET6:
-		ci->conn.port = ntohs(((struct sockaddr_in6 *)&from)->sin6_port);
-		inet_ntop(AF_INET6, &((struct sockaddr_in6 *)&from)->sin6_addr,
-				ci->conn.ipstr, sizeof(ci->conn.ipstr));
-		break;
-	}
-
-	ci->conn.fd = fd;
-	ci->conn.events = EPOLLIN;
-	refcount_set(&ci->refcnt, 0);
-
-	INIT_LIST_HEAD(&ci->done_reqs);
-
-	return ci;
-}
-
-static void client_handler(int fd, int events, void *data)
-{
-	struct client_info *ci = (struct client_info *)data;
-
-	sd_debug("%x, %d", events, ci->conn.dead);
-
-	if (events & (EPOLLERR | EPOLLHUP) || ci->conn.dead)
-		return clear_client_info(ci);
-
-	if (events & EPOLLIN) {
-		if (conn_rx_off(&ci->conn) != 0)
-			return;
-
-		/*
-		 * Increment refcnt so that the client_info isn't freed while
-		 * rx_work uses it.
-		 */
-		refcount_inc(&ci->refcnt);
-		ci->rx_work.fn = rx_work;
-		ci->rx_work.done = rx_main;
-		queue_work(sys->net_wqueue, &ci->rx_work);
-	}
-
-	if (events & EPOLLOUT) {
-		if (conn_tx_off(&ci->conn) != 0)
-			return;
-
-		assert(ci->tx_req == NULL);
-		ci->tx_req = list_first_entry(&ci->done_reqs, struct request,
-					      request_list);
-		list_del(&ci->tx_req->request_list);
-
-		/*
-		 * Increment refcnt so that the client_info isn't freed while
-		 * tx_work uses it.
-		 */
-		refcount_inc(&ci->refcnt);
-		ci->tx_work.fn = tx_work;
-		ci->tx_work.done = tx_main;
-		queue_work(sys->net_wqueue, &ci->tx_work);
-	}
+	work_done_on_worker(&req->work);
+	put_request(req);
 }
 
 static void listen_handler(int listen_fd, int events, void *data)
@@ -957,7 +706,6 @@ static void listen_handler(int listen_fd, int events, void *data)
 	struct sockaddr_storage from;
 	socklen_t namesize;
 	int fd, ret;
-	struct client_info *ci;
 	bool is_inet_socket = *(bool *)data;
 
 	if (sys->cinfo.status == SD_STATUS_SHUTDOWN) {
@@ -981,18 +729,11 @@ static void listen_handler(int listen_fd, int events, void *data)
 		}
 	}
 
-	ci = create_client(fd, data);
-	if (!ci) {
+	if (reactor_add_client(fd) < 0) {
 		close(fd);
 		return;
 	}
 
-	ret = register_event(fd, client_handler, ci);
-	if (ret) {
-		destroy_client(ci);
-		return;
-	}
-
 	sd_debug("accepted a new connection: %d", fd);
 }
 
@@ -1077,21 +818,34 @@ worker_fn int sheep_exec_req(const struct node_id *nid, struct sd_req *hdr,
 			     void *buf)
 {
 	struct sd_rsp *rsp = (struct sd_rsp *)hdr;
+	struct peer_stat *ps;
 	struct sockfd *sfd;
+	uint64_t start;
 	int ret;
 
+	if (forward_multiplexed(nid)) {
+		ret = forward_exec_req(nid, hdr, buf);
+		if (ret != SD_RES_SUCCESS && ret != SD_RES_NETWORK_ERROR)
+			sd_err("failed %s", sd_strerror(ret));
+		return ret;
+	}
+
 	sfd = sockfd_cache_get(nid);
 	if (!sfd)
 		return SD_RES_NETWORK_ERROR;
 
+	ps = peer_io_start(nid);
+	start = clock_get_time();
 	ret = exec_req(sfd->fd, hdr, buf, sheep_need_retry, hdr->epoch,
 		       MAX_RETRY_COUNT);
 	if (ret) {
 		sd_debug("remote node might have gone away");
 		sockfd_cache_del(nid, sfd);
+		peer_io_end(ps, start, SD_RES_NETWORK_ERROR);
 		return SD_RES_NETWORK_ERROR;
 	}
 	ret = rsp->result;
+	peer_io_end(ps, start, ret);
 	if (ret != SD_RES_SUCCESS)
 		sd_err("failed %s", sd_strerror(ret));
 
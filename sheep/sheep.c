@@ -43,6 +43,20 @@ static const char journal_help[] =
 "\nExample:\n\t$ sheep -j dir=/journal,size=1G\n"
 "This tries to use /journal as the journal storage of the size 1G\n";
 
+static const char read_help[] =
+"Available arguments:\n"
+"\tlatency: read from the replica with the lowest expected latency\n"
+"\t         (default)\n"
+"\trandom: read from a random replica\n"
+"\thedge=: if the replica hasn't answered after this percentile of the\n"
+"\t        read latency, read from another one too (default: 0, never)\n"
+"\nExample:\n\t$ sheep -S random ...\n"
+"This tries to spread the reads of replicated objects evenly over the\n"
+"replicas, whatever their latency\n"
+"\nExample:\n\t$ sheep -S hedge=95 ...\n"
+"This sends a second read to another replica when the first one is slower\n"
+"than 95% of the recent reads\n";
+
 static const char http_help[] =
 "Available arguments:\n"
 "\thost=: specify a host to communicate with http server (default: localhost)\n"
@@ -53,6 +67,16 @@ static const char http_help[] =
 "This tries to enable Swift API and use localhost:7001 to\n"
 "communicate with http server, using 64MB buffer.\n";
 
+static const char recovery_help[] =
+"Available arguments:\n"
+"\tmax=: max number of objects recovered at the same time\n"
+"\t      (default: twice the number of disks)\n"
+"\tpeer=: max number of objects read from the same peer at the same time\n"
+"\t       (default: unlimited)\n"
+"\nExample:\n\t$ sheep -R max=64,peer=8 ...\n"
+"This tries to recover 64 objects in parallel, but never read more than\n"
+"8 of them from the same node\n";
+
 static const char myaddr_help[] =
 "Example:\n\t$ sheep -y 192.168.1.1:7000 ...\n"
 "This tries to tell other nodes through what address they can talk to this\n"
@@ -81,6 +105,8 @@ static const char cache_help[] =
 "\tdir=: path to the location of the cache (default: $STORE/cache)\n"
 "\tdirectio: use directio mode for cache IO, "
 "if not specified use buffered IO\n"
+"\tbgfill: fetch the rest of a partially cached object in background\n"
+"\treadahead=: read up to this many objects ahead of a sequential reader\n"
 "\nExample:\n\t$ sheep -w size=200G,dir=/my_ssd,directio ...\n"
 "This tries to use /my_ssd as the cache storage with 200G allocted to the\n"
 "cache in directio mode\n";
@@ -131,12 +157,18 @@ static struct sd_option sheep_options[] = {
 	{'l', "log", true,
 	 "specify the log level, the log directory and the log format"
 	 "(log level default: 6 [SDOG_INFO])", log_help},
+	{'m', "multiplex", false, "share a few connections to each of the "
+	 "other sheep between the requests (default: disabled)"},
 	{'n', "nosync", false, "drop O_SYNC for write of backend"},
 	{'p', "port", true, "specify the TCP port on which to listen "
 	 "(default: 7000)"},
 	{'P', "pidfile", true, "create a pid file"},
 	{'r', "http", true, "enable http service. (default: disabled)",
 	 http_help},
+	{'R', "recovery", true, "specify the parallelism of object recovery",
+	 recovery_help},
+	{'S', "read", true, "specify how to choose the replica to read from "
+	 "(default: latency)", read_help},
 	{'u', "upgrade", false, "upgrade to the latest data layout"},
 	{'v', "version", false, "show the version"},
 	{'w', "cache", true, "enable object cache", cache_help},
@@ -301,6 +333,27 @@ static int cache_directio_parser(const char *s)
 	return 0;
 }
 
+static int cache_bgfill_parser(const char *s)
+{
+	sys->object_cache_bgfill = true;
+	return 0;
+}
+
+static int cache_readahead_parser(const char *s)
+{
+	char *p;
+	long n = strtol(s, &p, 10);
+
+	if (s == p || *p != '\0' || n < 0 || n > UINT8_MAX) {
+		sd_err("Invalid cache option '%s': readahead must be an "
+		       "integer between 0 and %u", s, UINT8_MAX);
+		return -1;
+	}
+
+	sys->object_cache_readahead = n;
+	return 0;
+}
+
 static char ocpath[PATH_MAX];
 
 static int cache_dir_parser(const char *s)
@@ -312,6 +365,8 @@ static int cache_dir_parser(const char *s)
 static struct option_parser cache_parsers[] = {
 	{ "size=", cache_size_parser },
 	{ "directio", cache_directio_parser },
+	{ "bgfill", cache_bgfill_parser },
+	{ "readahead=", cache_readahead_parser },
 	{ "dir=", cache_dir_parser },
 	{ NULL, NULL },
 };
@@ -424,6 +479,71 @@ static struct option_parser journal_parsers[] = {
 	{ NULL, NULL },
 };
 
+static int recovery_window_parser(const char *s, uint32_t *window)
+{
+	char *p;
+	long n = strtol(s, &p, 10);
+
+	if (s == p || *p != '\0' || n < 1 || n > UINT16_MAX) {
+		sd_err("Invalid recovery option '%s': must be an integer "
+		       "between 1 and %u", s, UINT16_MAX);
+		return -1;
+	}
+
+	*window = n;
+	return 0;
+}
+
+static int recovery_max_parser(const char *s)
+{
+	return recovery_window_parser(s, &sys->recovery_window);
+}
+
+static int recovery_peer_parser(const char *s)
+{
+	return recovery_window_parser(s, &sys->recovery_peer_window);
+}
+
+static int read_random_parser(const char *s)
+{
+	sys->random_read = true;
+	return 0;
+}
+
+static int read_latency_parser(const char *s)
+{
+	sys->random_read = false;
+	return 0;
+}
+
+static int read_hedge_parser(const char *s)
+{
+	char *p;
+	long n = strtol(s, &p, 10);
+
+	if (s == p || *p != '\0' || n < 0 || n > 99) {
+		sd_err("Invalid hedge percentile '%s': must be an integer "
+		       "between 0 and 99", s);
+		return -1;
+	}
+
+	sys->hedge_percentile = n;
+	return 0;
+}
+
+static struct option_parser read_parsers[] = {
+	{ "random", read_random_parser },
+	{ "latency", read_latency_parser },
+	{ "hedge=", read_hedge_parser },
+	{ NULL, NULL },
+};
+
+static struct option_parser recovery_parsers[] = {
+	{ "max=", recovery_max_parser },
+	{ "peer=", recovery_peer_parser },
+	{ NULL, NULL },
+};
+
 static size_t get_nr_nodes(void)
 {
 	struct vnode_info *vinfo;
@@ -442,7 +562,6 @@ static int create_work_queues(void)
 	if (init_work_queue(get_nr_nodes))
 		return -1;
 
-	sys->net_wqueue = create_work_queue("net", WQ_UNLIMITED);
 	sys->gateway_wqueue = create_work_queue("gway", WQ_UNLIMITED);
 	sys->io_wqueue = create_work_queue("io", WQ_UNLIMITED);
 	sys->recovery_wqueue = create_work_queue("rw", WQ_UNLIMITED);
@@ -652,6 +771,9 @@ int main(int argc, char **argv)
 			if (option_parse(optarg, ",", log_parsers) < 0)
 				exit(1);
 			break;
+		case 'm':
+			sys->peer_mux = true;
+			break;
 		case 'n':
 			sys->nosync = true;
 			break;
@@ -725,6 +847,14 @@ int main(int argc, char **argv)
 				}
 			sys->this_node.nid.io_port = io_port;
 			break;
+		case 'R':
+			if (option_parse(optarg, ",", recovery_parsers) < 0)
+				exit(1);
+			break;
+		case 'S':
+			if (option_parse(optarg, ",", read_parsers) < 0)
+				exit(1);
+			break;
 		case 'j':
 			uatomic_set_true(&sys->use_journal);
 			if (option_parse(optarg, ",", journal_parsers) < 0)
@@ -896,6 +1026,16 @@ int main(int argc, char **argv)
 	if (ret)
 		exit(1);
 
+	ret = forward_init();
+	if (ret)
+		exit(1);
+
+	pool_init();
+
+	ret = reactor_init();
+	if (ret)
+		exit(1);
+
 	ret = init_store_driver(sys->gateway_only);
 	if (ret)
 		exit(1);
@@ -63,18 +63,25 @@
 #define worker_fn
 #endif
 
+struct reactor;
+
+/* A client connection, only touched by its reactor but for refcnt */
 struct client_info {
 	struct connection conn;
+	struct reactor *reactor;
+	/* in the new clients of the reactor, or the ones to send to */
+	struct list_node list;
 
+	/* the request being received */
+	struct sd_req rx_hdr;
+	size_t rx_len;
 	struct request *rx_req;
-	struct work rx_work;
 
-	struct request *tx_req;
-	struct work tx_work;
+	/* the responses to send, the first one is being sent */
+	struct list_head tx_list;
+	size_t tx_off;			/* bytes of the first one sent */
 
-	struct list_head done_reqs;
-
-	refcnt_t refcnt;
+	refcnt_t refcnt;		/* nr of requests */
 };
 
 enum REQUST_STATUS {
@@ -114,6 +121,9 @@ struct request {
 	struct work work;
 	enum REQUST_STATUS status;
 	bool stat; /* true if this request is during stat */
+
+	/* set while the request is forwarded asynchronously, see forward.c */
+	struct gateway_forward *forward;
 };
 
 struct system_info {
@@ -138,7 +148,6 @@ struct system_info {
 	bool gateway_only;
 	bool nosync;
 
-	struct work_queue *net_wqueue;
 	struct work_queue *gateway_wqueue;
 	struct work_queue *io_wqueue;
 	struct work_queue *deletion_wqueue;
@@ -156,6 +165,19 @@ struct system_info {
 
 	uint32_t object_cache_size;
 	bool object_cache_directio;
+	bool object_cache_bgfill;
+	uint32_t object_cache_readahead; /* max nr of objects to read ahead */
+
+	/* max nr of objects in recovery, in total and per source peer */
+	uint32_t recovery_window;
+	uint32_t recovery_peer_window;
+
+	/* read replicated objects from a random replica, not the fastest */
+	bool random_read;
+	/* percentile of the read latency after which a read is hedged */
+	uint32_t hedge_percentile;
+	/* share a few tagged connections to each peer between the requests */
+	bool peer_mux;
 
 	uatomic_bool use_journal;
 	bool backend_dio;
@@ -249,6 +271,90 @@ int for_each_obj_path(int (*func)(const char *path));
 size_t get_store_objsize(uint64_t oid);
 int get_store_path(uint64_t oid, uint8_t ec_index, char *path);
 
+/* peer.c */
+struct peer_stat;
+struct peer_stat *peer_io_start(const struct node_id *nid);
+void peer_io_end(struct peer_stat *ps, uint64_t start, int ret);
+void sort_peers_for_read(const struct sd_node **nodes, int nr);
+int get_peer_stats(struct sd_peer_stat *buf, int nr_max);
+void account_read_latency(uint64_t ns);
+uint64_t read_hedge_delay(void);
+
+/* forward.c */
+struct forward_req;
+struct forward_conn;
+
+/* A request to one replica, and its response */
+struct forward_rpc {
+	const struct node_id *nid;
+	struct sockfd *sfd;		/* optional, a connection of its own */
+	struct sd_req hdr;		/* overwritten by the response */
+	struct iovec *iov;		/* the data to send or receive */
+	int iovcnt;
+	uint32_t wlen;			/* nr of bytes to send from iov */
+
+	/* private to forward.c */
+	struct forward_req *fr;
+	struct forward_conn *conn;
+	int fd;				/* a new connection to share, or -1 */
+	struct rb_node rb;		/* in the requests sent over conn */
+	struct list_node queue;		/* in the requests to send over conn */
+	struct list_node list;
+	int state;
+	struct iovec *vec;		/* what remains to transfer */
+	int vcnt;
+	struct iovec *vec_buf;
+	struct peer_stat *ps;
+	uint64_t start;
+	uint64_t last;			/* when it last made progress */
+};
+
+struct forward_req {
+	struct forward_rpc *rpcs;
+	int nr_rpcs;
+	uint32_t epoch;
+	int result;			/* the last error, or SD_RES_SUCCESS */
+	int nr_replies;
+	struct sd_rsp rsp;		/* the last response */
+	/* called in the forwarder thread when all the rpcs are done */
+	void (*end)(struct forward_req *fr);
+	/* called in the main thread after end(), if set */
+	void (*done)(struct forward_req *fr);
+
+	/* private to forward.c */
+	int nr_pending;
+	struct list_node list;
+};
+
+void forward_submit(struct forward_req *fr);
+bool forward_multiplexed(const struct node_id *nid);
+int forward_exec_req(const struct node_id *nid, struct sd_req *hdr, void *buf);
+int forward_init(void);
+
+/* reactor.c */
+int reactor_add_client(int fd);
+void reactor_send_response(struct request *req);
+int reactor_init(void);
+
+/* pool.c */
+struct request *alloc_request_struct(void);
+void free_request_struct(struct request *req);
+void *alloc_data_buffer(size_t len);
+void free_data_buffer(void *buf);
+void pool_init(void);
+
+/* fd_cache.c */
+struct fd_cache_entry;
+int fd_cache_init(void);
+struct fd_cache_entry *fd_cache_get(uint64_t oid, uint8_t ec_index, int flags,
+				    uint64_t *gen);
+struct fd_cache_entry *fd_cache_add(uint64_t oid, uint8_t ec_index, int flags,
+				    int fd, uint64_t gen);
+int fd_cache_fd(const struct fd_cache_entry *entry);
+void fd_cache_put(struct fd_cache_entry *entry);
+void fd_cache_del(uint64_t oid, uint8_t ec_index);
+void fd_cache_purge(void);
+
 extern struct list_head store_drivers;
 #define add_store_driver(driver)				\
 static void __attribute__((constructor)) add_ ## driver(void)	\
@@ -295,6 +401,7 @@ int lock_base_dir(const char *d);
 
 int fill_vdi_state_list(void *data);
 bool oid_is_readonly(uint64_t oid);
+bool get_vdi_state(uint32_t vid, struct vdi_state *vs);
 int get_vdi_copy_number(uint32_t vid);
 int get_vdi_copy_policy(uint32_t vid);
 int get_obj_copy_number(uint64_t oid, int nr_zones);
@@ -349,6 +456,7 @@ extern char *config_path;
 int set_cluster_config(const struct cluster_info *cinfo);
 int set_node_space(uint64_t space);
 int get_node_space(uint64_t *space);
+int set_recovery_throttle_config(const struct recovery_throttle *throttle);
 bool is_cluster_formatted(void);
 bool was_cluster_shutdowned(void);
 int set_cluster_shutdown(bool);
@@ -371,6 +479,8 @@ int start_recovery(struct vnode_info *cur_vinfo, struct vnode_info *, bool);
 bool oid_in_recovery(uint64_t oid);
 bool node_in_recovery(void);
 void get_recovery_state(struct recovery_state *state);
+void set_recovery_throttle(const struct recovery_throttle *throttle);
+void get_recovery_throttle(struct recovery_throttle *throttle);
 
 int read_backend_object(uint64_t oid, char *data, unsigned int datalen,
 		       uint64_t offset);
@@ -387,6 +497,7 @@ int exec_local_req_async(struct sd_req *rq, void *, struct request_iocb *);
 int local_req_wait(struct request_iocb *iocb);
 
 void local_request_init(void);
+void gateway_op_done(struct work *work);
 
 int prealloc(int fd, uint32_t size);
 
@@ -394,6 +505,7 @@ int objlist_cache_insert(uint64_t oid);
 void objlist_cache_remove(uint64_t oid);
 
 void put_request(struct request *req);
+void queue_request(struct request *req);
 
 int sheep_bnode_writer(uint64_t oid, void *mem, unsigned int len,
 		       uint64_t offset, uint32_t flags, int copies,
@@ -435,6 +547,7 @@ int gateway_read_obj(struct request *req);
 int gateway_write_obj(struct request *req);
 int gateway_create_and_write_obj(struct request *req);
 int gateway_remove_obj(struct request *req);
+bool gateway_forward_finish(struct request *req);
 bool is_erasure_oid(uint64_t oid);
 uint8_t local_ec_index(struct vnode_info *vinfo, uint64_t oid);
 
@@ -484,6 +597,7 @@ int md_plug_disks(char *disks);
 int md_unplug_disks(char *disks);
 uint64_t md_get_size(uint64_t *used);
 uint32_t md_nr_disks(void);
+int md_sync_disks(void);
 
 static inline bool is_stale_path(const char *path)
 {
@@ -11,16 +11,107 @@
 
 #include "sheep_priv.h"
 
-struct vdi_state_entry {
-	uint32_t vid;
-	unsigned int nr_copies;
-	bool snapshot;
-	uint8_t copy_policy;
-	struct rb_node node;
+/*
+ * vdi state table
+ *
+ * The state of each vdi is packed into a 32 bit word and stored in a three
+ * level radix table indexed by vid.  The I/O path looks up the state several
+ * times per request, so readers never take a lock: the table pages are never
+ * freed while sheep is running and are published with uatomic_cmpxchg(),
+ * which implies a full memory barrier, so readers only need atomic loads.
+ *
+ * Writers are serialized by vdi_state_lock.
+ */
+#define VDI_STATE_LEAF_BITS	6
+#define VDI_STATE_MID_BITS	9
+#define VDI_STATE_TOP_BITS	(24 - VDI_STATE_MID_BITS - VDI_STATE_LEAF_BITS)
+
+#define VDI_STATE_VALID		(1U << 31)
+#define VDI_STATE_SNAPSHOT	(1U << 30)
+#define VDI_STATE_POLICY_SHIFT	8
+
+struct vdi_state_leaf {
+	uint32_t state[1 << VDI_STATE_LEAF_BITS];
+};
+
+struct vdi_state_mid {
+	struct vdi_state_leaf *leaf[1 << VDI_STATE_MID_BITS];
 };
 
-static struct rb_root vdi_state_root = RB_ROOT;
-static struct sd_rw_lock vdi_state_lock = SD_RW_LOCK_INITIALIZER;
+static struct vdi_state_mid *vdi_state_table[1 << VDI_STATE_TOP_BITS];
+static struct sd_mutex vdi_state_lock = SD_MUTEX_INITIALIZER;
+
+static inline uint32_t vid_to_top(uint32_t vid)
+{
+	return vid >> (VDI_STATE_MID_BITS + VDI_STATE_LEAF_BITS);
+}
+
+static inline uint32_t vid_to_mid(uint32_t vid)
+{
+	return (vid >> VDI_STATE_LEAF_BITS) & ((1 << VDI_STATE_MID_BITS) - 1);
+}
+
+static inline uint32_t vid_to_leaf(uint32_t vid)
+{
+	return vid & ((1 << VDI_STATE_LEAF_BITS) - 1);
+}
+
+static inline uint32_t pack_vdi_state(int nr_copies, bool snapshot, uint8_t cp)
+{
+	return VDI_STATE_VALID | (snapshot ? VDI_STATE_SNAPSHOT : 0) |
+		((uint32_t)cp << VDI_STATE_POLICY_SHIFT) | (uint8_t)nr_copies;
+}
+
+static inline void unpack_vdi_state(uint32_t vid, uint32_t state,
+				    struct vdi_state *vs)
+{
+	vs->vid = vid;
+	vs->nr_copies = state & 0xff;
+	vs->snapshot = !!(state & VDI_STATE_SNAPSHOT);
+	vs->copy_policy = (state >> VDI_STATE_POLICY_SHIFT) & 0xff;
+	vs->_pad = 0;
+}
+
+/* Return the state word of the vdi, or 0 if the vdi is not known */
+static uint32_t vdi_state_load(uint32_t vid)
+{
+	struct vdi_state_mid *mid;
+	struct vdi_state_leaf *leaf;
+
+	if (unlikely(vid >= SD_NR_VDIS))
+		return 0;
+
+	mid = uatomic_read(&vdi_state_table[vid_to_top(vid)]);
+	if (!mid)
+		return 0;
+	leaf = uatomic_read(&mid->leaf[vid_to_mid(vid)]);
+	if (!leaf)
+		return 0;
+
+	return uatomic_read(&leaf->state[vid_to_leaf(vid)]);
+}
+
+/* Must be called with vdi_state_lock held */
+static uint32_t *vdi_state_slot(uint32_t vid)
+{
+	struct vdi_state_mid **midp = &vdi_state_table[vid_to_top(vid)], *mid;
+	struct vdi_state_leaf **leafp, *leaf;
+
+	if (!*midp) {
+		mid = xzalloc(sizeof(*mid));
+		if (uatomic_cmpxchg(midp, NULL, mid) != NULL)
+			free(mid);
+	}
+
+	leafp = &(*midp)->leaf[vid_to_mid(vid)];
+	if (!*leafp) {
+		leaf = xzalloc(sizeof(*leaf));
+		if (uatomic_cmpxchg(leafp, NULL, leaf) != NULL)
+			free(leaf);
+	}
+
+	return &(*leafp)->state[vid_to_leaf(vid)];
+}
 
 /*
  * ec_max_data_strip represent max number of data strips in the cluster. When
@@ -42,40 +133,31 @@ int sheep_bnode_reader(uint64_t oid, void **mem, unsigned int len,
 	return sd_read_object(oid, *mem, len, offset);
 }
 
-static int vdi_state_cmp(const struct vdi_state_entry *a,
-			 const struct vdi_state_entry *b)
-{
-	return intcmp(a->vid, b->vid);
-}
-
-static struct vdi_state_entry *vdi_state_search(struct rb_root *root,
-						uint32_t vid)
+/*
+ * Look up all the attributes of the vdi at once.  This never blocks, so it is
+ * fine to call it from both the main thread and the worker threads.
+ */
+bool get_vdi_state(uint32_t vid, struct vdi_state *vs)
 {
-	struct vdi_state_entry key = { .vid = vid };
+	uint32_t state = vdi_state_load(vid);
 
-	return rb_search(root, &key, node, vdi_state_cmp);
-}
+	if (!(state & VDI_STATE_VALID))
+		return false;
 
-static struct vdi_state_entry *vdi_state_insert(struct rb_root *root,
-						struct vdi_state_entry *new)
-{
-	return rb_insert(root, new, node, vdi_state_cmp);
+	unpack_vdi_state(vid, state, vs);
+	return true;
 }
 
 static bool vid_is_snapshot(uint32_t vid)
 {
-	struct vdi_state_entry *entry;
+	struct vdi_state vs;
 
-	sd_read_lock(&vdi_state_lock);
-	entry = vdi_state_search(&vdi_state_root, vid);
-	sd_rw_unlock(&vdi_state_lock);
-
-	if (!entry) {
+	if (!get_vdi_state(vid, &vs)) {
 		sd_err("No VDI entry for %" PRIx32 " found", vid);
 		return 0;
 	}
 
-	return entry->snapshot;
+	return vs.snapshot;
 }
 
 bool oid_is_readonly(uint64_t oid)
@@ -89,36 +171,28 @@ bool oid_is_readonly(uint64_t oid)
 
 int get_vdi_copy_number(uint32_t vid)
 {
-	struct vdi_state_entry *entry;
-
-	sd_read_lock(&vdi_state_lock);
-	entry = vdi_state_search(&vdi_state_root, vid);
-	sd_rw_unlock(&vdi_state_lock);
+	struct vdi_state vs;
 
-	if (!entry) {
+	if (!get_vdi_state(vid, &vs)) {
 		sd_alert("copy number for %" PRIx32 " not found, set %d", vid,
 			 sys->cinfo.nr_copies);
 		return sys->cinfo.nr_copies;
 	}
 
-	return entry->nr_copies;
+	return vs.nr_copies;
 }
 
 int get_vdi_copy_policy(uint32_t vid)
 {
-	struct vdi_state_entry *entry;
+	struct vdi_state vs;
 
-	sd_read_lock(&vdi_state_lock);
-	entry = vdi_state_search(&vdi_state_root, vid);
-	sd_rw_unlock(&vdi_state_lock);
-
-	if (!entry) {
+	if (!get_vdi_state(vid, &vs)) {
 		sd_alert("copy policy for %" PRIx32 " not found, set %d", vid,
 			 sys->cinfo.copy_policy);
 		return sys->cinfo.copy_policy;
 	}
 
-	return entry->copy_policy;
+	return vs.copy_policy;
 }
 
 int get_obj_copy_number(uint64_t oid, int nr_zones)
@@ -140,14 +214,6 @@ int get_req_copy_number(struct request *req)
 
 int add_vdi_state(uint32_t vid, int nr_copies, bool snapshot, uint8_t cp)
 {
-	struct vdi_state_entry *entry, *old;
-
-	entry = xzalloc(sizeof(*entry));
-	entry->vid = vid;
-	entry->nr_copies = nr_copies;
-	entry->snapshot = snapshot;
-	entry->copy_policy = cp;
-
 	if (cp) {
 		int d;
 
@@ -157,17 +223,9 @@ int add_vdi_state(uint32_t vid, int nr_copies, bool snapshot, uint8_t cp)
 
 	sd_debug("%" PRIx32 ", %d, %d", vid, nr_copies, cp);
 
-	sd_write_lock(&vdi_state_lock);
-	old = vdi_state_insert(&vdi_state_root, entry);
-	if (old) {
-		free(entry);
-		entry = old;
-		entry->nr_copies = nr_copies;
-		entry->snapshot = snapshot;
-		entry->copy_policy = cp;
-	}
-
-	sd_rw_unlock(&vdi_state_lock);
+	sd_mutex_lock(&vdi_state_lock);
+	uatomic_set(vdi_state_slot(vid), pack_vdi_state(nr_copies, snapshot, cp));
+	sd_mutex_unlock(&vdi_state_lock);
 
 	return SD_RES_SUCCESS;
 }
@@ -176,19 +234,32 @@ int fill_vdi_state_list(void *data)
 {
 	int nr = 0;
 	struct vdi_state *vs = data;
-	struct vdi_state_entry *entry;
-
-	sd_read_lock(&vdi_state_lock);
-	rb_for_each_entry(entry, &vdi_state_root, node) {
-		memset(vs, 0, sizeof(*vs));
-		vs->vid = entry->vid;
-		vs->nr_copies = entry->nr_copies;
-		vs->snapshot = entry->snapshot;
-		vs->copy_policy = entry->copy_policy;
-		vs++;
-		nr++;
+	struct vdi_state_mid *mid;
+	struct vdi_state_leaf *leaf;
+	uint32_t vid;
+
+	sd_mutex_lock(&vdi_state_lock);
+	for (int i = 0; i < ARRAY_SIZE(vdi_state_table); i++) {
+		mid = vdi_state_table[i];
+		if (!mid)
+			continue;
+		for (int j = 0; j < ARRAY_SIZE(mid->leaf); j++) {
+			leaf = mid->leaf[j];
+			if (!leaf)
+				continue;
+			for (int k = 0; k < ARRAY_SIZE(leaf->state); k++) {
+				if (!(leaf->state[k] & VDI_STATE_VALID))
+					continue;
+				vid = (i << (VDI_STATE_MID_BITS +
+					     VDI_STATE_LEAF_BITS)) |
+					(j << VDI_STATE_LEAF_BITS) | k;
+				unpack_vdi_state(vid, leaf->state[k], vs);
+				vs++;
+				nr++;
+			}
+		}
 	}
-	sd_rw_unlock(&vdi_state_lock);
+	sd_mutex_unlock(&vdi_state_lock);
 
 	return nr * sizeof(*vs);
 }
@@ -1250,12 +1321,29 @@ out:
 	return ret;
 }
 
+/*
+ * Lock-free readers might still be walking the table, so we only invalidate
+ * the states and keep the pages for later use.
+ */
 void clean_vdi_state(void)
 {
-	sd_write_lock(&vdi_state_lock);
-	rb_destroy(&vdi_state_root, struct vdi_state_entry, node);
-	INIT_RB_ROOT(&vdi_state_root);
-	sd_rw_unlock(&vdi_state_lock);
+	struct vdi_state_mid *mid;
+	struct vdi_state_leaf *leaf;
+
+	sd_mutex_lock(&vdi_state_lock);
+	for (int i = 0; i < ARRAY_SIZE(vdi_state_table); i++) {
+		mid = vdi_state_table[i];
+		if (!mid)
+			continue;
+		for (int j = 0; j < ARRAY_SIZE(mid->leaf); j++) {
+			leaf = mid->leaf[j];
+			if (!leaf)
+				continue;
+			for (int k = 0; k < ARRAY_SIZE(leaf->state); k++)
+				uatomic_set(&leaf->state[k], 0);
+		}
+	}
+	sd_mutex_unlock(&vdi_state_lock);
 }
 
 int sd_delete_vdi(const char *name)
@@ -0,0 +1,224 @@
+/*
+ * Copyright (C) 2013 Nippon Telegraph and Telephone Corporation.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License version
+ * 2 as published by the Free Software Foundation.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Eviction quality of CAR against LRU for the object cache
+ *
+ * Usage: bench_car [trace]
+ *
+ * A trace has one access per line, "<msec> <oid in hex>".  Without one, it
+ * replays a synthetic trace: some VMs reading their hot sets, while a backup
+ * job reads through a large VDI now and then.  Each object read by the
+ * backup is accessed several times in a row, like a scan reading an object
+ * by a few requests.  It prints the hit ratios of both policies for cache
+ * sizes in objects.
+ */
+
+#include <inttypes.h>
+
+#include "util.h"
+#include "sheepdog_proto.h"
+#include "car.h"
+
+#define HASH_BITS	20
+
+struct trace {
+	uint64_t msec;
+	uint64_t oid;
+};
+
+struct object {
+	struct hlist_node hash;
+	struct list_node lru;
+	struct car_node car;
+	uint64_t oid;
+};
+
+static struct hlist_head hashtable[1 << HASH_BITS];
+static size_t nr_objects;
+
+static struct object *lookup(uint64_t oid)
+{
+	struct hlist_head *head = hashtable + hash_64(oid, HASH_BITS);
+	struct hlist_node *n;
+	struct object *obj;
+
+	hlist_for_each_entry(obj, n, head, hash) {
+		if (obj->oid == oid)
+			return obj;
+	}
+	return NULL;
+}
+
+static struct object *add(uint64_t oid)
+{
+	struct object *obj = xzalloc(sizeof(*obj));
+
+	obj->oid = oid;
+	hlist_add_head(&obj->hash, hashtable + hash_64(oid, HASH_BITS));
+	nr_objects++;
+	return obj;
+}
+
+static void del(struct object *obj)
+{
+	hlist_del(&obj->hash);
+	nr_objects--;
+	free(obj);
+}
+
+static void reset(void)
+{
+	for (int i = 0; i < ARRAY_SIZE(hashtable); i++)
+		while (hashtable[i].first)
+			del(hlist_entry(hashtable[i].first, struct object,
+					hash));
+}
+
+static double run_lru(const struct trace *t, size_t nr, size_t size)
+{
+	LIST_HEAD(lru);
+	size_t hits = 0;
+
+	for (size_t i = 0; i < nr; i++) {
+		struct object *obj = lookup(t[i].oid);
+
+		if (obj) {
+			list_move_tail(&obj->lru, &lru);
+			hits++;
+			continue;
+		}
+		if (nr_objects >= size) {
+			struct object *victim = list_first_entry(&lru,
+							struct object, lru);
+			list_del(&victim->lru);
+			del(victim);
+		}
+		obj = add(t[i].oid);
+		list_add_tail(&obj->lru, &lru);
+	}
+	reset();
+
+	return (double)hits / nr;
+}
+
+static bool evictable(struct car_node *node)
+{
+	return true;
+}
+
+static double run_car(const struct trace *t, size_t nr, size_t size)
+{
+	struct car car;
+	size_t hits = 0;
+
+	car_init(&car, size, 1000);
+	for (size_t i = 0; i < nr; i++) {
+		struct object *obj = lookup(t[i].oid);
+
+		if (obj) {
+			car_hit(&car, &obj->car, t[i].msec);
+			hits++;
+			continue;
+		}
+		if (nr_objects >= size)
+			del(container_of(car_evict(&car, evictable),
+					 struct object, car));
+		obj = add(t[i].oid);
+		car_insert(&car, &obj->car, t[i].oid, t[i].msec);
+	}
+	reset();
+	car_destroy(&car);
+
+	return (double)hits / nr;
+}
+
+static struct trace *load_trace(const char *path, size_t *nr)
+{
+	struct trace *t = NULL;
+	size_t alloc = 0;
+	FILE *fp = fopen(path, "r");
+
+	if (!fp) {
+		fprintf(stderr, "failed to open %s, %m\n", path);
+		exit(1);
+	}
+	*nr = 0;
+	for (;;) {
+		uint64_t msec, oid;
+
+		if (fscanf(fp, "%"SCNu64" %"SCNx64, &msec, &oid) != 2)
+			break;
+		if (*nr == alloc) {
+			alloc = alloc ? alloc * 2 : 4096;
+			t = xrealloc(t, sizeof(*t) * alloc);
+		}
+		t[*nr].msec = msec;
+		t[*nr].oid = oid;
+		(*nr)++;
+	}
+	fclose(fp);
+
+	return t;
+}
+
+#define NR_VMS		8
+#define HOT_OBJECTS	128	/* per VM */
+#define VM_OBJECTS	2048	/* per VM */
+#define SCAN_OBJECTS	16384	/* of the VDI to back up */
+#define SCAN_REQS	16	/* per object */
+#define NR_ACCESSES	(1 << 21)
+
+/* 90% of the VM reads go to their hot sets, and a scan runs all the time */
+static struct trace *synthesize_trace(size_t *nr)
+{
+	struct trace *t = xmalloc(sizeof(*t) * NR_ACCESSES);
+	uint64_t scan = 0;
+
+	srandom(0);
+	for (size_t i = 0; i < NR_ACCESSES; i++) {
+		uint64_t vid = random() % (NR_VMS + 1), idx;
+
+		t[i].msec = i;
+		if (vid == NR_VMS) {
+			idx = scan++ / SCAN_REQS % SCAN_OBJECTS;
+		} else if (random() % 10) {
+			idx = random() % HOT_OBJECTS;
+		} else {
+			idx = random() % VM_OBJECTS;
+		}
+		t[i].oid = vid_to_data_oid(vid + 1, idx);
+	}
+	*nr = NR_ACCESSES;
+
+	return t;
+}
+
+int main(int argc, char **argv)
+{
+	static const size_t sizes[] = { 256, 512, 1024, 2048, 4096, 8192 };
+	struct trace *t;
+	size_t nr;
+
+	if (argc > 1)
+		t = load_trace(argv[1], &nr);
+	else
+		t = synthesize_trace(&nr);
+
+	printf("%zu accesses\n", nr);
+	printf("size\tLRU\tCAR\n");
+	for (int i = 0; i < ARRAY_SIZE(sizes); i++)
+		printf("%zu\t%.3f\t%.3f\n", sizes[i], run_lru(t, nr, sizes[i]),
+		       run_car(t, nr, sizes[i]));
+
+	free(t);
+	return 0;
+}
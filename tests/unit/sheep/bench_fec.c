@@ -0,0 +1,114 @@
+/*
+ * Copyright (C) 2013 Nippon Telegraph and Telephone Corporation.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License version
+ * 2 as published by the Free Software Foundation.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Throughput benchmark of the erasure code kernels
+ *
+ * Usage: bench_fec [MB per run]
+ *
+ * For each GF(2^8) kernel the CPU can run, it encodes the data the same way
+ * the gateway does (one ec_encode() per 1K stripe) and rebuilds a lost data
+ * strip with ec_decode_buffer(), then prints the throughput over the data.
+ */
+
+#include "fec.h"
+
+static const char * const kernels[] = { "generic", "ssse3", "avx2" };
+
+static const struct {
+	int d, p;
+} codes[] = {
+	{ 2, 1 }, { 4, 2 }, { 8, 4 }, { 16, 4 },
+};
+
+static double mb_per_sec(size_t len, uint64_t start)
+{
+	double sec = (double)(clock_get_time() - start) / 1000000000;
+
+	return (double)len / 1024 / 1024 / sec;
+}
+
+static void bench(int d, int p, size_t len)
+{
+	int dp = d + p, nr_stripes = len / SD_EC_DATA_STRIPE_SIZE;
+	size_t strip_size = SD_EC_DATA_STRIPE_SIZE / d;
+	struct fec *ctx = ec_init(d, dp);
+	uint8_t *strips[dp], *input[d];
+	char *buf = xmalloc(strip_size * SD_EC_NR_STRIPE_PER_OBJECT);
+	int inidx[d];
+	double enc, dec;
+	uint64_t start;
+
+	for (int i = 0; i < dp; i++)
+		strips[i] = xmalloc(strip_size * nr_stripes);
+	for (int i = 0; i < d; i++)
+		for (size_t j = 0; j < strip_size * nr_stripes; j++)
+			strips[i][j] = random();
+
+	start = clock_get_time();
+	for (int i = 0; i < nr_stripes; i++) {
+		const uint8_t *ds[d];
+		uint8_t *ps[p];
+
+		for (int j = 0; j < d; j++)
+			ds[j] = strips[j] + strip_size * i;
+		for (int j = 0; j < p; j++)
+			ps[j] = strips[d + j] + strip_size * i;
+		ec_encode(ctx, ds, ps);
+	}
+	enc = mb_per_sec(nr_stripes * SD_EC_DATA_STRIPE_SIZE, start);
+
+	/* lose the first data strip */
+	for (int i = 0; i < d; i++) {
+		input[i] = strips[i + 1];
+		inidx[i] = i + 1;
+	}
+	start = clock_get_time();
+	for (int i = 0; i + SD_EC_NR_STRIPE_PER_OBJECT <= nr_stripes;
+	     i += SD_EC_NR_STRIPE_PER_OBJECT) {
+		uint8_t *in[d];
+
+		for (int j = 0; j < d; j++)
+			in[j] = input[j] + strip_size * i;
+		ec_decode_buffer(ctx, in, inidx, buf, 0);
+	}
+	dec = mb_per_sec(nr_stripes * SD_EC_DATA_STRIPE_SIZE, start);
+
+	printf("%s\t%d:%d\t%.0f\t%.0f\n", fec_kernel_name(), d, p, enc, dec);
+
+	for (int i = 0; i < dp; i++)
+		free(strips[i]);
+	free(buf);
+	ec_destroy(ctx);
+}
+
+int main(int argc, char **argv)
+{
+	size_t len = 256;
+
+	if (argc > 1)
+		len = atoi(argv[1]);
+	/* whole objects, so that the rebuild covers the same data */
+	len = round_up(len * 1024 * 1024, SD_DATA_OBJ_SIZE);
+
+	init_fec();
+	srandom(0);
+
+	printf("kernel\tcode\tencode MB/s\trebuild MB/s\n");
+	for (int i = 0; i < ARRAY_SIZE(kernels); i++) {
+		if (!fec_set_kernel(kernels[i]))
+			continue;
+		for (int j = 0; j < ARRAY_SIZE(codes); j++)
+			bench(codes[j].d, codes[j].p, len);
+	}
+
+	return 0;
+}
@@ -0,0 +1,194 @@
+/*
+ * Copyright (C) 2013 Nippon Telegraph and Telephone Corporation.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License version
+ * 2 as published by the Free Software Foundation.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Microbenchmark of pread()/pwrite() against io_uring
+ *
+ * Usage: bench_io [file] [file size in MB] [I/Os per run] [direct]
+ *
+ * It issues random 4KB reads, then writes, to the file at queue depths of 1,
+ * 4, 16 and 64.  The plain I/O gets its queue depth from as many threads,
+ * each doing synchronous I/O like the store workers, while io_uring gets it
+ * from one thread submitting that many I/Os per uring_exec().  It prints the
+ * IOPS and the CPU time per I/O of both.  Pass "direct" to use O_DIRECT.
+ */
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/resource.h>
+
+#include "util.h"
+#include "uring.h"
+
+#define IO_SIZE		4096
+#define MAX_DEPTH	64
+
+static const char *path = "bench_io.dat";
+static uint64_t file_size = 64ULL << 20;
+static uint64_t nr_ios = 1 << 16;
+static int fd;
+
+struct worker {
+	pthread_t thread;
+	bool write;
+	bool uring;
+	int depth;
+	uint64_t nr;
+	uint64_t seed;
+	void *buf;
+};
+
+static off_t next_offset(struct worker *w)
+{
+	w->seed ^= w->seed << 13;
+	w->seed ^= w->seed >> 7;
+	w->seed ^= w->seed << 17;
+	return (w->seed % (file_size / IO_SIZE)) * IO_SIZE;
+}
+
+static void do_plain_io(struct worker *w)
+{
+	for (uint64_t i = 0; i < w->nr; i++) {
+		off_t off = next_offset(w);
+		ssize_t ret;
+
+		if (w->write)
+			ret = xpwrite(fd, w->buf, IO_SIZE, off);
+		else
+			ret = xpread(fd, w->buf, IO_SIZE, off);
+		if (ret != IO_SIZE)
+			panic("I/O failed, %m");
+	}
+}
+
+static void do_uring_io(struct worker *w)
+{
+	struct uring_io ios[MAX_DEPTH];
+
+	for (uint64_t i = 0; i < w->nr; i += w->depth) {
+		for (int j = 0; j < w->depth; j++) {
+			ios[j] = (struct uring_io) {
+				.op = w->write ? URING_WRITE : URING_READ,
+				.fd = fd,
+				.buf = (char *)w->buf + j * IO_SIZE,
+				.len = IO_SIZE,
+				.offset = next_offset(w),
+			};
+		}
+		if (uring_exec(ios, w->depth) < 0)
+			panic("I/O failed, %m");
+	}
+}
+
+static void *worker_routine(void *arg)
+{
+	struct worker *w = arg;
+
+	if (w->uring)
+		do_uring_io(w);
+	else
+		do_plain_io(w);
+
+	return NULL;
+}
+
+static uint64_t cpu_time(void)
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000ULL +
+		ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+}
+
+/* Print the IOPS and the CPU us per I/O */
+static void bench(bool write, bool uring, int depth)
+{
+	int nr_threads = uring ? 1 : depth;
+	struct worker *w = xzalloc(sizeof(*w) * nr_threads);
+	uint64_t start = clock_get_time(), cpu = cpu_time(), elapsed;
+
+	for (int i = 0; i < nr_threads; i++) {
+		w[i].write = write;
+		w[i].uring = uring;
+		w[i].depth = depth;
+		w[i].nr = nr_ios / nr_threads;
+		w[i].seed = i + 1;
+		w[i].buf = xvalloc(IO_SIZE * MAX_DEPTH);
+		memset(w[i].buf, i, IO_SIZE * MAX_DEPTH);
+		if (pthread_create(&w[i].thread, NULL, worker_routine, w + i))
+			panic("failed to create a worker, %m");
+	}
+	for (int i = 0; i < nr_threads; i++) {
+		pthread_join(w[i].thread, NULL);
+		free(w[i].buf);
+	}
+	elapsed = clock_get_time() - start;
+	cpu = cpu_time() - cpu;
+	free(w);
+
+	printf("\t%.0f\t%.2f", nr_ios / ((double)elapsed / 1000000000),
+	       (double)cpu / nr_ios);
+}
+
+static void prefill(void)
+{
+	size_t len = 1 << 20;
+	void *buf = xvalloc(len);
+
+	memset(buf, 0xaa, len);
+	for (uint64_t off = 0; off < file_size; off += len)
+		if (xpwrite(fd, buf, len, off) != len)
+			panic("failed to fill %s, %m", path);
+	fsync(fd);
+	free(buf);
+}
+
+int main(int argc, char **argv)
+{
+	int flags = O_RDWR | O_CREAT;
+
+	if (argc > 1)
+		path = argv[1];
+	if (argc > 2)
+		file_size = strtoull(argv[2], NULL, 10) << 20;
+	if (argc > 3)
+		nr_ios = strtoull(argv[3], NULL, 10);
+	if (argc > 4 && strcmp(argv[4], "direct") == 0)
+		flags |= O_DIRECT;
+
+	if (!uring_supported()) {
+		fprintf(stderr, "io_uring is not available\n");
+		return 1;
+	}
+
+	fd = open(path, flags, 0644);
+	if (fd < 0) {
+		fprintf(stderr, "failed to open %s, %m\n", path);
+		return 1;
+	}
+	prefill();
+
+	printf("op\tdepth\tplain IOPS\tus/IO\turing IOPS\tus/IO\n");
+	for (int write = 0; write <= 1; write++) {
+		for (int depth = 1; depth <= MAX_DEPTH; depth *= 4) {
+			printf("%s\t%d", write ? "write" : "read", depth);
+			bench(write, false, depth);
+			bench(write, true, depth);
+			printf("\n");
+		}
+	}
+
+	close(fd);
+	unlink(path);
+
+	return 0;
+}
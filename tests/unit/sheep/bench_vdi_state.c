@@ -0,0 +1,93 @@
+/*
+ * Copyright (C) 2013 Nippon Telegraph and Telephone Corporation.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License version
+ * 2 as published by the Free Software Foundation.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Microbenchmark of the vdi state lookup on the I/O path
+ *
+ * Usage: bench_vdi_state [max threads] [lookups per thread]
+ *
+ * It runs get_vdi_copy_policy(), get_vdi_copy_number() and oid_is_readonly()
+ * (what a gateway request typically calls) from 1, 2, 4, ... threads and
+ * prints the aggregate lookup rate, which should scale with the threads.
+ */
+
+#include <pthread.h>
+
+#include "sheep_priv.h"
+
+#define NR_VDIS		10000
+#define DEFAULT_LOOKUPS	(1 << 22)
+
+static uint32_t vids[NR_VDIS];
+static uint64_t nr_lookups = DEFAULT_LOOKUPS;
+static volatile int sink;
+
+static void *bench_thread(void *arg)
+{
+	uint64_t seed = (uintptr_t)arg + 1;
+	int sum = 0;
+
+	for (uint64_t i = 0; i < nr_lookups; i++) {
+		uint32_t vid;
+
+		seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+		vid = vids[(seed >> 33) % NR_VDIS];
+
+		sum += get_vdi_copy_policy(vid);
+		sum += get_vdi_copy_number(vid);
+		sum += oid_is_readonly(vid_to_data_oid(vid, i));
+	}
+	sink = sum;
+
+	return NULL;
+}
+
+static double run(int nr_threads)
+{
+	pthread_t threads[nr_threads];
+	uint64_t start = clock_get_time();
+
+	for (int i = 0; i < nr_threads; i++)
+		if (pthread_create(threads + i, NULL, bench_thread,
+				   (void *)(uintptr_t)i) != 0)
+			panic("failed to create a thread, %m");
+
+	for (int i = 0; i < nr_threads; i++)
+		pthread_join(threads[i], NULL);
+
+	return (double)(clock_get_time() - start) / 1000000000;
+}
+
+int main(int argc, char **argv)
+{
+	int max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+	if (argc > 1)
+		max_threads = atoi(argv[1]);
+	if (argc > 2)
+		nr_lookups = strtoull(argv[2], NULL, 10);
+
+	srandom(0);
+	for (int i = 0; i < NR_VDIS; i++) {
+		vids[i] = random() % SD_NR_VDIS;
+		add_vdi_state(vids[i], 3, i % 4 == 0, 0);
+	}
+
+	printf("threads\tseconds\tlookups/s\n");
+	for (int n = 1; n <= max_threads; n *= 2) {
+		double sec = run(n);
+
+		/* three lookups per iteration */
+		printf("%d\t%.3f\t%.0f\n", n, sec, 3.0 * nr_lookups * n / sec);
+	}
+
+	return 0;
+}
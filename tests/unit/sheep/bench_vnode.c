@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) 2013 Nippon Telegraph and Telephone Corporation.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License version
+ * 2 as published by the Free Software Foundation.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Microbenchmark of the object placement lookup
+ *
+ * Usage: bench_vnode [max nodes] [lookups]
+ *
+ * For 8, 16, ... nodes with the default number of vnodes, one zone per node,
+ * it places objects with the rbtree (oid_to_vnodes()) and with the flat ring
+ * (ring_oid_to_vnodes()) and prints both lookup rates.
+ */
+
+#include "sheep.h"
+
+#define DEFAULT_LOOKUPS	(1 << 21)
+
+static const int copies[] = { 1, 3, 6 };
+
+static uint64_t nr_lookups = DEFAULT_LOOKUPS;
+static volatile uintptr_t sink;
+
+static double bench_rbtree(struct rb_root *vroot, int nr_copies)
+{
+	const struct sd_vnode *vnodes[SD_MAX_COPIES];
+	uint64_t start = clock_get_time();
+
+	for (uint64_t i = 0; i < nr_lookups; i++) {
+		oid_to_vnodes(vid_to_data_oid(i >> 20, i), vroot, nr_copies,
+			      vnodes);
+		sink += (uintptr_t)vnodes[nr_copies - 1];
+	}
+
+	return nr_lookups / ((double)(clock_get_time() - start) / 1000000000);
+}
+
+static double bench_ring(struct vnode_ring *ring, int nr_copies)
+{
+	const struct sd_vnode *vnodes[SD_MAX_COPIES];
+	uint64_t start = clock_get_time();
+
+	for (uint64_t i = 0; i < nr_lookups; i++) {
+		ring_oid_to_vnodes(vid_to_data_oid(i >> 20, i), ring,
+				   nr_copies, vnodes);
+		sink += (uintptr_t)vnodes[nr_copies - 1];
+	}
+
+	return nr_lookups / ((double)(clock_get_time() - start) / 1000000000);
+}
+
+static void bench(int nr_nodes)
+{
+	struct sd_node *nodes = xzalloc(sizeof(*nodes) * nr_nodes);
+	struct rb_root vroot = RB_ROOT;
+	struct vnode_ring ring;
+
+	for (int i = 0; i < nr_nodes; i++) {
+		/* IPv4 10.0.x.y */
+		nodes[i].nid.addr[12] = 10;
+		nodes[i].nid.addr[14] = i / 256;
+		nodes[i].nid.addr[15] = i % 256;
+		nodes[i].nid.port = 7000;
+		nodes[i].nr_vnodes = SD_DEFAULT_VNODES;
+		nodes[i].zone = i;
+		node_to_vnodes(nodes + i, &vroot);
+	}
+	vnodes_to_ring(&vroot, &ring);
+
+	for (int i = 0; i < ARRAY_SIZE(copies); i++) {
+		double rb, flat;
+
+		if (copies[i] > nr_nodes)
+			continue;
+		rb = bench_rbtree(&vroot, copies[i]);
+		flat = bench_ring(&ring, copies[i]);
+		printf("%d\t%d\t%.0f\t%.0f\t%.2f\n", nr_nodes, copies[i], rb,
+		       flat, flat / rb);
+	}
+
+	free_vnode_ring(&ring);
+	rb_destroy(&vroot, struct sd_vnode, rb);
+	free(nodes);
+}
+
+int main(int argc, char **argv)
+{
+	int max_nodes = 128;
+
+	if (argc > 1)
+		max_nodes = atoi(argv[1]);
+	if (argc > 2)
+		nr_lookups = strtoull(argv[2], NULL, 10);
+
+	printf("nodes\tcopies\trbtree/s\tring/s\tspeedup\n");
+	for (int n = 8; n <= max_nodes; n *= 2)
+		bench(n);
+
+	return 0;
+}
@@ -0,0 +1,120 @@
+/*
+ * Copyright (C) 2013 Nippon Telegraph and Telephone Corporation.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License version
+ * 2 as published by the Free Software Foundation.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Microbenchmark of the work queues
+ *
+ * Usage: bench_work [max threads] [works per run] [queue depth]
+ *
+ * For 1, 2, 4, ... producer threads, each of them queues its share of empty
+ * works to one WQ_UNLIMITED work queue, keeping at most 'queue depth' works
+ * in flight in total, while the main thread runs the event loop until all of
+ * them are done.  It prints the number of works queued, executed and
+ * completed per second.
+ */
+
+#include <pthread.h>
+
+#include "work.h"
+#include "event.h"
+
+#define DEFAULT_WORKS	(1 << 18)
+#define DEFAULT_DEPTH	256
+
+static uint64_t nr_works = DEFAULT_WORKS;
+static uint32_t depth = DEFAULT_DEPTH;
+static uint32_t nr_inflight;
+static uint64_t nr_done;
+
+struct producer {
+	pthread_t thread;
+	struct work_queue *wq;
+	struct work *works;
+	uint64_t nr;
+};
+
+static void work_fn(struct work *work)
+{
+}
+
+static void work_done(struct work *work)
+{
+	nr_done++;
+	uatomic_dec(&nr_inflight);
+}
+
+static void *producer_routine(void *arg)
+{
+	struct producer *p = arg;
+
+	for (uint64_t i = 0; i < p->nr; i++) {
+		while (uatomic_add_return(&nr_inflight, 1) > depth) {
+			uatomic_dec(&nr_inflight);
+			sched_yield();
+		}
+		p->works[i].fn = work_fn;
+		p->works[i].done = work_done;
+		queue_work(p->wq, p->works + i);
+	}
+
+	return NULL;
+}
+
+static double bench(struct work_queue *wq, int nr_threads)
+{
+	struct producer *p = xzalloc(sizeof(*p) * nr_threads);
+	struct work *works = xzalloc(sizeof(*works) * nr_works);
+	uint64_t start = clock_get_time(), per_thread = nr_works / nr_threads;
+
+	nr_done = 0;
+	for (int i = 0; i < nr_threads; i++) {
+		p[i].wq = wq;
+		p[i].works = works + i * per_thread;
+		p[i].nr = per_thread;
+		if (pthread_create(&p[i].thread, NULL, producer_routine, p + i))
+			panic("failed to create a producer, %m");
+	}
+
+	while (nr_done < per_thread * nr_threads)
+		event_loop(-1);
+
+	for (int i = 0; i < nr_threads; i++)
+		pthread_join(p[i].thread, NULL);
+	free(works);
+	free(p);
+
+	return nr_done / ((double)(clock_get_time() - start) / 1000000000);
+}
+
+int main(int argc, char **argv)
+{
+	struct work_queue *wq;
+	int max_threads = 64;
+
+	if (argc > 1)
+		max_threads = atoi(argv[1]);
+	if (argc > 2)
+		nr_works = strtoull(argv[2], NULL, 10);
+	if (argc > 3)
+		depth = atoi(argv[3]);
+
+	if (init_event(4096) < 0 || init_work_queue(NULL) < 0)
+		return 1;
+	wq = create_work_queue("bench", WQ_UNLIMITED);
+	if (!wq)
+		return 1;
+
+	printf("threads\tworks/s\n");
+	for (int n = 1; n <= max_threads; n *= 2)
+		printf("%d\t%.0f\n", n, bench(wq, n));
+
+	return 0;
+}
@@ -23,3 +23,8 @@ MOCK_METHOD(read_backend_object, int, 0,
 	    uint64_t oid, char *data, unsigned int datalen, uint64_t offset)
 MOCK_METHOD(sd_remove_object, int, 0,
 	    uint64_t oid)
+MOCK_VOID_METHOD(fd_cache_del, uint64_t oid, uint8_t ec_index)
+MOCK_VOID_METHOD(fd_cache_purge)
+MOCK_METHOD(get_store_objsize, size_t, SD_DATA_OBJ_SIZE, uint64_t oid)
+MOCK_METHOD(get_store_path, int, 0, uint64_t oid, uint8_t ec_index, char *path)
+MOCK_METHOD(is_erasure_oid, bool, false, uint64_t oid)
@@ -0,0 +1,221 @@
+#include <check.h>
+
+#include "fec.h"
+
+static const char * const kernels[] = { "generic", "ssse3", "avx2" };
+
+static const struct {
+	int d, p;
+} codes[] = {
+	{ 2, 1 }, { 4, 2 }, { 6, 3 }, { 8, 4 }, { 10, 5 }, { 12, 3 },
+	{ 14, 2 }, { 16, 15 },
+};
+
+/* Around the vector widths, plus all the strip sizes of the erasure code */
+static const size_t sizes[] = {
+	1, 15, 16, 17, 31, 32, 33, 63, 64, 65, 102, 170, 512, 4099,
+};
+
+static void fill_random(uint8_t *buf, size_t len)
+{
+	for (size_t i = 0; i < len; i++)
+		buf[i] = random();
+}
+
+/* Encode with the given kernel, misaligning all the buffers by 'off' */
+static void encode(const char *kernel, struct fec *ctx, uint8_t *src,
+		   uint8_t *out, size_t sz, int off)
+{
+	int d = ctx->d, p = ctx->dp - ctx->d;
+	const uint8_t *ds[d];
+	uint8_t *ps[p];
+	int pidx[p];
+
+	for (int i = 0; i < d; i++)
+		ds[i] = src + i * (sz + off) + off;
+	for (int i = 0; i < p; i++) {
+		ps[i] = out + i * (sz + off) + off;
+		pidx[i] = d + i;
+	}
+
+	ck_assert(fec_set_kernel(kernel));
+	fec_encode(ctx, ds, ps, pidx, p, sz);
+}
+
+/* All the kernels must produce the same parity as the generic one */
+START_TEST(test_kernels)
+{
+	init_fec();
+	srandom(0);
+
+	for (int i = 0; i < ARRAY_SIZE(codes); i++) {
+		int d = codes[i].d, p = codes[i].p;
+		struct fec *ctx = ec_init(d, d + p);
+
+		for (int j = 0; j < ARRAY_SIZE(sizes); j++) {
+			for (int off = 0; off < 4; off++) {
+				size_t sz = sizes[j], len = sz + off;
+				uint8_t *src = xmalloc(d * len);
+				uint8_t *expect = xzalloc(p * len);
+				uint8_t *out = xzalloc(p * len);
+
+				fill_random(src, d * len);
+				encode("generic", ctx, src, expect, sz, off);
+
+				for (int k = 1; k < ARRAY_SIZE(kernels); k++) {
+					if (!fec_set_kernel(kernels[k]))
+						continue;
+					memset(out, 0, p * len);
+					encode(kernels[k], ctx, src, out, sz,
+					       off);
+					ck_assert_msg(memcmp(out, expect,
+							     p * len) == 0,
+						      "%s %d:%d size %zu off %d",
+						      kernels[k], d, p, sz, off);
+				}
+				free(src);
+				free(expect);
+				free(out);
+			}
+		}
+		ec_destroy(ctx);
+	}
+}
+END_TEST
+
+/* Any d of the d + p strips must rebuild each of the strips */
+START_TEST(test_decode)
+{
+	init_fec();
+	srandom(0);
+
+	for (int i = 0; i < ARRAY_SIZE(codes); i++) {
+		int d = codes[i].d, p = codes[i].p, dp = d + p;
+		size_t strip_size = SD_EC_DATA_STRIPE_SIZE / d;
+		struct fec *ctx = ec_init(d, dp);
+		uint8_t strips[dp][strip_size], out[strip_size];
+		const uint8_t *ds[d], *input[d];
+		uint8_t *ps[p];
+		int inidx[d];
+
+		for (int j = 0; j < d; j++) {
+			fill_random(strips[j], strip_size);
+			ds[j] = strips[j];
+		}
+		for (int j = 0; j < p; j++)
+			ps[j] = strips[d + j];
+		ec_encode(ctx, ds, ps);
+
+		/* lose the strips [lost, lost + p) and rebuild each of them */
+		for (int lost = 0; lost + p <= dp; lost++) {
+			int n = 0;
+
+			for (int j = 0; j < dp && n < d; j++) {
+				if (j >= lost && j < lost + p)
+					continue;
+				input[n] = strips[j];
+				inidx[n++] = j;
+			}
+			ck_assert_int_eq(n, d);
+
+			for (int j = lost; j < lost + p; j++) {
+				ec_decode(ctx, input, inidx, out, j);
+				ck_assert_msg(memcmp(out, strips[j],
+						     strip_size) == 0,
+					      "%s %d:%d strip %d",
+					      fec_kernel_name(), d, p, j);
+			}
+		}
+		ec_destroy(ctx);
+	}
+}
+END_TEST
+
+/* Contexts are shared, and the cached decode matrices give the same result */
+START_TEST(test_cache)
+{
+	int d = 4, p = 2, inidx[] = { 1, 2, 4, 5 };
+	size_t strip_size = SD_EC_DATA_STRIPE_SIZE / d;
+	struct fec *ctx, *other;
+	uint8_t strips[d + p][strip_size], out[strip_size];
+	const uint8_t *ds[d], *input[d];
+	uint8_t *ps[p];
+
+	init_fec();
+	srandom(0);
+
+	ctx = ec_init(d, d + p);
+	other = ec_init(d, d + p);
+	ck_assert_ptr_eq(ctx, other);
+	ec_destroy(other);
+	other = ec_init(d, d + p + 1);
+	ck_assert_ptr_ne(ctx, other);
+	ec_destroy(other);
+
+	for (int i = 0; i < d; i++) {
+		fill_random(strips[i], strip_size);
+		ds[i] = strips[i];
+	}
+	for (int i = 0; i < p; i++)
+		ps[i] = strips[d + i];
+	ec_encode(ctx, ds, ps);
+
+	for (int i = 0; i < d; i++)
+		input[i] = strips[inidx[i]];
+
+	/* the first call fills the cache, the others hit it */
+	for (int i = 0; i < 3; i++) {
+		ec_decode(ctx, input, inidx, out, 0);
+		ck_assert(memcmp(out, strips[0], strip_size) == 0);
+		ec_decode(ctx, input, inidx, out, 3);
+		ck_assert(memcmp(out, strips[3], strip_size) == 0);
+	}
+
+	/* switching the lost strips replaces the cached matrices */
+	for (int i = 0; i < 2 * 15; i++) {
+		int a = i % 5, b = a + 1 + i / 3 % (5 - a), n = 0;
+
+		for (int j = 0; j < d + p; j++) {
+			if (j == a || j == b)
+				continue;
+			input[n] = strips[j];
+			inidx[n++] = j;
+		}
+		ec_decode(ctx, input, inidx, out, a);
+		ck_assert(memcmp(out, strips[a], strip_size) == 0);
+		ec_decode(ctx, input, inidx, out, b);
+		ck_assert(memcmp(out, strips[b], strip_size) == 0);
+	}
+	ec_destroy(ctx);
+}
+END_TEST
+
+static Suite *test_suite(void)
+{
+	Suite *s = suite_create("test fec");
+
+	TCase *tc_kernel = tcase_create("kernel");
+	TCase *tc_decode = tcase_create("decode");
+	TCase *tc_cache = tcase_create("cache");
+
+	tcase_add_test(tc_kernel, test_kernels);
+	tcase_add_test(tc_decode, test_decode);
+	tcase_add_test(tc_cache, test_cache);
+
+	suite_add_tcase(s, tc_kernel);
+	suite_add_tcase(s, tc_decode);
+	suite_add_tcase(s, tc_cache);
+
+	return s;
+}
+
+int main(void)
+{
+	int number_failed;
+	Suite *s = test_suite();
+	SRunner *sr = srunner_create(s);
+	srunner_run_all(sr, CK_NORMAL);
+	number_failed = srunner_ntests_failed(sr);
+	srunner_free(sr);
+	return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -337,6 +337,45 @@ START_TEST(test_nodes_dispersion)
 }
 END_TEST
 
+/* the flat ring must place the objects on the same vnodes as the rbtree */
+START_TEST(test_vnode_ring)
+{
+	static const int zones[] = { 1, 2, 3, 7, 20, 60 };
+	struct sd_node nodes[60];
+
+	for (int z = 0; z < ARRAY_SIZE(zones); z++) {
+		int nr_copies = min(zones[z], SD_MAX_COPIES);
+		struct rb_root vroot = RB_ROOT;
+		struct vnode_ring ring;
+
+		memset(nodes, 0, sizeof(nodes));
+		for (int i = 0; i < ARRAY_SIZE(nodes); i++) {
+			nodes[i].nid.addr[12] = 10;
+			nodes[i].nid.addr[15] = i;
+			nodes[i].nid.port = 7000;
+			nodes[i].nr_vnodes = SD_DEFAULT_VNODES;
+			nodes[i].zone = i % zones[z];
+			node_to_vnodes(nodes + i, &vroot);
+		}
+		vnodes_to_ring(&vroot, &ring);
+
+		for (int i = 0; i < DATA_SIZE; i++) {
+			const struct sd_vnode *expect[SD_MAX_COPIES];
+			const struct sd_vnode *got[SD_MAX_COPIES];
+			uint64_t oid = vid_to_data_oid(z, i);
+
+			oid_to_vnodes(oid, &vroot, nr_copies, expect);
+			ring_oid_to_vnodes(oid, &ring, nr_copies, got);
+			ck_assert(memcmp(expect, got,
+					 sizeof(*got) * nr_copies) == 0);
+		}
+
+		free_vnode_ring(&ring);
+		rb_destroy(&vroot, struct sd_vnode, rb);
+	}
+}
+END_TEST
+
 static size_t (*gen_disks)(struct disk *disks, int idx);
 
 /* generate one disk who has many virtual disks */
@@ -552,6 +591,7 @@ static Suite *test_suite(void)
 	TCase *tc_nodes3 = tcase_create("many daemons with some vnodes");
 	TCase *tc_nodes4 = tcase_create("many nodes with one vnode");
 	TCase *tc_nodes5 = tcase_create("many nodes with some vnodes");
+	TCase *tc_ring = tcase_create("vnode ring");
 	TCase *tc_disks1 = tcase_create("many vdisks on one disk");
 	TCase *tc_disks2 = tcase_create("many disks with one vdisk");
 	TCase *tc_disks3 = tcase_create("many disks with some vdisks");
@@ -582,6 +622,7 @@ static Suite *test_suite(void)
 	tcase_add_test(tc_nodes4, test_nodes_dispersion);
 	tcase_add_test(tc_nodes5, test_nodes_update);
 	tcase_add_test(tc_nodes5, test_nodes_dispersion);
+	tcase_add_test(tc_ring, test_vnode_ring);
 	tcase_add_test(tc_disks1, test_disks_dispersion);
 	tcase_add_test(tc_disks2, test_disks_update);
 	tcase_add_test(tc_disks2, test_disks_dispersion);
@@ -595,6 +636,7 @@ static Suite *test_suite(void)
 	suite_add_tcase(s, tc_nodes1);
 	suite_add_tcase(s, tc_nodes2);
 	suite_add_tcase(s, tc_nodes3);
+	suite_add_tcase(s, tc_ring);
 	suite_add_tcase(s, tc_disks1);
 	suite_add_tcase(s, tc_disks2);
 	suite_add_tcase(s, tc_objects1);
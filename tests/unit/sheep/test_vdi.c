@@ -17,9 +17,9 @@
 
 START_TEST(test_vdi)
 {
-	add_vdi_state(1, 1, true);
-	add_vdi_state(2, 1, true);
-	add_vdi_state(3, 2, false);
+	add_vdi_state(1, 1, true, 0);
+	add_vdi_state(2, 1, true, 0);
+	add_vdi_state(3, 2, false, 0);
 
 	ck_assert_int_eq(get_vdi_copy_number(1), 1);
 	ck_assert_int_eq(get_vdi_copy_number(2), 1);
@@ -27,12 +27,45 @@ START_TEST(test_vdi)
 }
 END_TEST
 
+START_TEST(test_vdi_state)
+{
+	struct vdi_state vs, list[4];
+	uint32_t vid = SD_NR_VDIS - 1;
+
+	clean_vdi_state();
+	ck_assert(!get_vdi_state(vid, &vs));
+
+	add_vdi_state(vid, 6, false, 0x42);
+	ck_assert(get_vdi_state(vid, &vs));
+	ck_assert_int_eq(vs.vid, vid);
+	ck_assert_int_eq(vs.nr_copies, 6);
+	ck_assert_int_eq(vs.snapshot, 0);
+	ck_assert_int_eq(vs.copy_policy, 0x42);
+
+	/* update in place */
+	add_vdi_state(vid, 6, true, 0x42);
+	ck_assert(get_vdi_state(vid, &vs));
+	ck_assert_int_eq(vs.snapshot, 1);
+
+	add_vdi_state(0x10, 3, false, 0);
+	ck_assert_int_eq(fill_vdi_state_list(list), 2 * sizeof(list[0]));
+	ck_assert_int_eq(list[0].vid, 0x10);
+	ck_assert_int_eq(list[1].vid, vid);
+
+	clean_vdi_state();
+	ck_assert(!get_vdi_state(vid, &vs));
+	ck_assert(!get_vdi_state(0x10, &vs));
+	ck_assert_int_eq(fill_vdi_state_list(list), 0);
+}
+END_TEST
+
 static Suite *test_suite(void)
 {
 	Suite *s = suite_create("test vdi");
 
 	TCase *tc_vdi = tcase_create("vdi");
 	tcase_add_test(tc_vdi, test_vdi);
+	tcase_add_test(tc_vdi, test_vdi_state);
 
 	suite_add_tcase(s, tc_vdi);
 